@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "pandora/buffer.h"
+
+#define BENCH_BYTES (64 * 1024 * 1024)
+#define BENCH_LINE 100
+#define BENCH_ROUNDS 5
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* fill a fresh buffer with 64 MiB of lines, the way a batch grows */
+static double fill(int flags)
+{
+    char line[BENCH_LINE];
+    buffer_t buf;
+    double start, elapsed;
+    size_t i;
+
+    memset(line, 'x', BENCH_LINE - 1);
+    line[BENCH_LINE - 1] = '\n';
+
+    start = now_sec();
+    buffer_init(&buf, 4096, flags);
+    for (i = 0; i < BENCH_BYTES / BENCH_LINE; i++)
+        buffer_write(&buf, line, BENCH_LINE);
+    elapsed = now_sec() - start;
+    buffer_destroy(&buf);
+
+    return elapsed;
+}
+
+/* each mode runs in its own process, so that the peak RSS is its own */
+static void run(const char *name, int flags)
+{
+    struct rusage usage;
+    double best = 0, elapsed;
+    int fds[2], status, i;
+    pid_t pid;
+
+    if (pipe(fds) != 0)
+        return;
+
+    pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        for (i = 0; i < BENCH_ROUNDS; i++) {
+            elapsed = fill(flags);
+            if (i == 0 || elapsed < best)
+                best = elapsed;
+        }
+        if (write(fds[1], &best, sizeof(best)) != sizeof(best))
+            _exit(1);
+        _exit(0);
+    }
+
+    close(fds[1]);
+    if (pid < 0 || read(fds[0], &best, sizeof(best)) != sizeof(best))
+        best = -1;
+    close(fds[0]);
+    if (pid > 0 && wait4(pid, &status, 0, &usage) == pid)
+        printf("%-12s %8.2f ms  %8ld KiB peak RSS\n", name, best * 1000, usage.ru_maxrss);
+}
+
+int main(void)
+{
+    run("contiguous", BUFFER_GROWABLE);
+    run("segmented", BUFFER_SEGMENTED);
+
+    return 0;
+}
@@ -0,0 +1,168 @@
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pandora/client.h"
+#include "sink.h"
+
+#define BENCH_MAX_LINES (4 * 1024 * 1024)
+#define BENCH_PAD "the quick brown fox jumps over the lazy dog, the quick brown fox jumps over the lazy dog"
+
+/* the sink is posted to by the flusher thread and records how old each line is when it arrives */
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static double ages[BENCH_MAX_LINES];
+static long received;
+
+static char cachedir[PATH_MAX];
+static char results[16][160];
+static int nresults;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void record_lines(const s_sink_request *request, s_sink_reply *reply, void *userdata)
+{
+    double now = now_ms();
+    char *line = request->body, *end = request->body + request->len, *t;
+
+    (void)reply;
+    (void)userdata;
+
+    pthread_mutex_lock(&mutex);
+    while (line < end) {
+        /* the body is not NUL terminated, every line of it ends in a newline */
+        char *nl = memchr(line, '\n', end - line);
+        if (!nl)
+            break;
+        *nl = '\0';
+        t = strstr(line, "t=");
+        if (t && received < BENCH_MAX_LINES)
+            ages[received++] = now - strtod(t + 2, NULL) / 1000;
+        line = nl + 1;
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+static void clear_dir(void)
+{
+    char path[PATH_MAX * 2];
+    struct dirent *entry;
+    DIR *dirp = opendir(cachedir);
+
+    if (!dirp)
+        return;
+    while ((entry = readdir(dirp)) != NULL) {
+        if (strncmp(entry->d_name, "cache.", 6) != 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", cachedir, entry->d_name);
+        unlink(path);
+    }
+    closedir(dirp);
+}
+
+static int compare(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Write batches of points stamped with the time of the write every interval_ms for seconds, then
+ * stay quiet for quiet_ms and report the age of the lines which arrived by then
+ */
+static void run(const char *name, int port, e_cache_policy policy, int threshold, size_t max_bytes, int max_age_ms,
+                int points, int interval_ms, int seconds, int quiet_ms)
+{
+    s_client_params params;
+    s_pandora_client *client;
+    char host[64];
+    double start, p50, p99, max;
+    long sent = 0, got;
+    int i;
+
+    snprintf(host, sizeof(host), "http://127.0.0.1:%d", port);
+    memset(&params, 0, sizeof(params));
+    params.pipeline_host = host;
+    params.access_key = "ak";
+    params.secret_key = "sk";
+
+    client = pandora_client_init(&params);
+    if (!client || pandora_client_set_cache_policy(client, policy, threshold, cachedir) != PANDORAE_OK ||
+        pandora_client_set_durability(client, DURABILITY_NONE, 0, 0) != PANDORAE_OK ||
+        (max_age_ms >= 0 && pandora_client_set_cache_limits(client, max_bytes, max_age_ms) != PANDORAE_OK)) {
+        fprintf(stderr, "cannot set up a cached client in %s\n", cachedir);
+        return;
+    }
+
+    pthread_mutex_lock(&mutex);
+    received = 0;
+    pthread_mutex_unlock(&mutex);
+
+    start = now_ms();
+    while (now_ms() - start < seconds * 1000.0) {
+        s_data_points *data = data_points_create();
+        for (i = 0; i < points; i++) {
+            data_points_begin_point(data);
+            data_points_add_int64(data, "t", (long long)(now_ms() * 1000));
+            data_points_add_string(data, "pad", BENCH_PAD);
+            data_points_end_point(data);
+        }
+        if (pandora_client_write(client, "bench", data) == PANDORAE_OK)
+            sent += points;
+        data_points_destroy(data);
+        if (interval_ms > 0)
+            usleep(interval_ms * 1000);
+    }
+    usleep(quiet_ms * 1000);
+
+    pthread_mutex_lock(&mutex);
+    got = received;
+    qsort(ages, got, sizeof(double), compare);
+    p50 = got ? ages[got / 2] : 0;
+    p99 = got ? ages[got * 99 / 100] : 0;
+    max = got ? ages[got - 1] : 0;
+    pthread_mutex_unlock(&mutex);
+
+    snprintf(results[nresults++], sizeof(results[0]), "%-34s %8ld sent %8ld arrived  age p50 %7.0f ms  p99 %7.0f ms  max %7.0f ms",
+             name, sent, got, p50, p99, max);
+
+    /* what did not arrive stays on disk for pandora_client_write_cached, dropped here */
+    pandora_client_cleanup(client);
+    clear_dir();
+}
+
+int main(int argc, char **argv)
+{
+    int port = sink_start(record_lines, NULL);
+    int i;
+
+    if (port < 0) {
+        perror("listen");
+        return 1;
+    }
+    snprintf(cachedir, sizeof(cachedir), "%s", argc > 1 ? argv[1] : "./bench_cache_age");
+
+    /* a quiet producer: a point every 100 ms for 3 s, then nothing for 3 s */
+    run("trickle, by size 8 MiB", port, CACHE_BY_SIZE, 8 << 20, 0, -1, 1, 100, 3, 3000);
+    run("trickle, by time 1 s", port, CACHE_BY_TIME, 1, 0, -1, 1, 100, 3, 3000);
+    run("trickle, size or time 8 MiB/500 ms", port, CACHE_BY_SIZE_OR_TIME, 8 << 20, 8 << 20, 500, 1, 100, 3, 3000);
+
+    /* a busy producer: 1000 points every 2 ms for 3 s */
+    run("busy, by size 8 MiB", port, CACHE_BY_SIZE, 8 << 20, 0, -1, 1000, 2, 3, 3000);
+    run("busy, size or time 8 MiB/500 ms", port, CACHE_BY_SIZE_OR_TIME, 8 << 20, 8 << 20, 500, 1000, 2, 3, 3000);
+
+    for (i = 0; i < nresults; i++)
+        printf("%s\n", results[i]);
+
+    rmdir(cachedir);
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pandora/client.h"
+#include "sink.h"
+
+#define BENCH_WRITES 50
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* every reply is held back by the latency, as a remote server would */
+static void delay(const s_sink_request *request, s_sink_reply *reply, void *userdata)
+{
+    (void)request;
+    (void)reply;
+    usleep(*(const int *)userdata * 1000);
+}
+
+typedef struct {
+    s_pandora_client *client;
+    long writes;
+} s_writer;
+
+static void *writer_run(void *arg)
+{
+    s_writer *writer = (s_writer *)arg;
+    s_data_points *data = data_points_create();
+    int i;
+
+    data_points_begin_point(data);
+    data_points_add_int64(data, "seq", 0);
+    data_points_add_string(data, "msg", "the quick brown fox jumps over the lazy dog");
+    data_points_end_point(data);
+
+    for (i = 0; i < BENCH_WRITES; i++) {
+        if (pandora_client_write(writer->client, "bench", data) == PANDORAE_OK)
+            writer->writes++;
+    }
+
+    data_points_destroy(data);
+    return NULL;
+}
+
+/* nthreads writers sharing one NO_CACHE client, each making BENCH_WRITES writes */
+static void run(int port, int latency_ms, int nthreads)
+{
+    s_client_params params;
+    s_writer writers[64];
+    pthread_t threads[64];
+    s_pandora_client *client;
+    char host[64];
+    long writes = 0;
+    double start, elapsed;
+    int i;
+
+    snprintf(host, sizeof(host), "http://127.0.0.1:%d", port);
+    memset(&params, 0, sizeof(params));
+    params.pipeline_host = host;
+    params.access_key = "ak";
+    params.secret_key = "sk";
+    client = pandora_client_init(&params);
+    if (!client)
+        return;
+    pandora_client_set_max_connections(client, nthreads);
+
+    start = now_sec();
+    for (i = 0; i < nthreads; i++) {
+        writers[i].client = client;
+        writers[i].writes = 0;
+        pthread_create(&threads[i], NULL, writer_run, &writers[i]);
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+        writes += writers[i].writes;
+    }
+    elapsed = now_sec() - start;
+
+    /* writers which never wait on each other reach nthreads requests per latency */
+    printf("%2d threads x %d writes, %3d ms latency %8.0f writes/s  (no contention: %6.0f)\n", nthreads,
+           BENCH_WRITES, latency_ms, writes / elapsed, nthreads * 1000.0 / latency_ms);
+    pandora_client_cleanup(client);
+}
+
+int main(int argc, char **argv)
+{
+    static int latency_ms;
+    int port, nthreads;
+
+    latency_ms = argc > 1 ? atoi(argv[1]) : 20;
+    if (latency_ms <= 0)
+        latency_ms = 20;
+    port = sink_start(delay, &latency_ms);
+    if (port < 0) {
+        perror("listen");
+        return 1;
+    }
+
+    for (nthreads = 1; nthreads <= 16; nthreads *= 2)
+        run(port, latency_ms, nthreads);
+
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pandora/client.h"
+
+#define BENCH_SECONDS 2
+#define BENCH_POINTS 10
+
+static char cachedir[PATH_MAX];
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void clear_dir(void)
+{
+    char path[PATH_MAX * 2];
+    struct dirent *entry;
+    DIR *dirp = opendir(cachedir);
+
+    if (!dirp)
+        return;
+    while ((entry = readdir(dirp)) != NULL) {
+        if (strncmp(entry->d_name, "cache.", 6) != 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", cachedir, entry->d_name);
+        unlink(path);
+    }
+    closedir(dirp);
+}
+
+typedef struct {
+    s_pandora_client *client;
+    double deadline;
+    long writes;
+} s_writer;
+
+/* cached writes of a 10 point batch, none of which reaches the network */
+static void *writer_run(void *arg)
+{
+    s_writer *writer = (s_writer *)arg;
+    s_data_points *data = data_points_create();
+    int i;
+
+    for (i = 0; i < BENCH_POINTS; i++) {
+        data_points_begin_point(data);
+        data_points_add_int64(data, "seq", i);
+        data_points_add_string(data, "msg", "the quick brown fox jumps over the lazy dog");
+        data_points_end_point(data);
+    }
+
+    while (now_sec() < writer->deadline) {
+        if (pandora_client_write(writer->client, "bench", data) != PANDORAE_OK)
+            break;
+        writer->writes++;
+    }
+
+    data_points_destroy(data);
+    return NULL;
+}
+
+static void run(const char *name, e_durability mode, int interval_ms, int nthreads)
+{
+    s_client_params params;
+    s_writer writers[16];
+    pthread_t threads[16];
+    s_pandora_client *client;
+    long writes = 0;
+    double start;
+    int i;
+
+    memset(&params, 0, sizeof(params));
+    params.pipeline_host = "http://127.0.0.1:1";
+    params.access_key = "ak";
+    params.secret_key = "sk";
+
+    client = pandora_client_init(&params);
+    if (!client || pandora_client_set_cache_policy(client, CACHE_BY_SIZE, INT_MAX, cachedir) != PANDORAE_OK ||
+        pandora_client_set_durability(client, mode, interval_ms, 0) != PANDORAE_OK) {
+        fprintf(stderr, "cannot set up a cached client in %s\n", cachedir);
+        return;
+    }
+
+    start = now_sec();
+    for (i = 0; i < nthreads; i++) {
+        writers[i].client = client;
+        writers[i].deadline = start + BENCH_SECONDS;
+        writers[i].writes = 0;
+        pthread_create(&threads[i], NULL, writer_run, &writers[i]);
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+        writes += writers[i].writes;
+    }
+
+    printf("%-16s %2d threads %10.0f writes/s\n", name, nthreads, writes / (now_sec() - start));
+
+    pandora_client_cleanup(client);
+    clear_dir();
+}
+
+int main(int argc, char **argv)
+{
+    int threads[] = { 1, 4 };
+    int i;
+
+    snprintf(cachedir, sizeof(cachedir), "%s", argc > 1 ? argv[1] : "./bench_durability");
+
+    for (i = 0; i < 2; i++) {
+        run("none", DURABILITY_NONE, 0, threads[i]);
+        run("periodic 100ms", DURABILITY_PERIODIC, 100, threads[i]);
+        run("group commit", DURABILITY_GROUP_COMMIT, 0, threads[i]);
+    }
+
+    rmdir(cachedir);
+    return 0;
+}
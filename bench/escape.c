@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "escape.h"
+
+#define BENCH_BYTES (256L * 1024 * 1024)
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int copy_value(char *out, const char *src, size_t len, size_t *written)
+{
+    memcpy(out, src, len);
+    *written = len;
+    return 1;
+}
+
+/* MB/s of input run through escape over values of len bytes */
+static double run(int (*escape)(char *, const char *, size_t, size_t *), const char *src, size_t len, char *out)
+{
+    long i, n = BENCH_BYTES / len;
+    size_t written, total = 0;
+    double start = now_sec();
+
+    for (i = 0; i < n; i++) {
+        escape(out, src, len, &written);
+        total += written;
+    }
+    if (total == 0)
+        printf("nothing written\n");
+
+    return n * len / (now_sec() - start) / (1024 * 1024);
+}
+
+/* len bytes of text: pure ASCII, ASCII with a tab every 64 bytes, or 3 byte UTF-8 (CJK) */
+static void fill(char *buf, size_t len, int kind)
+{
+    static const char cjk[] = "\xe4\xb8\x83";
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        buf[i] = (char)('a' + i % 26);
+    if (kind == 1) {
+        for (i = 63; i < len; i += 64)
+            buf[i] = '\t';
+    } else if (kind == 2) {
+        for (i = 0; i + 3 <= len; i += 3)
+            memcpy(buf + i, cjk, 3);
+    }
+}
+
+int main(void)
+{
+    static const size_t lengths[] = { 8, 32, 128, 1024, 16384 };
+    static const char *kinds[] = { "ascii", "ascii+tab", "utf8" };
+    char *src = malloc(16384), *out = malloc(ESCAPE_MAX_SIZE(16384));
+    size_t i;
+    int kind;
+
+    printf("kernel: %s, MB/s of input\n", escape_kernel());
+    printf("%-10s %6s %10s %10s %10s\n", "text", "len", "memcpy", "scalar", escape_kernel());
+    for (kind = 0; kind < 3; kind++) {
+        for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+            fill(src, lengths[i], kind);
+            printf("%-10s %6zu %10.0f %10.0f %10.0f\n", kinds[kind], lengths[i],
+                   run(copy_value, src, lengths[i], out), run(escape_value_scalar, src, lengths[i], out),
+                   run(escape_value, src, lengths[i], out));
+        }
+    }
+
+    free(src);
+    free(out);
+    return 0;
+}
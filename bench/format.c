@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "pandora/client.h"
+
+#define BENCH_POINTS 1000000
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* One snprintf per field, with the formats point_entry_append_* used before format.c */
+#define PRINTF_FIELD(data, sep, format, key, value) do { \
+        char field[400]; \
+        int n = snprintf(field, sizeof(field), format, key, value); \
+        buffer_write((data)->buf, field, n); \
+        buffer_append((data)->buf, sep); \
+    } while (0)
+
+static void printf_ints(s_data_points *data, long i)
+{
+    PRINTF_FIELD(data, '\t', "%s=%ld", "a", i);
+    PRINTF_FIELD(data, '\t', "%s=%lld", "b", 1234567890123LL * i);
+    PRINTF_FIELD(data, '\t', "%s=%ld", "c", -i);
+    PRINTF_FIELD(data, '\n', "%s=%lld", "d", (long long)i << 20);
+}
+
+static void builder_ints(s_data_points *data, long i)
+{
+    data_points_begin_point(data);
+    data_points_add_int32(data, "a", i);
+    data_points_add_int64(data, "b", 1234567890123LL * i);
+    data_points_add_int32(data, "c", -i);
+    data_points_add_int64(data, "d", (long long)i << 20);
+    data_points_end_point(data);
+}
+
+/* measurements with few significant digits */
+static void printf_floats(s_data_points *data, long i)
+{
+    PRINTF_FIELD(data, '\t', "%s=%f", "a", 0.25f * (i % 1000));
+    PRINTF_FIELD(data, '\t', "%s=%lf", "b", 12.5 + i % 100);
+    PRINTF_FIELD(data, '\t', "%s=%f", "c", 0.75f);
+    PRINTF_FIELD(data, '\n', "%s=%lf", "d", 0.001 * (i % 5000));
+}
+
+static void builder_floats(s_data_points *data, long i)
+{
+    data_points_begin_point(data);
+    data_points_add_float32(data, "a", 0.25f * (i % 1000));
+    data_points_add_float64(data, "b", 12.5 + i % 100);
+    data_points_add_float32(data, "c", 0.75f);
+    data_points_add_float64(data, "d", 0.001 * (i % 5000));
+    data_points_end_point(data);
+}
+
+/* values %f cuts short, the shortest round trip needs up to 17 digits */
+static void printf_ratios(s_data_points *data, long i)
+{
+    PRINTF_FIELD(data, '\t', "%s=%f", "a", 1.0f / (i + 1));
+    PRINTF_FIELD(data, '\n', "%s=%lf", "b", 1e-3 / (i + 1));
+}
+
+static void builder_ratios(s_data_points *data, long i)
+{
+    data_points_begin_point(data);
+    data_points_add_float32(data, "a", 1.0f / (i + 1));
+    data_points_add_float64(data, "b", 1e-3 / (i + 1));
+    data_points_end_point(data);
+}
+
+static void run(const char *name, void (*encode)(s_data_points *, long))
+{
+    s_data_points *data = data_points_create();
+    double start = now_sec(), elapsed;
+    long i;
+
+    for (i = 0; i < BENCH_POINTS; i++)
+        encode(data, i);
+    elapsed = now_sec() - start;
+
+    printf("%-16s %10.0f points/s  %10zu bytes\n", name, BENCH_POINTS / elapsed, data->buf->written);
+    data_points_destroy(data);
+}
+
+int main(void)
+{
+    run("ints snprintf", printf_ints);
+    run("ints builder", builder_ints);
+    run("floats snprintf", printf_floats);
+    run("floats builder", builder_floats);
+    run("ratios snprintf", printf_ratios);
+    run("ratios builder", builder_ratios);
+
+    return 0;
+}
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "pandora/client.h"
+
+#define BENCH_POINTS 1000000
+
+#ifdef __GLIBC__
+/* count heap allocations made by the SDK by wrapping the glibc allocator */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static long allocations = 0;
+
+void *malloc(size_t size) { allocations++; return __libc_malloc(size); }
+void *calloc(size_t nmemb, size_t size) { allocations++; return __libc_calloc(nmemb, size); }
+void *realloc(void *ptr, size_t size) { allocations++; return __libc_realloc(ptr, size); }
+#else
+static long allocations = -1;
+#endif
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fill_entry(s_point_entry *pentry, long i)
+{
+    point_entry_append_string(pentry, "host", "web-01");
+    point_entry_append_int32(pentry, "status", 200 + i % 5);
+    point_entry_append_int64(pentry, "bytes", 1234567890123LL + i);
+    point_entry_append_float32(pentry, "load", 0.75f);
+    point_entry_append_float64(pentry, "latency", 12.5 + i % 100);
+    point_entry_append_boolean(pentry, "cached", i & 1);
+}
+
+/* a fresh s_point_entry for every point */
+static void encode_entry(s_data_points *data, long i)
+{
+    s_point_entry *pentry = point_entry_create();
+    fill_entry(pentry, i);
+    data_points_append(data, pentry);
+    point_entry_destroy(pentry);
+}
+
+/* one s_point_entry cleared between points */
+static s_point_entry *reused;
+
+static void encode_reused(s_data_points *data, long i)
+{
+    point_entry_clear(reused);
+    fill_entry(reused, i);
+    data_points_append(data, reused);
+}
+
+static void encode_builder(s_data_points *data, long i)
+{
+    data_points_begin_point(data);
+    data_points_add_string(data, "host", "web-01");
+    data_points_add_int32(data, "status", 200 + i % 5);
+    data_points_add_int64(data, "bytes", 1234567890123LL + i);
+    data_points_add_float32(data, "load", 0.75f);
+    data_points_add_float64(data, "latency", 12.5 + i % 100);
+    data_points_add_boolean(data, "cached", i & 1);
+    data_points_end_point(data);
+}
+
+enum { HOST, STATUS, BYTES, LOAD, LATENCY, CACHED };
+
+static s_pandora_schema *schema;
+
+static void encode_schema(s_data_points *data, long i)
+{
+    data_points_begin_point(data);
+    data_points_add_field_string(data, schema, HOST, "web-01");
+    data_points_add_field_int32(data, schema, STATUS, 200 + i % 5);
+    data_points_add_field_int64(data, schema, BYTES, 1234567890123LL + i);
+    data_points_add_field_float32(data, schema, LOAD, 0.75f);
+    data_points_add_field_float64(data, schema, LATENCY, 12.5 + i % 100);
+    data_points_add_field_boolean(data, schema, CACHED, i & 1);
+    data_points_end_point(data);
+}
+
+/* struct-of-arrays input, appended BENCH_CHUNK rows at a time */
+#define BENCH_CHUNK 10000
+
+static const char *hosts[BENCH_POINTS];
+static long statuses[BENCH_POINTS];
+static long long bytes[BENCH_POINTS];
+static float loads[BENCH_POINTS];
+static double latencies[BENCH_POINTS];
+static int cached[BENCH_POINTS];
+
+static void fill_columns(void)
+{
+    long i;
+
+    for (i = 0; i < BENCH_POINTS; i++) {
+        hosts[i] = "web-01";
+        statuses[i] = 200 + i % 5;
+        bytes[i] = 1234567890123LL + i;
+        loads[i] = 0.75f;
+        latencies[i] = 12.5 + i % 100;
+        cached[i] = i & 1;
+    }
+}
+
+static void encode_columns(s_data_points *data, long i)
+{
+    const void *columns[] = { hosts + i, statuses + i, bytes + i, loads + i, latencies + i, cached + i };
+
+    if (i % BENCH_CHUNK == 0)
+        data_points_append_columns(data, schema, columns, BENCH_CHUNK);
+}
+
+static s_data_points *run(const char *name, void (*encode)(s_data_points *, long))
+{
+    s_data_points *data = data_points_create();
+    double start, elapsed;
+    long before, i;
+
+    /* size the batch first, so growing it does not count against the encoder */
+    for (i = 0; i < BENCH_POINTS; i++)
+        encode(data, i);
+    data_points_clear(data);
+
+    before = allocations;
+    start = now_sec();
+    for (i = 0; i < BENCH_POINTS; i++)
+        encode(data, i);
+    elapsed = now_sec() - start;
+
+    printf("%-12s %10.0f points/s  %zu bytes  %ld allocations\n", name, BENCH_POINTS / elapsed,
+           data->buf->written, allocations < 0 ? -1 : allocations - before);
+    return data;
+}
+
+/* small batches created, filled and destroyed one after another, as a producer hands them off */
+static void churn(void)
+{
+    s_data_points *data;
+    double start, elapsed;
+    long before, i, j;
+
+    before = allocations;
+    start = now_sec();
+    for (i = 0; i < BENCH_POINTS / BENCH_CHUNK; i++) {
+        data = data_points_create();
+        for (j = 0; j < BENCH_CHUNK; j++)
+            encode_builder(data, i * BENCH_CHUNK + j);
+        data_points_destroy(data);
+    }
+    elapsed = now_sec() - start;
+
+    printf("%-12s %10.0f batches/s  %ld allocations\n", "batch churn", BENCH_POINTS / BENCH_CHUNK / elapsed,
+           allocations < 0 ? -1 : allocations - before);
+}
+
+/* the batches are segmented, and not necessarily at the same offsets */
+static int same_output(s_data_points *a, s_data_points *b)
+{
+    size_t offset, len, alen, blen;
+    const char *pa, *pb;
+
+    if (a->buf->written != b->buf->written)
+        return 0;
+    for (offset = 0; offset < a->buf->written; offset += len) {
+        pa = buffer_chunk(a->buf, offset, &alen);
+        pb = buffer_chunk(b->buf, offset, &blen);
+        len = alen < blen ? alen : blen;
+        if (memcmp(pa, pb, len) != 0)
+            return 0;
+    }
+    return 1;
+}
+
+int main(void)
+{
+    const char *keys[] = { "host", "status", "bytes", "load", "latency", "cached" };
+    const e_field_type types[] = { FIELD_STRING, FIELD_INT32, FIELD_INT64, FIELD_FLOAT32, FIELD_FLOAT64, FIELD_BOOLEAN };
+    s_data_points *entry, *reuse, *builder, *schemed, *columns;
+    int same;
+
+    reused = point_entry_create();
+    schema = pandora_schema_create("bench", keys, types, 6);
+    fill_columns();
+    entry = run("entry", encode_entry);
+    reuse = run("entry reuse", encode_reused);
+    builder = run("builder", encode_builder);
+    schemed = run("schema", encode_schema);
+    columns = run("columns", encode_columns);
+    same = same_output(entry, reuse) && same_output(entry, builder) && same_output(entry, schemed) &&
+           same_output(entry, columns);
+
+    printf("output %s\n", same ? "identical" : "DIFFERS");
+    churn();
+    point_entry_destroy(reused);
+    pandora_schema_destroy(schema);
+    data_points_destroy(entry);
+    data_points_destroy(reuse);
+    data_points_destroy(builder);
+    data_points_destroy(schemed);
+    data_points_destroy(columns);
+
+    return same ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "pandora/client.h"
+#include "sink.h"
+
+#define BENCH_SECONDS 2
+#define BENCH_LINE "the quick brown fox jumps over the lazy dog"
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* with close set the sink ends every connection after its reply, the cost of no reuse */
+static void reply(const s_sink_request *request, s_sink_reply *reply, void *userdata)
+{
+    (void)request;
+    if (*(const int *)userdata)
+        reply->headers = "Connection: close\r\n";
+}
+
+typedef struct {
+    s_pandora_client *client;
+    int points;
+    double deadline;
+    long writes;
+} s_writer;
+
+static void *writer_run(void *arg)
+{
+    s_writer *writer = (s_writer *)arg;
+    s_data_points *data = data_points_create();
+    int i;
+
+    for (i = 0; i < writer->points; i++) {
+        data_points_begin_point(data);
+        data_points_add_int64(data, "seq", i);
+        data_points_add_string(data, "msg", BENCH_LINE);
+        data_points_end_point(data);
+    }
+
+    while (now_sec() < writer->deadline) {
+        if (pandora_client_write(writer->client, "bench", data) != PANDORAE_OK)
+            break;
+        writer->writes++;
+    }
+
+    data_points_destroy(data);
+    return NULL;
+}
+
+/*
+ * nthreads writers of batches of points each for BENCH_SECONDS; a batch larger than body_size
+ * goes out as several bodies in parallel
+ */
+static void run(const char *name, int port, int nthreads, int points, size_t body_size)
+{
+    s_client_params params;
+    s_writer writers[16];
+    pthread_t threads[16];
+    s_pandora_client *client;
+    char host[64];
+    long writes = 0;
+    double start, elapsed;
+    int i;
+
+    snprintf(host, sizeof(host), "http://127.0.0.1:%d", port);
+    memset(&params, 0, sizeof(params));
+    params.pipeline_host = host;
+    params.access_key = "ak";
+    params.secret_key = "sk";
+    client = pandora_client_init(&params);
+    if (!client)
+        return;
+    pandora_client_set_max_connections(client, nthreads * 8);
+    if (body_size > 0)
+        pandora_client_set_max_body_size(client, body_size);
+
+    start = now_sec();
+    for (i = 0; i < nthreads; i++) {
+        writers[i].client = client;
+        writers[i].points = points;
+        writers[i].deadline = start + BENCH_SECONDS;
+        writers[i].writes = 0;
+        pthread_create(&threads[i], NULL, writer_run, &writers[i]);
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+        writes += writers[i].writes;
+    }
+    elapsed = now_sec() - start;
+
+    printf("%-40s %10.0f writes/s\n", name, writes / elapsed);
+    pandora_client_cleanup(client);
+}
+
+int main(void)
+{
+    static int keep_alive = 0, close_each = 1;
+    int reuse = sink_start(reply, &keep_alive);
+    int fresh = sink_start(reply, &close_each);
+
+    if (reuse < 0 || fresh < 0) {
+        perror("listen");
+        return 1;
+    }
+
+    run("1 thread, 1 point, keep-alive", reuse, 1, 1, 0);
+    run("1 thread, 1 point, connection per request", fresh, 1, 1, 0);
+    run("4 threads, 1 point, keep-alive", reuse, 4, 1, 0);
+    run("4 threads, 1 point, connection per request", fresh, 4, 1, 0);
+
+    /* 2000 points cut into 8 KiB bodies, posted in parallel over one multi handle */
+    run("1 thread, 2000 points, 8 KiB bodies, keep-alive", reuse, 1, 2000, 8192);
+    run("1 thread, 2000 points, 8 KiB bodies, per request", fresh, 1, 2000, 8192);
+    run("4 threads, 2000 points, 8 KiB bodies, keep-alive", reuse, 4, 2000, 8192);
+    run("4 threads, 2000 points, 8 KiB bodies, per request", fresh, 4, 2000, 8192);
+
+    return 0;
+}
@@ -0,0 +1,229 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pandora/buffer.h"
+#include "internal.h"
+#include "wal.h"
+
+#define BENCH_BYTES (512 * 1024 * 1024)
+#define BENCH_RECORD (64 * 1024)
+#define BENCH_LINE 100
+#define BENCH_BODY (2 * 1024 * 1024)
+#define BENCH_BODIES 8
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double elapsed, size_t bytes, size_t bodies)
+{
+    printf("%-22s %8.1f ms %8.2f GiB/s %8zu bodies\n", name, elapsed * 1000,
+           bytes / elapsed / (1024.0 * 1024 * 1024), bodies);
+}
+
+/* the cuts the replay makes before posting, every body is what a transfer would send */
+static size_t slice(s_pandora_client *client, const buffer_t *buf, size_t len)
+{
+    size_t pos, piece, bodies = 0;
+
+    for (pos = 0; pos < len; pos += piece, bodies++)
+        piece = pandora_client_next_slice(client, buf, pos, len - pos);
+    return bodies;
+}
+
+static void write_segment(const char *path)
+{
+    char line[BENCH_LINE];
+    buffer_t record;
+    size_t size = WAL_MAGIC_SIZE, i;
+    int fd;
+
+    memset(line, 'x', BENCH_LINE - 1);
+    line[BENCH_LINE - 1] = '\n';
+    buffer_init(&record, 0, BUFFER_SEGMENTED);
+    for (i = 0; i + BENCH_LINE <= BENCH_RECORD; i += BENCH_LINE)
+        buffer_write(&record, line, BENCH_LINE);
+
+    fd = wal_create(path);
+    for (i = 0; fd >= 0 && size < BENCH_BYTES; i++)
+        wal_append(fd, &size, "bench", &record, 0, BUFFER_SIZE(&record));
+    if (fd >= 0)
+        close(fd);
+    buffer_destroy(&record);
+}
+
+/* records read into a buffer of up to one body, as replay did before segments were mapped */
+static void replay_copy(s_pandora_client *client, const char *path)
+{
+    s_wal_reader reader;
+    buffer_t body;
+    size_t bytes = 0, bodies = 0;
+    double start = now_sec();
+
+    if (wal_open(&reader, path) != 1)
+        return;
+    buffer_init(&body, 0, BUFFER_SEGMENTED);
+    while (wal_next(&reader) > 0) {
+        if (BUFFER_SIZE(&body) > 0 && BUFFER_SIZE(&body) + reader.length > BENCH_BODY) {
+            bodies += slice(client, &body, BUFFER_SIZE(&body));
+            bytes += BUFFER_SIZE(&body);
+            buffer_reset(&body);
+        }
+        if (wal_read(&reader, &body) <= 0)
+            break;
+    }
+    bodies += slice(client, &body, BUFFER_SIZE(&body));
+    bytes += BUFFER_SIZE(&body);
+    buffer_destroy(&body);
+    wal_close(&reader);
+
+    report("segment, read + copy", now_sec() - start, bytes, bodies);
+}
+
+/* payloads chained as extents of the mapping */
+static void replay_map(s_pandora_client *client, const char *path)
+{
+    s_wal_reader reader;
+    buffer_t body;
+    const char *payload;
+    size_t bytes = 0, bodies = 0;
+    double start = now_sec();
+
+    if (wal_open(&reader, path) != 1)
+        return;
+    if (!wal_map(&reader) || !buffer_init_extents(&body)) {
+        wal_close(&reader);
+        return;
+    }
+    while (wal_next(&reader) > 0) {
+        if (BUFFER_SIZE(&body) > 0 && BUFFER_SIZE(&body) + reader.length > BENCH_BODIES * BENCH_BODY) {
+            bodies += slice(client, &body, BUFFER_SIZE(&body));
+            bytes += BUFFER_SIZE(&body);
+            buffer_reset(&body);
+        }
+        payload = wal_payload(&reader);
+        if (!payload || !buffer_add_extent(&body, payload, reader.length))
+            break;
+    }
+    bodies += slice(client, &body, BUFFER_SIZE(&body));
+    bytes += BUFFER_SIZE(&body);
+    buffer_destroy(&body);
+    wal_close(&reader);
+
+    report("segment, mapped", now_sec() - start, bytes, bodies);
+}
+
+static void write_text(const char *path)
+{
+    char line[BENCH_LINE];
+    FILE *fp = fopen(path, "w");
+    size_t i;
+
+    if (!fp)
+        return;
+    memset(line, 'x', BENCH_LINE - 1);
+    line[BENCH_LINE - 1] = '\n';
+    for (i = 0; i < BENCH_BYTES; i += BENCH_LINE)
+        fwrite(line, 1, BENCH_LINE, fp);
+    fclose(fp);
+}
+
+/* fgets into a stack buffer and a copy of each line, as the text format was replayed before */
+static void replay_text_copy(s_pandora_client *client, const char *path)
+{
+    static char line[128 * 1024];
+    FILE *fp = fopen(path, "r");
+    buffer_t body;
+    size_t bytes = 0, bodies = 0, len;
+    double start = now_sec();
+
+    if (!fp)
+        return;
+    buffer_init(&body, 0, BUFFER_SEGMENTED);
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        len = strlen(line);
+        if (BUFFER_SIZE(&body) + len > BENCH_BODY) {
+            bodies += slice(client, &body, BUFFER_SIZE(&body));
+            bytes += BUFFER_SIZE(&body);
+            buffer_reset(&body);
+        }
+        buffer_write(&body, line, len);
+    }
+    bodies += slice(client, &body, BUFFER_SIZE(&body));
+    bytes += BUFFER_SIZE(&body);
+    buffer_destroy(&body);
+    fclose(fp);
+
+    report("text, fgets + copy", now_sec() - start, bytes, bodies);
+}
+
+static void replay_text_map(s_pandora_client *client, const char *path)
+{
+    struct stat st;
+    buffer_t body;
+    double start = now_sec();
+    size_t bodies;
+    void *map;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) != 0)
+        return;
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return;
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    buffer_init_extents(&body);
+    buffer_add_extent(&body, map, (size_t)st.st_size);
+    bodies = slice(client, &body, BUFFER_SIZE(&body));
+    buffer_destroy(&body);
+    munmap(map, (size_t)st.st_size);
+
+    report("text, mapped", now_sec() - start, (size_t)st.st_size, bodies);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = argc > 1 ? argv[1] : ".";
+    s_client_params params;
+    s_pandora_client *client;
+    char path[4096];
+    int pass;
+
+    memset(&params, 0, sizeof(params));
+    params.access_key = "ak";
+    params.secret_key = "sk";
+    client = pandora_client_init(&params);
+    if (!client)
+        return 1;
+    pandora_client_set_max_body_size(client, BENCH_BODY);
+
+    /* the second pass reads from the page cache, which is what the CPU cost is measured on */
+    snprintf(path, sizeof(path), "%s/bench_replay.seg", dir);
+    write_segment(path);
+    for (pass = 0; pass < 2; pass++) {
+        replay_copy(client, path);
+        replay_map(client, path);
+    }
+    unlink(path);
+
+    snprintf(path, sizeof(path), "%s/bench_replay.txt", dir);
+    write_text(path);
+    for (pass = 0; pass < 2; pass++) {
+        replay_text_copy(client, path);
+        replay_text_map(client, path);
+    }
+    unlink(path);
+
+    pandora_client_cleanup(client);
+    return 0;
+}
@@ -0,0 +1,157 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "pandora/client.h"
+
+#define BENCH_MESSAGES 4000000
+#define BENCH_LINE 100
+#define BENCH_RING (4 * 1024 * 1024)
+#define BENCH_BODY (2 * 1024 * 1024)
+#define BENCH_QUEUE 4
+
+static char line[BENCH_LINE + 1];
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double elapsed, size_t bytes)
+{
+    printf("%-10s %8.2f M msgs/s  %8.1f MiB/s\n", name, BENCH_MESSAGES / elapsed / 1e6,
+           bytes / elapsed / (1024 * 1024));
+}
+
+/* ring: the producer copies lines in, the consumer takes line-aligned bodies in place */
+static buffer_t ring;
+static int ring_done;
+
+static void *ring_producer(void *arg)
+{
+    size_t i;
+    char *dest;
+
+    (void)arg;
+    for (i = 0; i < BENCH_MESSAGES; i++) {
+        while ((dest = buffer_ring_reserve(&ring, BENCH_LINE)) == NULL)
+            sched_yield();
+        memcpy(dest, line, BENCH_LINE);
+        buffer_ring_commit(&ring, BENCH_LINE);
+    }
+    __atomic_store_n(&ring_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void bench_ring(void)
+{
+    pthread_t thread;
+    size_t bytes = 0, len;
+    double start;
+    int done;
+
+    if (!buffer_ring_init(&ring, BENCH_RING))
+        return;
+
+    start = now_sec();
+    pthread_create(&thread, NULL, ring_producer, NULL);
+    for (;;) {
+        done = __atomic_load_n(&ring_done, __ATOMIC_ACQUIRE);
+        buffer_ring_peek_lines(&ring, BENCH_BODY, &len);
+        if (len == 0) {
+            if (done)
+                break;
+            sched_yield();
+            continue;
+        }
+        buffer_ring_consume(&ring, len);
+        bytes += len;
+    }
+    pthread_join(thread, NULL);
+    report("ring", now_sec() - start, bytes);
+
+    buffer_destroy(&ring);
+}
+
+/* handoff: the producer fills batches and queues them under a mutex, the consumer frees them */
+static s_data_points *queue[BENCH_QUEUE];
+static int queue_count, queue_done;
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+
+static void queue_push(s_data_points *data)
+{
+    pthread_mutex_lock(&queue_mutex);
+    while (queue_count == BENCH_QUEUE)
+        pthread_cond_wait(&queue_cond, &queue_mutex);
+    queue[queue_count++] = data;
+    pthread_cond_broadcast(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+}
+
+static void *handoff_producer(void *arg)
+{
+    s_data_points *data = data_points_create();
+    size_t i;
+
+    (void)arg;
+    for (i = 0; i < BENCH_MESSAGES; i++) {
+        buffer_write(data->buf, line, BENCH_LINE);
+        data->point_count++;
+        if (BUFFER_SIZE(data->buf) + BENCH_LINE > BENCH_BODY) {
+            queue_push(data);
+            data = data_points_create();
+        }
+    }
+    queue_push(data);
+
+    pthread_mutex_lock(&queue_mutex);
+    queue_done = 1;
+    pthread_cond_broadcast(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+    return NULL;
+}
+
+static void bench_handoff(void)
+{
+    pthread_t thread;
+    s_data_points *data;
+    size_t bytes = 0;
+    double start;
+
+    start = now_sec();
+    pthread_create(&thread, NULL, handoff_producer, NULL);
+    for (;;) {
+        pthread_mutex_lock(&queue_mutex);
+        while (queue_count == 0 && !queue_done)
+            pthread_cond_wait(&queue_cond, &queue_mutex);
+        if (queue_count == 0) {
+            pthread_mutex_unlock(&queue_mutex);
+            break;
+        }
+        data = queue[0];
+        memmove(queue, queue + 1, sizeof(queue[0]) * --queue_count);
+        pthread_cond_broadcast(&queue_cond);
+        pthread_mutex_unlock(&queue_mutex);
+
+        bytes += BUFFER_SIZE(data->buf);
+        data_points_destroy(data);
+    }
+    pthread_join(thread, NULL);
+    report("handoff", now_sec() - start, bytes);
+}
+
+int main(void)
+{
+    memset(line, 'x', BENCH_LINE - 1);
+    line[BENCH_LINE - 1] = '\n';
+
+    bench_handoff();
+    bench_ring();
+
+    return 0;
+}
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pandora/client.h"
+#include "compress.h"
+#include "sink.h"
+
+#define BENCH_HITS 50000
+#define BENCH_SEARCHES 50
+
+static buffer_t plain;
+static buffer_t encoded;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the same result, gzip encoded or as is depending on the sink */
+static void search(const s_sink_request *request, s_sink_reply *reply, void *userdata)
+{
+    (void)request;
+    if (*(const int *)userdata) {
+        reply->headers = "Content-Encoding: gzip\r\n";
+        reply->body = encoded.data;
+        reply->len = BUFFER_SIZE(&encoded);
+    } else {
+        reply->body = plain.data;
+        reply->len = BUFFER_SIZE(&plain);
+    }
+}
+
+/* BENCH_SEARCHES searches for the whole result, the mean time until the decoded JSON is at hand */
+static void run(const char *name, int port, size_t wire)
+{
+    s_client_params params;
+    s_search_params sp;
+    s_pandora_client *client;
+    char host[64];
+    char *result;
+    double start, elapsed;
+    int i, done = 0;
+
+    snprintf(host, sizeof(host), "http://127.0.0.1:%d", port);
+    memset(&params, 0, sizeof(params));
+    params.insight_host = host;
+    params.access_key = "ak";
+    params.secret_key = "sk";
+    client = pandora_client_init(&params);
+    if (!client)
+        return;
+
+    memset(&sp, 0, sizeof(sp));
+    sp.query = "*";
+    sp.size = BENCH_HITS;
+
+    start = now_sec();
+    for (i = 0; i < BENCH_SEARCHES; i++) {
+        result = NULL;
+        if (pandora_client_insight_search(client, "bench", &sp, &result) != PANDORAE_OK || !result ||
+            strlen(result) != BUFFER_SIZE(&plain)) {
+            free(result);
+            break;
+        }
+        free(result);
+        done++;
+    }
+    elapsed = now_sec() - start;
+
+    if (done > 0)
+        printf("%-10s %9zu bytes on the wire  %9zu decoded  %8.2f ms/search\n", name, wire, BUFFER_SIZE(&plain),
+               elapsed * 1000 / done);
+    else
+        printf("%-10s search failed\n", name);
+    pandora_client_cleanup(client);
+}
+
+int main(void)
+{
+    static int as_is = 0, gzip = 1;
+    char hit[160];
+    double start, deflate_ms;
+    int identity_port, gzip_port, i, len;
+
+    if (!buffer_init(&plain, 0, BUFFER_GROWABLE) || !buffer_init(&encoded, 0, BUFFER_GROWABLE))
+        return 1;
+    len = snprintf(hit, sizeof(hit), "{\"total\":%d,\"data\":[", BENCH_HITS);
+    buffer_write(&plain, hit, len);
+    for (i = 0; i < BENCH_HITS; i++) {
+        len = snprintf(hit, sizeof(hit), "%s{\"seq\":%d,\"host\":\"web-%d\",\"msg\":\"the quick brown fox jumps over the lazy dog\"}",
+                       i ? "," : "", i, i % 16);
+        buffer_write(&plain, hit, len);
+    }
+    buffer_write(&plain, "]}", 2);
+
+    start = now_sec();
+    if (!gzip_compress(&plain, 0, BUFFER_SIZE(&plain), 6, &encoded))
+        return 1;
+    deflate_ms = (now_sec() - start) * 1000;
+
+    identity_port = sink_start(search, &as_is);
+    gzip_port = sink_start(search, &gzip);
+    if (identity_port < 0 || gzip_port < 0) {
+        perror("listen");
+        return 1;
+    }
+
+    printf("%d hits, %.1f%% of the size once gzip encoded (%.2f ms on the server side)\n", BENCH_HITS,
+           100.0 * BUFFER_SIZE(&encoded) / BUFFER_SIZE(&plain), deflate_ms);
+    run("identity", identity_port, BUFFER_SIZE(&plain));
+    run("gzip", gzip_port, BUFFER_SIZE(&encoded));
+
+    buffer_destroy(&plain);
+    buffer_destroy(&encoded);
+    return 0;
+}
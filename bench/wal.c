@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pandora/buffer.h"
+#include "wal.h"
+
+#define BENCH_BYTES (256 * 1024 * 1024)
+#define BENCH_LINE 100
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fill(buffer_t *buf, size_t len)
+{
+    char line[BENCH_LINE];
+    size_t i;
+
+    memset(line, 'x', BENCH_LINE - 1);
+    line[BENCH_LINE - 1] = '\n';
+    for (i = 0; i + BENCH_LINE <= len; i += BENCH_LINE)
+        buffer_write(buf, line, BENCH_LINE);
+}
+
+/* append BENCH_BYTES in records of record bytes, with an fdatasync every sync_every records (0 for none) */
+static void append(const char *path, size_t record, int sync_every, size_t total)
+{
+    buffer_t buf;
+    size_t size = WAL_MAGIC_SIZE, i, n = total / record;
+    double start, elapsed;
+    int fd;
+
+    buffer_init(&buf, 0, BUFFER_SEGMENTED);
+    fill(&buf, record);
+
+    fd = wal_create(path);
+    if (fd < 0) {
+        perror(path);
+        buffer_destroy(&buf);
+        return;
+    }
+
+    start = now_sec();
+    for (i = 0; i < n; i++) {
+        wal_append(fd, &size, "bench", &buf, 0, BUFFER_SIZE(&buf));
+        if (sync_every > 0 && (i + 1) % sync_every == 0)
+            wal_sync(fd);
+    }
+    elapsed = now_sec() - start;
+    close(fd);
+
+    printf("append %7zu B records, %-13s %10.0f records/s %8.1f MiB/s\n", record,
+           sync_every == 0 ? "no sync" : sync_every == 1 ? "sync each" : "sync every 64",
+           n / elapsed, n * (double)BUFFER_SIZE(&buf) / elapsed / (1024 * 1024));
+    buffer_destroy(&buf);
+}
+
+static void recover(const char *path, const char *name)
+{
+    double start = now_sec();
+    long records = wal_recover(path);
+    double elapsed = now_sec() - start;
+
+    printf("recover %-28s %8ld records %8.1f ms\n", name, records, elapsed * 1000);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = argc > 1 ? argv[1] : ".";
+    char path[4096];
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "%s/bench_wal.seg", dir);
+
+    append(path, 1024, 0, BENCH_BYTES);
+    append(path, 64 * 1024, 0, BENCH_BYTES);
+    append(path, 1024 * 1024, 0, BENCH_BYTES);
+    append(path, 64 * 1024, 64, BENCH_BYTES);
+    append(path, 64 * 1024, 1, BENCH_BYTES / 16);
+    append(path, 1024, 1, BENCH_BYTES / 1024);
+
+    /* a full segment, checked from the page cache */
+    append(path, 64 * 1024, 0, BENCH_BYTES);
+    recover(path, "256 MiB, clean");
+
+    /* the same with half a record torn off the end */
+    fp = fopen(path, "ab");
+    if (fp) {
+        fwrite("\x00\x00\x01\x00garbage", 1, 11, fp);
+        fclose(fp);
+    }
+    recover(path, "256 MiB, torn tail");
+
+    unlink(path);
+    return 0;
+}
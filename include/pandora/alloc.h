@@ -0,0 +1,65 @@
+#ifndef PANDORA_C_ALLOC_H
+#define PANDORA_C_ALLOC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+
+#include "error.h"
+
+typedef struct {
+    void *(*malloc_fn)(size_t size, void *userdata);
+    void *(*realloc_fn)(void *ptr, size_t size, void *userdata);
+    void (*free_fn)(void *ptr, void *userdata);
+    void *userdata;
+} s_pandora_allocator;
+
+typedef struct {
+    size_t bytes_in_use;    /* bytes the SDK asked for and has not freed yet */
+    size_t peak_bytes;      /* highest bytes_in_use so far */
+    size_t allocations;     /* live allocations */
+    size_t budget;          /* set by pandora_set_memory_budget, 0 for none */
+} s_pandora_memory_stats;
+
+/**
+ * Route every allocation of the SDK through allocator, or back to the C library with NULL:
+ * buffers, batches, cJSON, zlib and, when the application has not initialized libcurl yet,
+ * libcurl too. Call it once at startup, before any other SDK call; returns
+ * PANDORAE_INVALID_ARGUMENT if memory of the SDK is still in use
+ */
+pandora_error_t pandora_set_allocator(const s_pandora_allocator *allocator);
+
+/**
+ * Memory used by the SDK through pandora_malloc and friends
+ */
+void pandora_get_memory_stats(s_pandora_memory_stats *stats);
+
+/**
+ * Cap the memory of the SDK, across all clients, at max_bytes (0 for no cap). Over the budget,
+ * batches and buffer segments are freed instead of kept for reuse and async writes apply the
+ * queue policy of the sender, see pandora_client_start_async. Allocations themselves never fail
+ * because of the budget
+ */
+void pandora_set_memory_budget(size_t max_bytes);
+
+/**
+ * 1 when a budget is set and the SDK uses more than it, 0 otherwise
+ */
+int pandora_memory_over_budget(void);
+
+/**
+ * The SDK's allocation functions, for buffers handed to the SDK like those of buffer_adopt and
+ * the arrays buffer_detach returns. Search results come from malloc() and go back with free()
+ */
+void *pandora_malloc(size_t size);
+void *pandora_calloc(size_t nmemb, size_t size);
+void *pandora_realloc(void *ptr, size_t size);
+void pandora_free(void *ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //PANDORA_C_ALLOC_H
@@ -5,34 +5,61 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
 #include <stdlib.h>
 
 typedef enum {
     BUFFER_OWNS_SELF    = 1, /* buffer struct will be freed by buffer_destroy() */
     BUFFER_OWNS_DATA    = 2, /* buffer data will be freed by buffer_destroy() */
-    BUFFER_GROWABLE     = 4  /* buffer can grow dynamically to accommodate new data */
+    BUFFER_GROWABLE     = 4, /* buffer can grow dynamically to accommodate new data */
+    BUFFER_SEGMENTED    = 8, /* buffer grows by chaining pooled segments, data already written never moves */
+    BUFFER_RING         = 16, /* single-producer single-consumer ring, see buffer_ring_init() */
+    BUFFER_EXTENTS      = 32  /* read only chain of memory owned elsewhere, see buffer_init_extents() */
 } buffer_flags_t;
 
+/* Size of the pooled segments of a BUFFER_SEGMENTED buffer */
+#define BUFFER_SEGMENT_SIZE (64 * 1024)
+
+typedef struct {
+    char   *data;
+    size_t start;       /* offset of the segment within the buffer */
+    size_t capacity;
+} buffer_segment_t;
+
+/*
+ * A buffer is one contiguous array, or with BUFFER_SEGMENTED a chain of segments of which
+ * data/capacity describe the last one, starting at offset base. Use buffer_chunk() to read a
+ * segmented buffer, BUFFER_RESET, BUFFER_GET and BUFFER_CAPACITY assume a contiguous one.
+ * With BUFFER_RING, written and read are free-running cursors of the producer and the consumer,
+ * only to be used through the buffer_ring_* functions and buffer_chunk(). With BUFFER_EXTENTS the
+ * segments point into memory the buffer does not own and can only be read with buffer_chunk()
+ */
 typedef struct {
     int    flags;
     char   *data;
     size_t capacity;
     size_t written;
     size_t read;
+    size_t base;
+    buffer_segment_t *segments;
+    int    nsegments;       /* segments holding data */
+    int    nallocated;      /* segments allocated, those past nsegments are kept for reuse */
+    int    max_segments;
 } buffer_t;
 
 #define BUFFER_RESET(b)             ((b)->written = 0, (b)->read = 0)
-#define BUFFER_APPEND(b, byte)      ((b)->data[(b)->written++] = (byte))
+#define BUFFER_APPEND(b, byte)      ((b)->data[(b)->written++ - (b)->base] = (byte))
 #define BUFFER_GET(b)               ((b)->data[(b)->read++])
 #define BUFFER_CAPACITY(b)          ((b)->capacity)
 #define BUFFER_SIZE(b)              ((b)->written)
-#define BUFFER_REMAIN(b)            ((b)->capacity - (b)->written)
+#define BUFFER_REMAIN(b)            ((b)->capacity - ((b)->written - (b)->base))
 #define BUFFER_IS_EMPTY(b)          ((b)->written == 0)
-#define BUFFER_IS_FULL(b)           ((b)->written == (b)->capacity)
+#define BUFFER_IS_FULL(b)           (BUFFER_REMAIN(b) == 0)
 #define BUFFER_TELL(b)              ((b)->read)
 #define BUFFER_EOF(b)               ((b)->read == (b)->written)
 #define BUFFER_REWIND(b)            ((b)->read = 0)
 #define BUFFER_SEEK(b, offset)      ((b)->read = (offset))
+#define BUFFER_TAIL(b)              ((b)->data + ((b)->written - (b)->base))
 
 /**
  * Initialize an existing buffer with an existing data array of given length
@@ -41,10 +68,17 @@ void buffer_init_static(buffer_t *buffer, char *data, size_t size);
 
 /**
  * Initial an existing buffer with dynamically allocated data array of a known size
- * implies BUFFER_OWNS_DATA
+ * implies BUFFER_OWNS_DATA. With BUFFER_SEGMENTED size is that of the first segment only, later
+ * ones take BUFFER_SEGMENT_SIZE or more
  */
 int buffer_init(buffer_t *buffer, size_t size, int flags);
 
+/**
+ * Initialize an existing buffer with len bytes of data, an array of capacity bytes from
+ * pandora_malloc() the buffer takes ownership of. implies BUFFER_OWNS_DATA
+ */
+void buffer_adopt(buffer_t *buffer, char *data, size_t len, size_t capacity, int flags);
+
 /**
  * Allocate a new buffer with a given initial size and flags
  * implies BUFFER_OWNS_SELF | BUFFER_OWNS_DATA
@@ -73,6 +107,121 @@ int buffer_append(buffer_t *buffer, char byte);
  */
 int buffer_write(buffer_t *buffer, const char *data, size_t len);
 
+/*
+ * Make room for len more contiguous bytes at BUFFER_TAIL, so that writes of up to len bytes in
+ * total need no further allocation. returns 1 on success, 0 if the buffer cannot grow that far
+ */
+int buffer_reserve(buffer_t *buffer, size_t len);
+
+/*
+ * Append value in decimal, returns 1 on success, 0 on failure
+ */
+int buffer_append_u64(buffer_t *buffer, uint64_t value);
+
+/*
+ * Append value in decimal with its sign, returns 1 on success, 0 on failure
+ */
+int buffer_append_i64(buffer_t *buffer, int64_t value);
+
+/*
+ * Append the shortest decimal which reads back as exactly value, returns 1 on success, 0 on failure
+ */
+int buffer_append_double(buffer_t *buffer, double value);
+
+/*
+ * Like buffer_append_double, shortest for the precision of a float
+ */
+int buffer_append_float(buffer_t *buffer, float value);
+
+/*
+ * Append len bytes of UTF-8 text at src with tab, newline and backslash written as "\t", "\n" and
+ * "\\". All or nothing; returns 1 on success, 0 on failure and -1 if src is not valid UTF-8
+ */
+int buffer_append_escaped(buffer_t *buffer, const char *src, size_t len);
+
+/*
+ * Take the data out of buffer without copying it: returns the array, to be released with
+ * pandora_free() by the caller, and sets *len to its size when len is not NULL. The buffer is left empty.
+ * Returns NULL if the buffer does not own its data, or holds it in more than one segment
+ */
+char *buffer_detach(buffer_t *buffer, size_t *len);
+
+/*
+ * Give memory not holding data back until no more than keep bytes are allocated, or as close to
+ * that as the data allows
+ */
+void buffer_trim(buffer_t *buffer, size_t keep);
+
+/*
+ * Free the segments kept for reuse by BUFFER_SEGMENTED buffers
+ */
+void buffer_pool_trim(void);
+
+/*
+ * Drop everything past the first size bytes
+ */
+void buffer_truncate(buffer_t *buffer, size_t size);
+
+/*
+ * Contiguous bytes at offset: returns a pointer to them and sets *len to how many there are,
+ * up to the end of the data or of the segment holding offset. For a ring, offset is a cursor
+ * between read and written and everything up to written is contiguous
+ */
+const char *buffer_chunk(const buffer_t *buffer, size_t offset, size_t *len);
+
+/*
+ * Initialize an empty buffer of extents, such as ranges of a file mapping, which are read in the
+ * order they are added as if they were one array. returns 1 on success, 0 on failure
+ */
+int buffer_init_extents(buffer_t *buffer);
+
+/*
+ * Append len bytes at data, which must stay valid and unchanged until the buffer is reset or
+ * destroyed. An extent which continues the last one only makes it longer.
+ * returns 1 on success, 0 on failure
+ */
+int buffer_add_extent(buffer_t *buffer, const char *data, size_t len);
+
+/*
+ * Initialize a ring of at least size bytes, rounded up to a power of two pages, for one producer
+ * and one consumer thread with no lock. The pages are mapped twice in a row, outside of
+ * pandora_malloc(), so that data never wraps: any range between read and written is contiguous.
+ * returns 1 on success, 0 on failure
+ */
+int buffer_ring_init(buffer_t *buffer, size_t size);
+
+/*
+ * Producer: room for len contiguous bytes, or NULL while the consumer has not freed that much.
+ * Nothing is visible to the consumer before buffer_ring_commit()
+ */
+char *buffer_ring_reserve(buffer_t *buffer, size_t len);
+
+/*
+ * Producer: publish the first len bytes of the last reservation
+ */
+void buffer_ring_commit(buffer_t *buffer, size_t len);
+
+/*
+ * Producer: copy len bytes in and publish them. All or nothing; returns 0 if the ring lacks room
+ */
+int buffer_ring_write(buffer_t *buffer, const char *data, size_t len);
+
+/*
+ * Consumer: the published bytes from the read cursor, *len set to how many there are
+ */
+const char *buffer_ring_peek(buffer_t *buffer, size_t *len);
+
+/*
+ * Consumer: like buffer_ring_peek, cut after the last newline within max bytes, or after the
+ * first one if that line alone is longer. *len is 0 while no line is complete
+ */
+const char *buffer_ring_peek_lines(buffer_t *buffer, size_t max, size_t *len);
+
+/*
+ * Consumer: release len bytes from the read cursor to the producer
+ */
+void buffer_ring_consume(buffer_t *buffer, size_t len);
+
 /**
  * Reads a single character buffer from the buffer
  */
@@ -10,9 +10,12 @@ extern "C" {
 #include <time.h>
 #include <limits.h>
 
+#include "alloc.h"
 #include "buffer.h"
 #include "error.h"
 
+#define PANDORA_DEFAULT_MAX_CONNECTIONS 8
+
 typedef struct {
     char *pipeline_host;
     char *insight_host;
@@ -25,8 +28,27 @@ typedef enum {
     NO_CACHE,
     CACHE_BY_SIZE,
     CACHE_BY_TIME,
+    CACHE_BY_SIZE_OR_TIME,      /* whichever of pandora_client_set_cache_limits comes first */
 } e_cache_policy;
 
+typedef enum {
+    DURABILITY_GROUP_COMMIT,    /* a cached write returns once on disk, concurrent writers share one fdatasync */
+    DURABILITY_PERIODIC,        /* a background thread syncs every interval_ms or interval_bytes */
+    DURABILITY_NONE,            /* left to the page cache, lost on a crash of the machine */
+} e_durability;
+
+typedef struct {
+    int pending_segments;               /* sealed cache files waiting to be replayed, the one in progress included */
+    size_t pending_bytes;
+    int flushing;                       /* a cache file is being replayed right now */
+    unsigned long long flushed_segments;
+    unsigned long long flushed_bytes;
+    pandora_error_t last_error;         /* of the last replay, PANDORAE_OK once one succeeds */
+    time_t last_flush;                  /* when a cache file was last replayed in full, 0 if never */
+} s_flush_status;
+
+struct s_cache_segment;
+
 typedef struct {
     int initialized;
 
@@ -34,19 +56,87 @@ typedef struct {
     int threshold;
 
     char *cachedir;
-    FILE *fileptr;
-    int filesize;
+    int fd;                 /* current segment, opened O_APPEND, -1 when none */
+    size_t filesize;
     char filename[FILENAME_MAX];
-    FILE *oldpf;
-    char oldfn[FILENAME_MAX];
 
-    unsigned int start;
+    /* group commit: bytes appended and made durable across segments, one fdatasync at a time */
+    unsigned long long appended;
+    unsigned long long synced;
+    int syncing;
+    pthread_cond_t sync_done;
+
+    e_durability durability;
+    int sync_interval_ms;
+    size_t sync_interval_bytes;
+    pthread_t syncer;           /* runs with DURABILITY_PERIODIC */
+    int syncer_running;
+    int syncer_stop;
+    pthread_cond_t sync_wanted;
+
+    /* sealed segments, replayed in order by the flusher thread */
+    struct s_cache_segment *sealed_head;
+    struct s_cache_segment *sealed_tail;
+    struct s_cache_segment *flushing;
+    pthread_t flusher;
+    int flusher_running;
+    int flusher_stop;
+    pthread_cond_t flush_wanted;
+    s_flush_status flush_status;
+
+    /* a segment is sealed at max_bytes or once its oldest record is max_age_ms old, 0 for no limit */
+    size_t max_bytes;
+    int max_age_ms;
+    long long first_append_ms;  /* monotonic time of the oldest record in the current segment, 0 when empty */
+    unsigned int seq;
 } s_cache_control;
 
 typedef struct {
     pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    CURLSH *share;
+    pthread_mutex_t share_locks[CURL_LOCK_DATA_LAST];
+
+    CURL **idle;
+    int nidle;
+    int active;
+    int max_handles;
+
+    /* multi handles of finished transfer runs, each with the connections it opened */
+    CURLM **idle_multi;
+    int nidle_multi;
+} s_curl_pool;
+
+typedef struct {
+    int base_ms;            /* backoff before the first retry, doubled for every further retry */
+    int cap_ms;             /* upper bound of a single backoff */
+    int jitter;             /* percent of each backoff which is randomized, 0-100 */
+    int deadline_ms;        /* give up once a write would take longer than this, 0 for no deadline */
+    int budget;             /* max retries of the whole client per budget window, 0 for unlimited */
+    int budget_window_ms;
+} s_retry_policy;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    long long window_start;
+    int used;
+} s_retry_budget;
+
+typedef struct s_async_sender s_async_sender;
+
+typedef struct {
+    pthread_mutex_t mutex;          /* guards cache_control, never held across network I/O */
+    pthread_mutex_t flush_mutex;    /* held while a sealed cache file is replayed */
     s_client_params params;
     s_cache_control cache_control;
+    s_curl_pool curl_pool;
+    s_async_sender *sender;
+    int compress_level;
+    size_t compress_min_size;
+    size_t max_body_size;
+    s_retry_policy retry_policy;
+    s_retry_budget retry_budget;
 } s_pandora_client;
 
 /**
@@ -55,23 +145,84 @@ typedef struct {
 s_pandora_client *pandora_client_init(s_client_params *params);
 
 /**
- * Set cache policy for a pandora client (use NO_CACHE as default cache policy)
+ * Set cache policy for a pandora client (use NO_CACHE as default cache policy). Cached writes are
+ * appended to segment files under cachedir as checksummed records tagged with their repo and made
+ * durable with a group commit before the write returns. A full (or, with CACHE_BY_TIME, old enough)
+ * segment is sealed by the write which notices it and replayed by a flusher thread. threshold is
+ * in bytes for CACHE_BY_SIZE and CACHE_BY_SIZE_OR_TIME (which seals segments after 5 s too), in
+ * seconds for CACHE_BY_TIME, up to INT_MAX / 1000 (PANDORAE_INVALID_ARGUMENT above)
  */
 pandora_error_t pandora_client_set_cache_policy(s_pandora_client *client, e_cache_policy policy, int threshold, char *cachedir);
 
+/**
+ * Seal the current cache segment at max_bytes or once its oldest record is max_age_ms old,
+ * whichever comes first, 0 for no such limit. The age limit is kept by the flusher thread, so data
+ * of a quiet producer is replayed no later than max_age_ms plus the time to replay the segments
+ * sealed before it. Requires a policy other than NO_CACHE
+ */
+pandora_error_t pandora_client_set_cache_limits(s_pandora_client *client, size_t max_bytes, int max_age_ms);
+
+/**
+ * Progress of the flusher thread which, with a policy other than NO_CACHE, replays each cache
+ * file once it is full or old enough and deletes it. How far a cache file got is kept in a
+ * ".replayed" file next to it, so that a retried replay resumes after the last record the server
+ * accepted with every record before it; only the bodies posted along with one which failed, at
+ * most 7, and the lines before it of the record it starts in may be posted twice
+ */
+pandora_error_t pandora_client_get_flush_status(s_pandora_client *client, s_flush_status *status);
+
+/**
+ * Choose how cached writes reach the disk, DURABILITY_GROUP_COMMIT by default. With
+ * DURABILITY_PERIODIC a background thread syncs the cache at least every interval_ms and once
+ * interval_bytes are not synced yet, either may be 0 but not both; the other modes ignore them.
+ * PANDORAE_FAILED_INIT if that thread cannot be started, the previous durability is then kept.
+ * Call it before writing
+ */
+pandora_error_t pandora_client_set_durability(s_pandora_client *client, e_durability mode, int interval_ms,
+                                              size_t interval_bytes);
+
+/**
+ * Set the max number of connections a client keeps open and reuses across requests
+ * (PANDORA_DEFAULT_MAX_CONNECTIONS by default)
+ */
+pandora_error_t pandora_client_set_max_connections(s_pandora_client *client, int max_connections);
+
+/**
+ * Gzip write request bodies of at least min_size bytes with zlib level 1-9 (0 disables compression,
+ * the default). Bodies which do not shrink are sent uncompressed
+ */
+pandora_error_t pandora_client_set_compression(s_pandora_client *client, int level, size_t min_size);
+
+/**
+ * Set the max size of one write request (2 MiB by default). Larger batches are split on
+ * line boundaries and the parts are sent concurrently
+ */
+pandora_error_t pandora_client_set_max_body_size(s_pandora_client *client, size_t max_body_size);
+
+/**
+ * Set how failed writes are retried (see s_retry_policy). params.fail_retry still bounds the number
+ * of attempts; a Retry-After header from the server lengthens the backoff
+ */
+pandora_error_t pandora_client_set_retry_policy(s_pandora_client *client, s_retry_policy *policy);
+
 /**
  * Free resources used by a client
  */
 void pandora_client_cleanup(s_pandora_client *client);
 
 typedef struct {
-    struct curl_slist *fields;
+    buffer_t fields;        /* encoded fields, tab separated; the capacity is kept across point_entry_clear */
+    int field_count;
 } s_point_entry;
 
 s_point_entry *point_entry_create();
 void point_entry_clear(s_point_entry *pentry);
 void point_entry_destroy(s_point_entry *pentry);
 
+/**
+ * String values are checked to be UTF-8 (PANDORAE_INVALID_UTF8 otherwise) and tabs and newlines
+ * in them are written as \t and \n, here and in every data_points_add_* function
+ */
 pandora_error_t point_entry_append_boolean(s_point_entry *pentry, const char *key, int value);
 pandora_error_t point_entry_append_int32(s_point_entry *pentry, const char *key, long value);
 pandora_error_t point_entry_append_int64(s_point_entry *pentry, const char *key, long long value);
@@ -82,21 +233,156 @@ pandora_error_t point_entry_append_string(s_point_entry *pentry, const char *key
 typedef struct {
     buffer_t *buf;
     int point_count;
+    size_t point_start;     /* offset of the point being built */
+    int point_fields;       /* fields of the point being built, -1 when none is open */
 } s_data_points;
 
+/**
+ * data_points_destroy keeps up to 64 batches, cleared and with at most 1 MiB of buffer each,
+ * which data_points_create hands out again before allocating new ones
+ */
 s_data_points *data_points_create();
 void data_points_clear(s_data_points *data);
 void data_points_destroy(s_data_points *data);
 
+/**
+ * Free the batches and buffer segments kept for reuse, e.g. after a burst;
+ * pandora_client_cleanup calls it too
+ */
+void data_points_pool_trim(void);
+
 pandora_error_t data_points_append(s_data_points *data, s_point_entry *pentry);
 
+/**
+ * Build a point in place, without an s_point_entry: begin_point, one add call per field, then
+ * end_point. Fields are formatted straight into data. Running out of memory discards the open
+ * point, an invalid argument leaves it open without that field
+ */
+pandora_error_t data_points_begin_point(s_data_points *data);
+pandora_error_t data_points_add_boolean(s_data_points *data, const char *key, int value);
+pandora_error_t data_points_add_int32(s_data_points *data, const char *key, long value);
+pandora_error_t data_points_add_int64(s_data_points *data, const char *key, long long value);
+pandora_error_t data_points_add_float32(s_data_points *data, const char *key, float value);
+pandora_error_t data_points_add_float64(s_data_points *data, const char *key, double value);
+pandora_error_t data_points_add_string(s_data_points *data, const char *key, const char *value);
+pandora_error_t data_points_end_point(s_data_points *data);
+
+typedef enum {
+    FIELD_BOOLEAN,
+    FIELD_INT32,
+    FIELD_INT64,
+    FIELD_FLOAT32,
+    FIELD_FLOAT64,
+    FIELD_STRING,
+} e_field_type;
+
+typedef struct {
+    char *repo;
+    int count;
+    e_field_type *types;
+    char *prefixes;         /* "\tkey=" of every field, back to back */
+    size_t *offsets;        /* count + 1 offsets into prefixes */
+} s_pandora_schema;
+
+/**
+ * Describe the count fields of the points of a repo once, so points can be built by field index
+ * (data_points_add_field_*) with the keys encoded ahead of time. Returns NULL when a key is not a
+ * valid pandora field name (a letter or underscore, then letters, digits or underscores) or is
+ * given twice
+ */
+s_pandora_schema *pandora_schema_create(const char *repo, const char **keys, const e_field_type *types, int count);
+void pandora_schema_destroy(s_pandora_schema *schema);
+
+/**
+ * Add field idx of schema to the point opened with data_points_begin_point. Returns
+ * PANDORAE_SCHEMA_MISMATCH, keeping the point open, when the field has another type
+ */
+pandora_error_t data_points_add_field_boolean(s_data_points *data, s_pandora_schema *schema, int idx, int value);
+pandora_error_t data_points_add_field_int32(s_data_points *data, s_pandora_schema *schema, int idx, long value);
+pandora_error_t data_points_add_field_int64(s_data_points *data, s_pandora_schema *schema, int idx, long long value);
+pandora_error_t data_points_add_field_float32(s_data_points *data, s_pandora_schema *schema, int idx, float value);
+pandora_error_t data_points_add_field_float64(s_data_points *data, s_pandora_schema *schema, int idx, double value);
+pandora_error_t data_points_add_field_string(s_data_points *data, s_pandora_schema *schema, int idx, const char *value);
+
+/**
+ * Append rows points at once from columns, one array per schema field: const int * for
+ * FIELD_BOOLEAN, const long * for FIELD_INT32, const long long * for FIELD_INT64, const float *
+ * for FIELD_FLOAT32, const double * for FIELD_FLOAT64 and const char ** for FIELD_STRING.
+ * A NULL column, or a NULL string, leaves that field out; rows left without any field are skipped.
+ * Nothing is appended when any string is not valid UTF-8
+ */
+pandora_error_t data_points_append_columns(s_data_points *data, s_pandora_schema *schema, const void **columns, size_t rows);
+
 /**
  * Write data points to a given pandora repo
  */
 pandora_error_t pandora_client_write(s_pandora_client *client, const char *repo, s_data_points *data);
 
 /**
- * Write data points from all cache files under given cache directory
+ * Write the complete lines waiting in ring, a buffer from buffer_ring_init() filled by another
+ * thread, to a given pandora repo. They go out straight from the ring, cut on line boundaries into
+ * bodies of at most max_body_size sent concurrently, and are consumed once all are accepted; *bytes
+ * (may be NULL) is set to how many were. The calling thread is the ring's consumer, the client's
+ * cache policy does not apply
+ */
+pandora_error_t pandora_client_write_ring(s_pandora_client *client, const char *repo, buffer_t *ring, size_t *bytes);
+
+typedef enum {
+    QUEUE_BLOCK,
+    QUEUE_DROP,
+    QUEUE_SPILL,
+} e_queue_policy;
+
+typedef void (*pandora_write_callback)(const char *repo, s_data_points *data, pandora_error_t status, void *userdata);
+
+typedef struct {
+    int queue_depth;
+    int sender_threads;
+    e_queue_policy policy;
+    int max_inflight;                   /* batches each sender thread keeps in flight, 1 if not positive */
+    int ordered;                        /* never send two batches of the same repo concurrently */
+    pandora_write_callback callback;    /* called by a sender thread once a batch is done, may be NULL */
+    void *userdata;
+    int block_timeout_ms;               /* QUEUE_BLOCK gives up after this long, 0 waits for good */
+} s_async_params;
+
+/**
+ * Start background sender threads draining a bounded queue of at most params->queue_depth batches,
+ * each thread keeping up to params->max_inflight requests in flight over one curl multi handle.
+ * Over the memory budget (pandora_set_memory_budget) the pools are trimmed first. When the queue
+ * is full or the SDK is still over budget, QUEUE_BLOCK waits for room (for the budget only while
+ * batches are queued or in flight, which may bring usage down), QUEUE_DROP discards the queued
+ * batch of lowest priority below that of the new one or else rejects the new one, and QUEUE_SPILL
+ * appends the new one to the cache file
+ * (requires a policy other than NO_CACHE). Rejected batches get PANDORAE_QUEUE_FULL, or
+ * PANDORAE_OVER_BUDGET when only the budget is exceeded; discarded ones are passed to the callback
+ * with PANDORAE_OVER_BUDGET or PANDORAE_QUEUE_FULL, from the writing thread
+ */
+pandora_error_t pandora_client_start_async(s_pandora_client *client, s_async_params *params);
+
+/**
+ * Queue data points for a given pandora repo. On PANDORAE_OK the client takes ownership of data
+ * and destroys it once sent; on any other status data still belongs to the caller
+ */
+pandora_error_t pandora_client_write_async(s_pandora_client *client, const char *repo, s_data_points *data);
+
+/**
+ * pandora_client_write_async with a priority (0 for pandora_client_write_async), which decides what
+ * QUEUE_DROP discards first
+ */
+pandora_error_t pandora_client_write_async_priority(s_pandora_client *client, const char *repo, s_data_points *data,
+                                                    int priority);
+
+/**
+ * Block until every queued batch has been sent
+ */
+pandora_error_t pandora_client_drain(s_pandora_client *client);
+
+/**
+ * Write data points from all cache files under given cache directory, each record to the repo it
+ * was cached for; repo is only used for cache files of the text format of older versions. A torn
+ * or corrupt tail left by a crash is cut off the file. A cache file resumes where an earlier
+ * replay of it stopped, see pandora_client_get_flush_status
  */
 pandora_error_t pandora_client_write_cached(s_pandora_client *client, const char *repo, const char *cachedir);
 
@@ -109,7 +395,7 @@ typedef struct {
 } s_search_params;
 
 /**
- * Search logs from pandora insight with given parameters.
+ * Search logs from pandora insight with given parameters. *result is released with free()
  */
 pandora_error_t pandora_client_insight_search(s_pandora_client *client, const char *repo, s_search_params *params, char **result);
 
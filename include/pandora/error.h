@@ -26,6 +26,13 @@ typedef enum {
     PANDORAE_CONNECTION_FAILED,
 
     PANDORAE_FAILED_QUERY,
+
+    PANDORAE_QUEUE_FULL,
+
+    PANDORAE_SCHEMA_MISMATCH,
+    PANDORAE_INVALID_UTF8,
+
+    PANDORAE_OVER_BUDGET,
 } pandora_error_t;
 
 #ifdef __cplusplus
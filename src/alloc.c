@@ -0,0 +1,154 @@
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <curl/curl.h>
+
+#include "pandora/alloc.h"
+#include "cJSON.h"
+#include "utils.h"
+
+/*
+ * Every block starts with a header holding its size, so that frees, including those from
+ * cJSON and libcurl which do not pass one, can be accounted for
+ */
+#define ALLOC_HEADER_SIZE sizeof(max_align_t)
+
+static void *libc_malloc(size_t size, void *userdata) { (void)userdata; return malloc(size); }
+static void *libc_realloc(void *ptr, size_t size, void *userdata) { (void)userdata; return realloc(ptr, size); }
+static void libc_free(void *ptr, void *userdata) { (void)userdata; free(ptr); }
+
+static s_pandora_allocator allocator = { libc_malloc, libc_realloc, libc_free, NULL };
+
+static atomic_size_t bytes_in_use;
+static atomic_size_t peak_bytes;
+static atomic_size_t allocations;
+static atomic_size_t budget;
+
+static void alloc_account(size_t added, size_t removed)
+{
+    size_t now = atomic_fetch_add_explicit(&bytes_in_use, added - removed, memory_order_relaxed) + added - removed;
+    size_t peak = atomic_load_explicit(&peak_bytes, memory_order_relaxed);
+
+    while (now > peak && !atomic_compare_exchange_weak_explicit(&peak_bytes, &peak, now,
+                                                                 memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+void *pandora_malloc(size_t size)
+{
+    char *block;
+
+    if (size > SIZE_MAX - ALLOC_HEADER_SIZE)
+        return NULL;
+    block = allocator.malloc_fn(size + ALLOC_HEADER_SIZE, allocator.userdata);
+    if (!block)
+        return NULL;
+
+    *(size_t *)block = size;
+    alloc_account(size, 0);
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return block + ALLOC_HEADER_SIZE;
+}
+
+void *pandora_calloc(size_t nmemb, size_t size)
+{
+    void *ptr;
+
+    if (size > 0 && nmemb > SIZE_MAX / size)
+        return NULL;
+    ptr = pandora_malloc(nmemb * size);
+    if (ptr)
+        memset(ptr, 0, nmemb * size);
+    return ptr;
+}
+
+void *pandora_realloc(void *ptr, size_t size)
+{
+    char *block;
+    size_t old;
+
+    if (!ptr)
+        return pandora_malloc(size);
+    if (size > SIZE_MAX - ALLOC_HEADER_SIZE)
+        return NULL;
+
+    block = (char *)ptr - ALLOC_HEADER_SIZE;
+    old = *(size_t *)block;
+    block = allocator.realloc_fn(block, size + ALLOC_HEADER_SIZE, allocator.userdata);
+    if (!block)
+        return NULL;
+
+    *(size_t *)block = size;
+    alloc_account(size, old);
+    return block + ALLOC_HEADER_SIZE;
+}
+
+void pandora_free(void *ptr)
+{
+    char *block;
+
+    if (!ptr)
+        return;
+
+    block = (char *)ptr - ALLOC_HEADER_SIZE;
+    alloc_account(0, *(size_t *)block);
+    atomic_fetch_sub_explicit(&allocations, 1, memory_order_relaxed);
+    allocator.free_fn(block, allocator.userdata);
+}
+
+static char *alloc_curl_strdup(const char *str)
+{
+    return pandora_strdup(str);
+}
+
+pandora_error_t pandora_set_allocator(const s_pandora_allocator *custom)
+{
+    cJSON_Hooks hooks = { pandora_malloc, pandora_free };
+
+    if (custom && (!custom->malloc_fn || !custom->realloc_fn || !custom->free_fn))
+        return PANDORAE_INVALID_ARGUMENT;
+
+    /* blocks cannot move from one allocator to another */
+    if (atomic_load(&allocations) != 0)
+        return PANDORAE_INVALID_ARGUMENT;
+
+    if (custom) {
+        allocator = *custom;
+    } else {
+        allocator.malloc_fn = libc_malloc;
+        allocator.realloc_fn = libc_realloc;
+        allocator.free_fn = libc_free;
+        allocator.userdata = NULL;
+    }
+
+    cJSON_InitHooks(&hooks);
+    /* no-op if libcurl is initialized already, it then keeps using the C library */
+    curl_global_init_mem(CURL_GLOBAL_DEFAULT, pandora_malloc, pandora_free, pandora_realloc,
+                         alloc_curl_strdup, pandora_calloc);
+
+    return PANDORAE_OK;
+}
+
+void pandora_get_memory_stats(s_pandora_memory_stats *stats)
+{
+    if (!stats)
+        return;
+
+    stats->bytes_in_use = atomic_load_explicit(&bytes_in_use, memory_order_relaxed);
+    stats->peak_bytes = atomic_load_explicit(&peak_bytes, memory_order_relaxed);
+    stats->allocations = atomic_load_explicit(&allocations, memory_order_relaxed);
+    stats->budget = atomic_load_explicit(&budget, memory_order_relaxed);
+}
+
+void pandora_set_memory_budget(size_t max_bytes)
+{
+    atomic_store_explicit(&budget, max_bytes, memory_order_relaxed);
+}
+
+int pandora_memory_over_budget(void)
+{
+    size_t max_bytes = atomic_load_explicit(&budget, memory_order_relaxed);
+
+    return max_bytes > 0 && atomic_load_explicit(&bytes_in_use, memory_order_relaxed) > max_bytes;
+}
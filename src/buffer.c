@@ -1,13 +1,142 @@
+#define _GNU_SOURCE
+#include <pthread.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
+#include "pandora/alloc.h"
 #include "pandora/buffer.h"
+#include "escape.h"
+#include "format.h"
+
+/* Free segments of BUFFER_SEGMENT_SIZE bytes kept for reuse, shared by all buffers */
+#define BUFFER_POOL_MAX 64
+
+/* The producer only stores written and the consumer only stores read, each published with release */
+#define RING_LOAD(p)        __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define RING_STORE(p, v)    __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+static pthread_mutex_t segment_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static void *segment_pool[BUFFER_POOL_MAX];
+static int segment_pool_count = 0;
+
+static char *segment_alloc(size_t capacity)
+{
+    char *data = NULL;
+
+    if (capacity == BUFFER_SEGMENT_SIZE) {
+        pthread_mutex_lock(&segment_pool_mutex);
+        if (segment_pool_count > 0)
+            data = segment_pool[--segment_pool_count];
+        pthread_mutex_unlock(&segment_pool_mutex);
+    }
+
+    return data ? data : pandora_malloc(capacity);
+}
+
+static void segment_free(char *data, size_t capacity)
+{
+    if (capacity == BUFFER_SEGMENT_SIZE && !pandora_memory_over_budget()) {
+        pthread_mutex_lock(&segment_pool_mutex);
+        if (segment_pool_count < BUFFER_POOL_MAX) {
+            segment_pool[segment_pool_count++] = data;
+            data = NULL;
+        }
+        pthread_mutex_unlock(&segment_pool_mutex);
+    }
+    pandora_free(data);
+}
+
+void buffer_pool_trim(void)
+{
+    pthread_mutex_lock(&segment_pool_mutex);
+    while (segment_pool_count > 0)
+        pandora_free(segment_pool[--segment_pool_count]);
+    pthread_mutex_unlock(&segment_pool_mutex);
+}
+
+/* Make segment i the one being written */
+static void segment_select(buffer_t *buffer, int i)
+{
+    buffer->data = buffer->segments[i].data;
+    buffer->capacity = buffer->segments[i].capacity;
+    buffer->base = buffer->segments[i].start;
+}
+
+/* Chain a segment with room for at least len bytes after the current one, which keeps its data */
+static int segment_add(buffer_t *buffer, size_t len)
+{
+    buffer_segment_t *last = &buffer->segments[buffer->nsegments - 1];
+    size_t capacity = len > BUFFER_SEGMENT_SIZE ? len : BUFFER_SEGMENT_SIZE;
+    char *data;
+
+    /* an empty last segment is swapped rather than left in the chain */
+    if (buffer->written == last->start && capacity > last->capacity) {
+        data = segment_alloc(capacity);
+        if (!data)
+            return 0;
+        segment_free(last->data, last->capacity);
+        last->data = data;
+        last->capacity = capacity;
+        segment_select(buffer, buffer->nsegments - 1);
+        return 1;
+    }
+
+    /* segments left over by a reset or truncate are used again before asking the pool */
+    if (buffer->nsegments < buffer->nallocated) {
+        last = &buffer->segments[buffer->nsegments];
+        if (last->capacity < capacity) {
+            data = segment_alloc(capacity);
+            if (!data)
+                return 0;
+            segment_free(last->data, last->capacity);
+            last->data = data;
+            last->capacity = capacity;
+        }
+        last->start = buffer->written;
+        segment_select(buffer, buffer->nsegments++);
+        return 1;
+    }
+
+    if (buffer->nsegments == buffer->max_segments) {
+        int max_segments = buffer->max_segments * 2;
+        buffer_segment_t *segments = pandora_realloc(buffer->segments, sizeof(buffer_segment_t) * max_segments);
+        if (!segments)
+            return 0;
+        buffer->segments = segments;
+        buffer->max_segments = max_segments;
+    }
+
+    data = segment_alloc(capacity);
+    if (!data)
+        return 0;
+    buffer->segments[buffer->nsegments].data = data;
+    buffer->segments[buffer->nsegments].start = buffer->written;
+    buffer->segments[buffer->nsegments].capacity = capacity;
+    buffer->nallocated++;
+    segment_select(buffer, buffer->nsegments++);
+    return 1;
+}
+
+/* Stop using the segments from the first one starting past size on, keeping them for later writes */
+static void segment_drop(buffer_t *buffer, size_t size)
+{
+    while (buffer->nsegments > 1 && buffer->segments[buffer->nsegments - 1].start > size)
+        buffer->nsegments--;
+    segment_select(buffer, buffer->nsegments - 1);
+}
 
 static int buffer_grow(buffer_t *buffer, size_t min_capacity)
 {
-    size_t new_capacity = buffer->capacity;
+    size_t new_capacity = buffer->capacity ? buffer->capacity : 1;
+
+    /* min_capacity counts from the start of the buffer, a new segment only needs the part past it */
+    if (buffer->flags & BUFFER_SEGMENTED)
+        return segment_add(buffer, min_capacity - buffer->written);
+
     while (new_capacity < min_capacity)
         new_capacity <<= 2;
-    void *new_data = realloc(buffer->data, new_capacity);
+    void *new_data = pandora_realloc(buffer->data, new_capacity);
     if (!new_data) {
         return 0;
     } else {
@@ -24,89 +153,470 @@ void buffer_init_static(buffer_t *buffer, char *data, size_t size)
     buffer->capacity = size;
     buffer->written = 0;
     buffer->read = 0;
+    buffer->base = 0;
+    buffer->segments = NULL;
+    buffer->nsegments = 0;
+    buffer->nallocated = 0;
+    buffer->max_segments = 0;
 }
 
 int buffer_init(buffer_t *buffer, size_t size, int flags)
 {
     buffer->flags = flags | BUFFER_OWNS_DATA;
-    buffer->data = malloc(size);
+    buffer->written = 0;
+    buffer->read = 0;
+    buffer->base = 0;
+    buffer->segments = NULL;
+    buffer->nsegments = 0;
+    buffer->nallocated = 0;
+    buffer->max_segments = 0;
+
+    if (flags & BUFFER_SEGMENTED) {
+        buffer->flags |= BUFFER_GROWABLE;
+        buffer->segments = pandora_malloc(sizeof(buffer_segment_t) * 8);
+        if (!buffer->segments)
+            return 0;
+        buffer->max_segments = 8;
+        buffer->segments[0].capacity = size > 0 ? size : BUFFER_SEGMENT_SIZE;
+        buffer->segments[0].data = segment_alloc(buffer->segments[0].capacity);
+        buffer->segments[0].start = 0;
+        if (!buffer->segments[0].data) {
+            pandora_free(buffer->segments);
+            buffer->segments = NULL;
+            return 0;
+        }
+        buffer->nsegments = 1;
+        buffer->nallocated = 1;
+        segment_select(buffer, 0);
+        return 1;
+    }
+
+    buffer->data = pandora_malloc(size);
     if (!buffer->data)
         return 0;
     buffer->capacity = size;
-    buffer->written = 0;
-    buffer->read = 0;
     return 1;
 }
 
+void buffer_adopt(buffer_t *buffer, char *data, size_t len, size_t capacity, int flags)
+{
+    buffer_init_static(buffer, data, capacity);
+    buffer->flags = (flags & ~BUFFER_SEGMENTED) | BUFFER_OWNS_DATA;
+    buffer->written = len;
+}
+
 buffer_t* buffer_create(size_t size, int flags)
 {
-    buffer_t *buffer = malloc(sizeof(buffer_t));
+    buffer_t *buffer = pandora_malloc(sizeof(buffer_t));
     if (!buffer)
         return NULL;
     if (!buffer_init(buffer, size, flags | BUFFER_OWNS_SELF)) {
-        free(buffer);
+        pandora_free(buffer);
+        return NULL;
     }
     return buffer;
 }
 
 void buffer_destroy(buffer_t *buffer)
 {
-    if (buffer->flags & BUFFER_OWNS_DATA)
-        free(buffer->data);
+    if (buffer->flags & BUFFER_SEGMENTED) {
+        while (buffer->nallocated > 0) {
+            buffer->nallocated--;
+            segment_free(buffer->segments[buffer->nallocated].data, buffer->segments[buffer->nallocated].capacity);
+        }
+        buffer->nsegments = 0;
+        pandora_free(buffer->segments);
+        buffer->segments = NULL;
+    } else if (buffer->flags & BUFFER_RING) {
+        munmap(buffer->data, 2 * buffer->capacity);
+    } else if (buffer->flags & BUFFER_EXTENTS) {
+        pandora_free(buffer->segments);
+        buffer->segments = NULL;
+    } else if (buffer->flags & BUFFER_OWNS_DATA) {
+        pandora_free(buffer->data);
+    }
     if (buffer->flags & BUFFER_OWNS_SELF)
-        free(buffer);
+        pandora_free(buffer);
 }
 
 void buffer_reset(buffer_t *buffer)
 {
     BUFFER_RESET(buffer);
+    if (buffer->flags & BUFFER_SEGMENTED)
+        segment_drop(buffer, 0);
+    else if (buffer->flags & BUFFER_EXTENTS) {
+        buffer->nsegments = 0;
+        buffer->base = 0;
+    }
+}
+
+void buffer_trim(buffer_t *buffer, size_t keep)
+{
+    size_t capacity = 0;
+    char *data;
+    int i;
+
+    if (!(buffer->flags & BUFFER_SEGMENTED)) {
+        if ((buffer->flags & BUFFER_OWNS_DATA) && buffer->capacity > keep && buffer->written <= keep) {
+            data = pandora_realloc(buffer->data, keep > 0 ? keep : 1);
+            if (data) {
+                buffer->data = data;
+                buffer->capacity = keep > 0 ? keep : 1;
+            }
+        }
+        return;
+    }
+
+    /* segments in use stay, spare ones go back to the pool once keep bytes are reached */
+    for (i = 0; i < buffer->nallocated; i++) {
+        if (i >= buffer->nsegments && capacity + buffer->segments[i].capacity > keep)
+            break;
+        capacity += buffer->segments[i].capacity;
+    }
+    while (buffer->nallocated > i) {
+        buffer->nallocated--;
+        segment_free(buffer->segments[buffer->nallocated].data, buffer->segments[buffer->nallocated].capacity);
+    }
+}
+
+void buffer_truncate(buffer_t *buffer, size_t size)
+{
+    if (size >= buffer->written)
+        return;
+
+    buffer->written = size;
+    if (buffer->read > size)
+        buffer->read = size;
+    if (buffer->flags & BUFFER_SEGMENTED)
+        segment_drop(buffer, size);
 }
 
 int buffer_append(buffer_t *buffer, char byte)
 {
-    if (buffer->capacity - buffer->written == 0) {
+    if (BUFFER_REMAIN(buffer) == 0) {
         if (buffer->flags & BUFFER_GROWABLE) {
-            if (!buffer_grow(buffer, buffer->capacity + 1)) {
+            if (!buffer_grow(buffer, buffer->written + 1)) {
                 return 0;
             }
         } else {
             return 0;
         }
     }
-    buffer->data[buffer->written++] = byte;
+    BUFFER_APPEND(buffer, byte);
     return 1;
 }
 
 int buffer_write(buffer_t *buffer, const char *data, size_t len)
 {
-    if (buffer->capacity - buffer->written < len) {
-        if (buffer->flags & BUFFER_GROWABLE) {
-            if (!buffer_grow(buffer, buffer->capacity + len)) {
+    size_t part, start = buffer->written;
+
+    if (BUFFER_REMAIN(buffer) < len) {
+        if (buffer->flags & BUFFER_SEGMENTED) {
+            /* fill the current segment, the rest goes to new ones; a segment which cannot be
+             * had takes back what was written, nothing of a failed write is kept */
+            while (BUFFER_REMAIN(buffer) < len) {
+                part = BUFFER_REMAIN(buffer);
+                memcpy(BUFFER_TAIL(buffer), data, part);
+                buffer->written += part;
+                data += part;
+                len -= part;
+                if (!segment_add(buffer, 0)) {
+                    buffer_truncate(buffer, start);
+                    return 0;
+                }
+            }
+        } else if (buffer->flags & BUFFER_GROWABLE) {
+            if (!buffer_grow(buffer, buffer->written + len)) {
                 return 0;
             }
         } else {
             return 0;
         }
     }
-    memcpy(buffer->data + buffer->written, data, len);
+    memcpy(BUFFER_TAIL(buffer), data, len);
     buffer->written += len;
     return 1;
 }
 
+int buffer_reserve(buffer_t *buffer, size_t len)
+{
+    if (BUFFER_REMAIN(buffer) >= len)
+        return 1;
+    if (!(buffer->flags & BUFFER_GROWABLE))
+        return 0;
+    return buffer_grow(buffer, buffer->written + len);
+}
+
+int buffer_append_u64(buffer_t *buffer, uint64_t value)
+{
+    if (BUFFER_REMAIN(buffer) < FORMAT_MAX_SIZE && !buffer_reserve(buffer, FORMAT_MAX_SIZE))
+        return 0;
+    buffer->written += format_uint64(BUFFER_TAIL(buffer), value);
+    return 1;
+}
+
+int buffer_append_i64(buffer_t *buffer, int64_t value)
+{
+    if (BUFFER_REMAIN(buffer) < FORMAT_MAX_SIZE && !buffer_reserve(buffer, FORMAT_MAX_SIZE))
+        return 0;
+    buffer->written += format_int64(BUFFER_TAIL(buffer), value);
+    return 1;
+}
+
+int buffer_append_double(buffer_t *buffer, double value)
+{
+    if (BUFFER_REMAIN(buffer) < FORMAT_MAX_SIZE && !buffer_reserve(buffer, FORMAT_MAX_SIZE))
+        return 0;
+    buffer->written += format_float64(BUFFER_TAIL(buffer), value);
+    return 1;
+}
+
+int buffer_append_float(buffer_t *buffer, float value)
+{
+    if (BUFFER_REMAIN(buffer) < FORMAT_MAX_SIZE && !buffer_reserve(buffer, FORMAT_MAX_SIZE))
+        return 0;
+    buffer->written += format_float32(BUFFER_TAIL(buffer), value);
+    return 1;
+}
+
+int buffer_append_escaped(buffer_t *buffer, const char *src, size_t len)
+{
+    size_t written;
+
+    if (BUFFER_REMAIN(buffer) < ESCAPE_MAX_SIZE(len) && !buffer_reserve(buffer, ESCAPE_MAX_SIZE(len)))
+        return 0;
+    if (!escape_value(BUFFER_TAIL(buffer), src, len, &written))
+        return -1;
+    buffer->written += written;
+    return 1;
+}
+
+char *buffer_detach(buffer_t *buffer, size_t *len)
+{
+    char *data = buffer->data;
+
+    if (!(buffer->flags & BUFFER_OWNS_DATA))
+        return NULL;
+
+    if (buffer->flags & BUFFER_SEGMENTED) {
+        /* the segment may come back from the pool, hand out its array and start a fresh one */
+        if (buffer->nsegments > 1)
+            return NULL;
+        buffer->segments[0].data = segment_alloc(BUFFER_SEGMENT_SIZE);
+        if (!buffer->segments[0].data) {
+            buffer->segments[0].data = data;
+            return NULL;
+        }
+        buffer->segments[0].capacity = BUFFER_SEGMENT_SIZE;
+        segment_select(buffer, 0);
+    } else {
+        buffer->data = NULL;
+        buffer->capacity = 0;
+    }
+
+    if (len)
+        *len = buffer->written;
+    buffer->written = 0;
+    buffer->read = 0;
+    return data;
+}
+
+const char *buffer_chunk(const buffer_t *buffer, size_t offset, size_t *len)
+{
+    int lo = 0, hi = buffer->nsegments - 1, mid;
+    size_t end;
+
+    if (buffer->flags & BUFFER_RING) {
+        end = RING_LOAD(&buffer->written);
+        *len = offset < end ? end - offset : 0;
+        return buffer->data + (offset & (buffer->capacity - 1));
+    }
+
+    if (!(buffer->flags & (BUFFER_SEGMENTED | BUFFER_EXTENTS)) || buffer->nsegments == 0) {
+        *len = offset < buffer->written ? buffer->written - offset : 0;
+        return buffer->data + offset;
+    }
+
+    /* the last segment starting at or before offset */
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (buffer->segments[mid].start <= offset)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    end = lo + 1 < buffer->nsegments ? buffer->segments[lo + 1].start : buffer->written;
+    *len = offset < end ? end - offset : 0;
+    return buffer->segments[lo].data + (offset - buffer->segments[lo].start);
+}
+
+int buffer_init_extents(buffer_t *buffer)
+{
+    buffer_init_static(buffer, NULL, 0);
+    buffer->flags = BUFFER_EXTENTS;
+    buffer->segments = pandora_malloc(sizeof(buffer_segment_t) * 8);
+    if (!buffer->segments)
+        return 0;
+    buffer->max_segments = 8;
+    return 1;
+}
+
+int buffer_add_extent(buffer_t *buffer, const char *data, size_t len)
+{
+    buffer_segment_t *last = buffer->nsegments > 0 ? &buffer->segments[buffer->nsegments - 1] : NULL;
+
+    if (len == 0)
+        return 1;
+
+    if (last && last->data + last->capacity == data) {
+        last->capacity += len;
+    } else {
+        if (buffer->nsegments == buffer->max_segments) {
+            int max_segments = buffer->max_segments * 2;
+            buffer_segment_t *segments = pandora_realloc(buffer->segments, sizeof(buffer_segment_t) * max_segments);
+            if (!segments)
+                return 0;
+            buffer->segments = segments;
+            buffer->max_segments = max_segments;
+        }
+        last = &buffer->segments[buffer->nsegments++];
+        last->data = (char *)data;
+        last->start = buffer->written;
+        last->capacity = len;
+    }
+
+    /* no room to write, BUFFER_REMAIN stays 0 */
+    buffer->written += len;
+    buffer->base = buffer->written;
+    return 1;
+}
+
+static int ring_file(size_t size)
+{
+    int fd;
+
+#ifdef __linux__
+    fd = memfd_create("pandora-ring", MFD_CLOEXEC);
+#else
+    char path[] = "/tmp/pandora-ring-XXXXXX";
+    fd = mkstemp(path);
+    if (fd >= 0)
+        unlink(path);
+#endif
+    if (fd >= 0 && ftruncate(fd, (off_t)size) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+int buffer_ring_init(buffer_t *buffer, size_t size)
+{
+    size_t capacity = (size_t)sysconf(_SC_PAGESIZE);
+    char *data;
+    int fd;
+
+    while (capacity < size)
+        capacity <<= 1;
+
+    fd = ring_file(capacity);
+    if (fd < 0)
+        return 0;
+
+    /* reserve both halves first so that the second mapping lands right after the first */
+    data = mmap(NULL, 2 * capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return 0;
+    }
+    if (mmap(data, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        mmap(data + capacity, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(data, 2 * capacity);
+        close(fd);
+        return 0;
+    }
+    close(fd);
+
+    buffer_init_static(buffer, data, capacity);
+    buffer->flags = BUFFER_RING | BUFFER_OWNS_DATA;
+    return 1;
+}
+
+char *buffer_ring_reserve(buffer_t *buffer, size_t len)
+{
+    if (len > buffer->capacity - (buffer->written - RING_LOAD(&buffer->read)))
+        return NULL;
+    return buffer->data + (buffer->written & (buffer->capacity - 1));
+}
+
+void buffer_ring_commit(buffer_t *buffer, size_t len)
+{
+    RING_STORE(&buffer->written, buffer->written + len);
+}
+
+int buffer_ring_write(buffer_t *buffer, const char *data, size_t len)
+{
+    char *dest = buffer_ring_reserve(buffer, len);
+
+    if (!dest)
+        return 0;
+    memcpy(dest, data, len);
+    buffer_ring_commit(buffer, len);
+    return 1;
+}
+
+const char *buffer_ring_peek(buffer_t *buffer, size_t *len)
+{
+    *len = RING_LOAD(&buffer->written) - buffer->read;
+    return buffer->data + (buffer->read & (buffer->capacity - 1));
+}
+
+const char *buffer_ring_peek_lines(buffer_t *buffer, size_t max, size_t *len)
+{
+    size_t avail;
+    const char *data = buffer_ring_peek(buffer, &avail);
+    const char *end = memrchr(data, '\n', avail < max ? avail : max);
+
+    if (!end && avail > max)
+        end = memchr(data + max, '\n', avail - max);
+    *len = end ? (size_t)(end - data) + 1 : 0;
+    return data;
+}
+
+void buffer_ring_consume(buffer_t *buffer, size_t len)
+{
+    RING_STORE(&buffer->read, buffer->read + len);
+}
+
 char buffer_get(buffer_t *buffer)
 {
+    size_t len;
+    const char *p;
+
     if (buffer->read >= buffer->written)
         return 0;
-    return BUFFER_GET(buffer);
+    p = buffer_chunk(buffer, buffer->read, &len);
+    buffer->read++;
+    return *p;
 }
 
 int buffer_read(buffer_t *buffer, size_t maxlen, void *dest)
 {
     size_t remain = buffer->written - buffer->read;
+    size_t done = 0, len;
+    const char *p;
+
     if (remain < maxlen)
         maxlen = remain;
-    memcpy(dest, buffer->data + buffer->read, maxlen);
-    buffer->read += maxlen;
+    while (done < maxlen) {
+        p = buffer_chunk(buffer, buffer->read, &len);
+        if (len > maxlen - done)
+            len = maxlen - done;
+        memcpy((char *)dest + done, p, len);
+        buffer->read += len;
+        done += len;
+    }
     return maxlen;
 }
 
@@ -118,4 +628,4 @@ int buffer_is_full(buffer_t *buffer) { return BUFFER_IS_FULL(buffer); }
 size_t buffer_tell(buffer_t *buffer) { return BUFFER_TELL(buffer); }
 int buffer_eof(buffer_t *buffer) { return BUFFER_EOF(buffer); }
 void buffer_rewind(buffer_t *buffer) { BUFFER_REWIND(buffer); }
-void buffer_seek(buffer_t *buffer, size_t offset) { BUFFER_SEEK(buffer, offset); }
\ No newline at end of file
+void buffer_seek(buffer_t *buffer, size_t offset) { BUFFER_SEEK(buffer, offset); }
@@ -1,23 +1,47 @@
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include "pandora/buffer.h"
 #include "pandora/client.h"
+#include "compress.h"
 #include "crypto.h"
+#include "escape.h"
+#include "format.h"
+#include "internal.h"
+#include "pool.h"
+#include "retry.h"
+#include "sender.h"
+#include "transfer.h"
 #include "utils.h"
+#include "wal.h"
 #include "cJSON.h"
 
 #define PANDORA_DEFAULT_PIPELINE_HOST "https://nb-pipeline.qiniuapi.com"
 #define PANDORA_DEFAULT_INSIGHT_HOST "https://nb-insight.qiniuapi.com"
-#define PANDORA_URL_MAX_SIZE 256
 #define PANDORA_C_USER_AGENT "pandora-c-sdk/1.0.1"
 
-#define CLIENT_MAX_BODY_SIZE 2*1024*1024
+#define CLIENT_MAX_BODY_SIZE (2*1024*1024)
+
+#define RETRY_DEFAULT_BASE 1000
+#define RETRY_DEFAULT_CAP 30000
+#define RETRY_DEFAULT_JITTER 50
+
+#define CACHE_FLUSH_BACKOFF 5000
+#define CACHE_DEFAULT_MAX_AGE 5000
+#define CACHE_REPLAY_BODIES 8
 
 #define DATA_BUFFER_SIZE 4096
+#define DATA_POINTS_POOL_SIZE 64
+#define DATA_POINTS_POOL_KEEP (1024 * 1024)
+#define POINT_ENTRY_BUFFER_SIZE 256
+#define RESPONSE_BUFFER_SIZE 4096
 #define AUTH_BUFFER_SIZE 256
 
 #define TRUE 1
@@ -30,7 +54,11 @@ s_pandora_client *pandora_client_init(s_client_params *params)
         return NULL;
     }
 
-    s_pandora_client *client = malloc(sizeof(s_pandora_client));
+    /* cJSON output is freed with pandora_free, e.g. as an adopted buffer */
+    cJSON_Hooks hooks = { pandora_malloc, pandora_free };
+    cJSON_InitHooks(&hooks);
+
+    s_pandora_client *client = pandora_malloc(sizeof(s_pandora_client));
     if (!client) {
         fprintf(stderr, "null pandora client");
         return NULL;
@@ -41,9 +69,9 @@ s_pandora_client *pandora_client_init(s_client_params *params)
     else
         client->params.pipeline_host = pandora_strdup(PANDORA_DEFAULT_PIPELINE_HOST);
     if (params->insight_host)
-        client->params.insight_host = pandora_strdup(PANDORA_DEFAULT_INSIGHT_HOST);
-    else
         client->params.insight_host = pandora_strdup(params->insight_host);
+    else
+        client->params.insight_host = pandora_strdup(PANDORA_DEFAULT_INSIGHT_HOST);
     client->params.access_key = pandora_strdup(params->access_key);
     client->params.secret_key = pandora_strdup(params->secret_key);
     client->params.fail_retry = params->fail_retry;
@@ -52,137 +80,365 @@ s_pandora_client *pandora_client_init(s_client_params *params)
     client->cache_control.policy = NO_CACHE;
     client->cache_control.threshold = 0;
     client->cache_control.cachedir = ".";
-    client->cache_control.fileptr = NULL;
+    client->cache_control.fd = -1;
     client->cache_control.filesize = 0;
-    client->cache_control.oldpf = NULL;
-    client->cache_control.start = UINT_MAX;
+    client->cache_control.max_bytes = 0;
+    client->cache_control.max_age_ms = 0;
+    client->cache_control.first_append_ms = 0;
+    client->cache_control.seq = 0;
+    client->cache_control.appended = 0;
+    client->cache_control.synced = 0;
+    client->cache_control.syncing = FALSE;
+    client->cache_control.durability = DURABILITY_GROUP_COMMIT;
+    client->cache_control.sync_interval_ms = 0;
+    client->cache_control.sync_interval_bytes = 0;
+    client->cache_control.syncer_running = FALSE;
+    client->cache_control.syncer_stop = FALSE;
+    client->cache_control.sealed_head = NULL;
+    client->cache_control.sealed_tail = NULL;
+    client->cache_control.flushing = NULL;
+    client->cache_control.flusher_running = FALSE;
+    client->cache_control.flusher_stop = FALSE;
+    memset(&client->cache_control.flush_status, 0, sizeof(s_flush_status));
 
     memset(client->cache_control.filename, 0, FILENAME_MAX);
-    memset(client->cache_control.oldfn, 0, FILENAME_MAX);
+
+    if (!curl_pool_init(&client->curl_pool, PANDORA_DEFAULT_MAX_CONNECTIONS)) {
+        fprintf(stderr, "curl handle pool initialization failed");
+        pandora_free(client->params.pipeline_host);
+        pandora_free(client->params.insight_host);
+        pandora_free(client->params.access_key);
+        pandora_free(client->params.secret_key);
+        pandora_free(client);
+        return NULL;
+    }
+
+    client->sender = NULL;
+    client->compress_level = 0;
+    client->compress_min_size = 0;
+    client->max_body_size = CLIENT_MAX_BODY_SIZE;
+
+    client->retry_policy.base_ms = RETRY_DEFAULT_BASE;
+    client->retry_policy.cap_ms = RETRY_DEFAULT_CAP;
+    client->retry_policy.jitter = RETRY_DEFAULT_JITTER;
+    client->retry_policy.deadline_ms = 0;
+    client->retry_policy.budget = 0;
+    client->retry_policy.budget_window_ms = 0;
+    retry_budget_init(&client->retry_budget);
 
     pthread_mutex_init(&client->mutex, NULL);
+    pthread_mutex_init(&client->flush_mutex, NULL);
+    pthread_cond_init(&client->cache_control.sync_done, NULL);
+    pthread_cond_init(&client->cache_control.sync_wanted, NULL);
+    pthread_cond_init(&client->cache_control.flush_wanted, NULL);
 
     return client;
 }
 
+pandora_error_t pandora_client_set_max_connections(s_pandora_client *client, int max_connections)
+{
+    if (!client)
+        return PANDORAE_INVALID_CLIENT;
+
+    if (max_connections <= 0)
+        return PANDORAE_INVALID_ARGUMENT;
+
+    if (!curl_pool_resize(&client->curl_pool, max_connections))
+        return PANDORAE_OUT_OF_MEMORY;
+
+    return PANDORAE_OK;
+}
+
+pandora_error_t pandora_client_set_compression(s_pandora_client *client, int level, size_t min_size)
+{
+    if (!client)
+        return PANDORAE_INVALID_CLIENT;
+
+    if (level < 0 || level > 9)
+        return PANDORAE_INVALID_ARGUMENT;
+
+    client->compress_level = level;
+    client->compress_min_size = min_size;
+
+    return PANDORAE_OK;
+}
+
+pandora_error_t pandora_client_set_max_body_size(s_pandora_client *client, size_t max_body_size)
+{
+    if (!client)
+        return PANDORAE_INVALID_CLIENT;
+
+    if (max_body_size == 0)
+        return PANDORAE_INVALID_ARGUMENT;
+
+    client->max_body_size = max_body_size;
+
+    return PANDORAE_OK;
+}
+
+pandora_error_t pandora_client_set_retry_policy(s_pandora_client *client, s_retry_policy *policy)
+{
+    if (!client)
+        return PANDORAE_INVALID_CLIENT;
+
+    if (!policy || policy->base_ms < 0 || policy->cap_ms < policy->base_ms ||
+        policy->jitter < 0 || policy->jitter > 100 || policy->deadline_ms < 0 ||
+        (policy->budget > 0 && policy->budget_window_ms <= 0))
+        return PANDORAE_INVALID_ARGUMENT;
+
+    client->retry_policy = *policy;
+
+    return PANDORAE_OK;
+}
+
 void cache_control_do_flush(s_cache_control *ctl)
 {
     if (!ctl)
         return;
 
-    if (ctl->fileptr) {
-        fflush(ctl->fileptr);
-        fclose(ctl->fileptr);
-        ctl->fileptr = NULL;
-    }
-
-    if (ctl->oldpf) {
-        fflush(ctl->oldpf);
-        fclose(ctl->oldpf);
-        ctl->oldpf = NULL;
+    if (ctl->fd >= 0) {
+        if (ctl->durability != DURABILITY_NONE && ctl->synced < ctl->appended && wal_sync(ctl->fd) == 0)
+            ctl->synced = ctl->appended;
+        close(ctl->fd);
+        ctl->fd = -1;
     }
 }
 
 void pandora_client_cleanup(s_pandora_client *client)
 {
     if (client) {
+        if (client->sender) {
+            async_sender_destroy(client->sender);
+            client->sender = NULL;
+        }
+
+        cache_flusher_stop(client);
+        cache_syncer_stop(client);
         cache_control_do_flush(&client->cache_control);
 
+        pthread_cond_destroy(&client->cache_control.flush_wanted);
+        pthread_cond_destroy(&client->cache_control.sync_wanted);
+        pthread_cond_destroy(&client->cache_control.sync_done);
+        pthread_mutex_destroy(&client->flush_mutex);
         pthread_mutex_destroy(&client->mutex);
+        retry_budget_cleanup(&client->retry_budget);
+        curl_pool_cleanup(&client->curl_pool);
 
-        free(client->params.pipeline_host);
-        free(client->params.insight_host);
-        free(client->params.access_key);
-        free(client->params.secret_key);
-        free(client);
+        pandora_free(client->params.pipeline_host);
+        pandora_free(client->params.insight_host);
+        pandora_free(client->params.access_key);
+        pandora_free(client->params.secret_key);
+        pandora_free(client);
+
+        data_points_pool_trim();
     }
 }
 
 s_point_entry *point_entry_create()
 {
-    s_point_entry *pentry = malloc(sizeof(s_point_entry));
-    if (pentry)
-        pentry->fields = NULL;
+    s_point_entry *pentry = pandora_malloc(sizeof(s_point_entry));
+    if (!pentry)
+        return NULL;
+
+    if (!buffer_init(&pentry->fields, POINT_ENTRY_BUFFER_SIZE, BUFFER_GROWABLE)) {
+        pandora_free(pentry);
+        return NULL;
+    }
+    pentry->field_count = 0;
+
     return pentry;
 }
 
 void point_entry_clear(s_point_entry *pentry)
 {
     if (pentry) {
-        if (pentry->fields) {
-            curl_slist_free_all(pentry->fields);
-            pentry->fields = NULL;
-        }
+        BUFFER_RESET(&pentry->fields);
+        pentry->field_count = 0;
     }
 }
 
 void point_entry_destroy(s_point_entry *pentry)
 {
     if (pentry) {
-        if (pentry->fields) {
-            curl_slist_free_all(pentry->fields);
-            pentry->fields = NULL;
-        }
-        free(pentry);
+        buffer_destroy(&pentry->fields);
+        pandora_free(pentry);
     }
 }
 
-#define POINT_ENTRY_APPEND_FIELD(pentry, key, value, format, valuelen) \
-    size_t bytes = strlen(key) + valuelen + 2; \
-    char *field = malloc(bytes); \
-    if (!field) \
-        return PANDORAE_OUT_OF_MEMORY; \
-    snprintf(field, bytes, format, key, value); \
-    pentry->fields = curl_slist_append(pentry->fields, field); \
-    free(field); \
-    return PANDORAE_OK
+/* Append "\tkey=" to buf, without the tab for the first field; *start is where the field begins */
+static pandora_error_t field_key(buffer_t *buf, int first, const char *key, size_t *start)
+{
+    size_t keylen = strlen(key);
+
+    *start = BUFFER_SIZE(buf);
+    if (BUFFER_REMAIN(buf) < keylen + 2 && !buffer_reserve(buf, keylen + 2))
+        return PANDORAE_OUT_OF_MEMORY;
+
+    if (!first)
+        BUFFER_APPEND(buf, '\t');
+    memcpy(BUFFER_TAIL(buf), key, keylen);
+    buf->written += keylen;
+    BUFFER_APPEND(buf, '=');
+
+    return PANDORAE_OK;
+}
+
+/* Status of a field value appended with one of the buffer_append_* calls */
+static pandora_error_t field_status(int appended)
+{
+    if (appended > 0)
+        return PANDORAE_OK;
+    return appended < 0 ? PANDORAE_INVALID_UTF8 : PANDORAE_OUT_OF_MEMORY;
+}
+
+static int buffer_append_boolean(buffer_t *buf, int value)
+{
+    return value ? buffer_write(buf, "true", 4) : buffer_write(buf, "false", 5);
+}
+
+static pandora_error_t point_entry_begin_field(s_point_entry *pentry, const char *key, size_t *start)
+{
+    if (!pentry || !key)
+        return PANDORAE_INVALID_ARGUMENT;
+
+    return field_key(&pentry->fields, pentry->field_count == 0, key, start);
+}
+
+/* A field whose value could not be appended is taken out again */
+static pandora_error_t point_entry_end_field(s_point_entry *pentry, size_t start, int appended)
+{
+    pandora_error_t status = field_status(appended);
+
+    if (status != PANDORAE_OK) {
+        buffer_truncate(&pentry->fields, start);
+        return status;
+    }
+    pentry->field_count++;
+
+    return PANDORAE_OK;
+}
+
+#define POINT_ENTRY_APPEND(pentry, key, append) \
+    size_t start; \
+    pandora_error_t status = point_entry_begin_field(pentry, key, &start); \
+    if (status != PANDORAE_OK) \
+        return status; \
+    return point_entry_end_field(pentry, start, append(&pentry->fields, value))
 
 pandora_error_t point_entry_append_boolean(s_point_entry *pentry, const char *key, int value)
 {
-    POINT_ENTRY_APPEND_FIELD(pentry, key, value ? "true" : "false", "%s=%s", 4);
+    POINT_ENTRY_APPEND(pentry, key, buffer_append_boolean);
 }
 
 pandora_error_t point_entry_append_int32(s_point_entry *pentry, const char *key, long value)
 {
-    POINT_ENTRY_APPEND_FIELD(pentry, key, value, "%s=%ld", 11);
+    POINT_ENTRY_APPEND(pentry, key, buffer_append_i64);
 }
 
 pandora_error_t point_entry_append_int64(s_point_entry *pentry, const char *key, long long value)
 {
-    POINT_ENTRY_APPEND_FIELD(pentry, key, value, "%s=%lld", 20);
+    POINT_ENTRY_APPEND(pentry, key, buffer_append_i64);
 }
 
 pandora_error_t point_entry_append_float32(s_point_entry *pentry, const char *key, float value)
 {
-    POINT_ENTRY_APPEND_FIELD(pentry, key, value, "%s=%f", 32);
+    POINT_ENTRY_APPEND(pentry, key, buffer_append_float);
 }
 
 pandora_error_t point_entry_append_float64(s_point_entry *pentry, const char *key, double value)
 {
-    POINT_ENTRY_APPEND_FIELD(pentry, key, value, "%s=%lf", 48);
+    POINT_ENTRY_APPEND(pentry, key, buffer_append_double);
+}
+
+static int buffer_append_string(buffer_t *buf, const char *value)
+{
+    return buffer_append_escaped(buf, value, strlen(value));
 }
 
 pandora_error_t point_entry_append_string(s_point_entry *pentry, const char *key, const char *value)
 {
-    POINT_ENTRY_APPEND_FIELD(pentry, key, value, "%s=%s", strlen(value));
+    if (!value)
+        return PANDORAE_INVALID_ARGUMENT;
+
+    POINT_ENTRY_APPEND(pentry, key, buffer_append_string);
+}
+
+/*
+ * Destroyed batches are kept for reuse in a fixed array of slots, taken and given back with
+ * atomic exchanges only. A slot holds either a batch or NULL, so there is no list to corrupt
+ */
+static _Atomic(s_data_points *) data_points_pool[DATA_POINTS_POOL_SIZE];
+
+static s_data_points *data_points_pool_get(void)
+{
+    s_data_points *data;
+    int i;
+
+    for (i = 0; i < DATA_POINTS_POOL_SIZE; i++) {
+        if (!atomic_load_explicit(&data_points_pool[i], memory_order_relaxed))
+            continue;
+        data = atomic_exchange_explicit(&data_points_pool[i], NULL, memory_order_acquire);
+        if (data)
+            return data;
+    }
+    return NULL;
+}
+
+static int data_points_pool_put(s_data_points *data)
+{
+    s_data_points *expected;
+    int i;
+
+    for (i = 0; i < DATA_POINTS_POOL_SIZE; i++) {
+        expected = NULL;
+        if (atomic_compare_exchange_strong_explicit(&data_points_pool[i], &expected, data,
+                                                    memory_order_release, memory_order_relaxed))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static void data_points_free(s_data_points *data)
+{
+    if (data->buf) {
+        buffer_destroy(data->buf);
+        data->buf = NULL;
+        data->point_count = 0;
+    }
+    pandora_free(data);
+}
+
+void data_points_pool_trim(void)
+{
+    s_data_points *data;
+
+    while ((data = data_points_pool_get()) != NULL)
+        data_points_free(data);
+    buffer_pool_trim();
 }
 
 s_data_points *data_points_create()
 {
     buffer_t *buf;
-    s_data_points *data;
+    s_data_points *data = data_points_pool_get();
+
+    if (data)
+        return data;
 
-    buf = buffer_create(DATA_BUFFER_SIZE, BUFFER_OWNS_SELF | BUFFER_OWNS_DATA | BUFFER_GROWABLE);
+    /* large batches chain segments instead of copying everything on each realloc */
+    buf = buffer_create(DATA_BUFFER_SIZE, BUFFER_OWNS_SELF | BUFFER_OWNS_DATA | BUFFER_SEGMENTED);
     if (!buf)
         return NULL;
 
-    data = malloc(sizeof(s_data_points));
+    data = pandora_malloc(sizeof(s_data_points));
     if (!data) {
         buffer_destroy(buf);
         return NULL;
     }
     data->buf = buf;
     data->point_count = 0;
+    data->point_start = 0;
+    data->point_fields = -1;
 
     return data;
 }
@@ -194,239 +450,945 @@ void data_points_clear(s_data_points *data)
 
     buffer_reset(data->buf);
     data->point_count = 0;
+    data->point_start = 0;
+    data->point_fields = -1;
 }
 
 void data_points_destroy(s_data_points *data)
 {
-    if (data) {
-        if (data->buf) {
-            buffer_destroy(data->buf);
-            data->buf = NULL;
-            data->point_count = 0;
-        }
-        free(data);
+    if (!data)
+        return;
+
+    /* a batch which grew past DATA_POINTS_POOL_KEEP gives the rest back before it is kept */
+    if (data->buf && !pandora_memory_over_budget()) {
+        data_points_clear(data);
+        buffer_trim(data->buf, DATA_POINTS_POOL_KEEP);
+        if (data_points_pool_put(data))
+            return;
     }
+    data_points_free(data);
 }
 
 pandora_error_t data_points_append(s_data_points *data, s_point_entry *pentry)
 {
-    if (!data || !data->buf || !pentry || !pentry->fields)
+    if (!data || !data->buf || !pentry || pentry->field_count == 0 || data->point_fields >= 0)
         return PANDORAE_INVALID_ARGUMENT;
 
-    struct curl_slist *item = pentry->fields;
-    while (item) {
-        buffer_write(data->buf, item->data, strlen(item->data));
-        item = item->next;
-        if (item)
-            buffer_append(data->buf, '\t');
-    }
-    buffer_append(data->buf, '\n');
+    /* one capacity check for the point and its line end */
+    if (!buffer_reserve(data->buf, BUFFER_SIZE(&pentry->fields) + 1))
+        return PANDORAE_OUT_OF_MEMORY;
+    memcpy(BUFFER_TAIL(data->buf), pentry->fields.data, BUFFER_SIZE(&pentry->fields));
+    data->buf->written += BUFFER_SIZE(&pentry->fields);
+    BUFFER_APPEND(data->buf, '\n');
 
     data->point_count++;
 
     return PANDORAE_OK;
 }
 
-pandora_error_t data_points_append_string(s_data_points *data, const char *str)
+pandora_error_t data_points_begin_point(s_data_points *data)
 {
-    if (!data || !data->buf || !str)
+    if (!data || !data->buf || data->point_fields >= 0)
         return PANDORAE_INVALID_ARGUMENT;
 
-    buffer_write(data->buf, str, strlen(str));
-
-    data->point_count++;
+    data->point_start = data->buf->written;
+    data->point_fields = 0;
 
     return PANDORAE_OK;
 }
 
-char *data_points_to_string(s_data_points *data)
+static void data_points_abort_point(s_data_points *data)
 {
-    if (!data)
-        return NULL;
-
-    return data->buf->data;
+    buffer_truncate(data->buf, data->point_start);
+    data->point_fields = -1;
 }
 
-size_t data_points_length(s_data_points *data)
+static pandora_error_t data_points_begin_field(s_data_points *data, const char *key, size_t *start)
 {
-    if (!data || !data->buf)
-        return 0;
+    pandora_error_t status;
 
-    return data->buf->written;
+    if (!data || !data->buf || data->point_fields < 0 || !key)
+        return PANDORAE_INVALID_ARGUMENT;
+
+    status = field_key(data->buf, data->point_fields == 0, key, start);
+    if (status != PANDORAE_OK)
+        data_points_abort_point(data);
+    return status;
 }
 
-int data_points_count(s_data_points *data)
+/* Running out of memory drops the whole point, an invalid value only the field */
+static pandora_error_t data_points_end_field(s_data_points *data, size_t start, int appended)
 {
-    if (!data || !data->buf)
-        return 0;
+    pandora_error_t status = field_status(appended);
 
-    return data->point_count;
+    if (status == PANDORAE_OUT_OF_MEMORY)
+        data_points_abort_point(data);
+    else if (status != PANDORAE_OK)
+        buffer_truncate(data->buf, start);
+    if (status != PANDORAE_OK)
+        return status;
+    data->point_fields++;
+
+    return PANDORAE_OK;
 }
 
-typedef struct {
-    char *memory;
-    size_t size;
-} memory_t;
+#define DATA_POINTS_ADD(data, key, append) \
+    size_t start; \
+    pandora_error_t status = data_points_begin_field(data, key, &start); \
+    if (status != PANDORAE_OK) \
+        return status; \
+    return data_points_end_field(data, start, append(data->buf, value))
 
-static size_t write_callback(void *contents, size_t size, size_t nmemb, void *userp)
+pandora_error_t data_points_add_boolean(s_data_points *data, const char *key, int value)
 {
-    size_t realsize = size * nmemb;
-    memory_t *mem = (memory_t *)userp;
+    DATA_POINTS_ADD(data, key, buffer_append_boolean);
+}
 
-    mem->memory = realloc(mem->memory, mem->size + realsize + 1);
-    if(mem->memory == NULL) {
-        /* out of memory! */
-        printf("not enough memory (realloc returned NULL)\n");
-        return 0;
-    }
+pandora_error_t data_points_add_int32(s_data_points *data, const char *key, long value)
+{
+    DATA_POINTS_ADD(data, key, buffer_append_i64);
+}
 
-    memcpy(&(mem->memory[mem->size]), contents, realsize);
-    mem->size += realsize;
-    mem->memory[mem->size] = 0;
+pandora_error_t data_points_add_int64(s_data_points *data, const char *key, long long value)
+{
+    DATA_POINTS_ADD(data, key, buffer_append_i64);
+}
 
-    return realsize;
+pandora_error_t data_points_add_float32(s_data_points *data, const char *key, float value)
+{
+    DATA_POINTS_ADD(data, key, buffer_append_float);
 }
 
-int pandora_client_curl(const char *url, struct curl_slist *headers, char *data, size_t len, char **response)
+pandora_error_t data_points_add_float64(s_data_points *data, const char *key, double value)
 {
-    CURLcode c;
-    CURL *handle = curl_easy_init();
+    DATA_POINTS_ADD(data, key, buffer_append_double);
+}
 
-    curl_easy_setopt(handle, CURLOPT_URL, url);
-    curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
+pandora_error_t data_points_add_string(s_data_points *data, const char *key, const char *value)
+{
+    if (!value)
+        return PANDORAE_INVALID_ARGUMENT;
 
-    memory_t chunk;
-    chunk.memory = malloc(1);
-    chunk.size = 0;
+    DATA_POINTS_ADD(data, key, buffer_append_string);
+}
 
-    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(handle, CURLOPT_WRITEDATA, (void *)&chunk);
+/* Append the pre-encoded key of field idx; the tab in front is skipped for the first field */
+static pandora_error_t data_points_begin_schema_field(s_data_points *data, s_pandora_schema *schema, int idx,
+                                                      e_field_type type, size_t *start)
+{
+    const char *prefix;
+    size_t prefix_len;
 
-    if (len > 0) {
-        curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE, len);
-        curl_easy_setopt(handle, CURLOPT_POSTFIELDS, data);
-    }
+    if (!data || !data->buf || data->point_fields < 0 || !schema || idx < 0 || idx >= schema->count)
+        return PANDORAE_INVALID_ARGUMENT;
 
-    c = curl_easy_perform(handle);
-    if (c == CURLE_OK) {
-        long status_code = 0;
-        if (curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status_code) == CURLE_OK)
-            c = status_code;
-    }
-    if (response != NULL) {
-        *response = chunk.memory;
-    } else {
-        free(chunk.memory);
+    if (schema->types[idx] != type)
+        return PANDORAE_SCHEMA_MISMATCH;
+
+    prefix = schema->prefixes + schema->offsets[idx];
+    prefix_len = schema->offsets[idx + 1] - schema->offsets[idx];
+    if (data->point_fields == 0) {
+        prefix++;
+        prefix_len--;
     }
 
-    curl_easy_cleanup(handle);
+    *start = BUFFER_SIZE(data->buf);
+    if (!buffer_write(data->buf, prefix, prefix_len)) {
+        data_points_abort_point(data);
+        return PANDORAE_OUT_OF_MEMORY;
+    }
 
-    return c;
+    return PANDORAE_OK;
 }
 
-void add_request_headers(s_pandora_client *client, const char *uri, struct curl_slist **headers)
+#define DATA_POINTS_ADD_SCHEMA(data, schema, idx, type, append) \
+    size_t start; \
+    pandora_error_t status = data_points_begin_schema_field(data, schema, idx, type, &start); \
+    if (status != PANDORAE_OK) \
+        return status; \
+    return data_points_end_field(data, start, append(data->buf, value))
+
+pandora_error_t data_points_add_field_boolean(s_data_points *data, s_pandora_schema *schema, int idx, int value)
 {
-    char date[36];
-    char signstr[128];
+    DATA_POINTS_ADD_SCHEMA(data, schema, idx, FIELD_BOOLEAN, buffer_append_boolean);
+}
 
-    char *pmt = current_gmt();
-    snprintf(date, 36, "Date: %s", pmt);
-    snprintf(signstr, 128, "POST\n\ntext/plain\n%s\n%s", pmt, uri);
-    free(pmt);
+pandora_error_t data_points_add_field_int32(s_data_points *data, s_pandora_schema *schema, int idx, long value)
+{
+    DATA_POINTS_ADD_SCHEMA(data, schema, idx, FIELD_INT32, buffer_append_i64);
+}
 
-    unsigned char hmac[20];
-    char b64[((20 + 1) * 4) / 3 +1];
-    char auth[AUTH_BUFFER_SIZE];
+pandora_error_t data_points_add_field_int64(s_data_points *data, s_pandora_schema *schema, int idx, long long value)
+{
+    DATA_POINTS_ADD_SCHEMA(data, schema, idx, FIELD_INT64, buffer_append_i64);
+}
 
-    hmac_sha1(hmac, (unsigned char *)client->params.secret_key, strlen(client->params.secret_key),
-              (unsigned char *)signstr, strlen(signstr));
-    base64_encode(hmac, 20, b64);
-    snprintf(auth, AUTH_BUFFER_SIZE, "Authorization: Pandora %s:%s", client->params.access_key, b64);
+pandora_error_t data_points_add_field_float32(s_data_points *data, s_pandora_schema *schema, int idx, float value)
+{
+    DATA_POINTS_ADD_SCHEMA(data, schema, idx, FIELD_FLOAT32, buffer_append_float);
+}
 
-    *headers = curl_slist_append(*headers, "Content-Type: text/plain");
-    *headers = curl_slist_append(*headers, date);
-    *headers = curl_slist_append(*headers, "User-Agent: " PANDORA_C_USER_AGENT);
-    *headers = curl_slist_append(*headers, auth);
-    *headers = curl_slist_append(*headers, "Expect:");
-    *headers = curl_slist_append(*headers, "Accept-Encoding: gzip");
+pandora_error_t data_points_add_field_float64(s_data_points *data, s_pandora_schema *schema, int idx, double value)
+{
+    DATA_POINTS_ADD_SCHEMA(data, schema, idx, FIELD_FLOAT64, buffer_append_double);
 }
 
-pandora_error_t cache_control_create_tmpfile(s_cache_control *ctl)
+pandora_error_t data_points_add_field_string(s_data_points *data, s_pandora_schema *schema, int idx, const char *value)
 {
-    if (!ctl)
+    if (!value)
         return PANDORAE_INVALID_ARGUMENT;
 
-    if (ctl->fileptr) {
-        fflush(ctl->fileptr);
-        rewind(ctl->fileptr);
+    DATA_POINTS_ADD_SCHEMA(data, schema, idx, FIELD_STRING, buffer_append_string);
+}
 
-        ctl->oldpf = ctl->fileptr;
-        memcpy(ctl->oldfn, ctl->filename, strlen(ctl->filename));
-        ctl->fileptr = NULL;
-    }
+/* Upper bound of the bytes rows points of columns take, strings measured exactly before escaping */
+static size_t data_points_columns_size(s_pandora_schema *schema, const void **columns, size_t rows)
+{
+    size_t bytes = rows, row;
+    int i;
 
-    time_t rawtime;
-    struct tm *ptm;
+    for (i = 0; i < schema->count; i++) {
+        if (!columns[i])
+            continue;
 
-gen_filename:
-    time (&rawtime);
-    ptm = gmtime (&rawtime);
-    if (ctl->cachedir[strlen(ctl->cachedir) - 1] == '/') {
-        snprintf(ctl->filename, FILENAME_MAX, "%scache.%02d%02d%02d%02d%02d", ctl->cachedir,
-                 ptm->tm_mon, ptm->tm_mday, ptm->tm_hour, ptm->tm_min, ptm->tm_sec);
-    } else {
-        snprintf(ctl->filename, FILENAME_MAX, "%s/cache.%02d%02d%02d%02d%02d", ctl->cachedir,
-                 ptm->tm_mon, ptm->tm_mday, ptm->tm_hour, ptm->tm_min, ptm->tm_sec);
-    }
-    if (strcmp(ctl->filename, ctl->oldfn) == 0) {
-        sleep(1);
-        goto gen_filename;
+        bytes += rows * (schema->offsets[i + 1] - schema->offsets[i]);
+        if (schema->types[i] != FIELD_STRING) {
+            bytes += rows * FORMAT_MAX_SIZE;
+            continue;
+        }
+        for (row = 0; row < rows; row++) {
+            const char *value = ((const char **)columns[i])[row];
+            if (value)
+                bytes += ESCAPE_MAX_SIZE(strlen(value));
+        }
     }
 
-    ctl->fileptr = fopen(ctl->filename, "w+");
-    if (!ctl->fileptr) {
-        perror("fopen");
-        return PANDORAE_CREATE_CACHE;
+    return bytes;
+}
+
+pandora_error_t data_points_append_columns(s_data_points *data, s_pandora_schema *schema, const void **columns, size_t rows)
+{
+    size_t row, len;
+    char *out, *start;
+    int i, count = 0;
+
+    if (!data || !data->buf || data->point_fields >= 0 || !schema || !columns)
+        return PANDORAE_INVALID_ARGUMENT;
+
+    /* everything is written in place below, with no further capacity checks */
+    if (!buffer_reserve(data->buf, data_points_columns_size(schema, columns, rows)))
+        return PANDORAE_OUT_OF_MEMORY;
+
+    out = BUFFER_TAIL(data->buf);
+    for (row = 0; row < rows; row++) {
+        start = out;
+        for (i = 0; i < schema->count; i++) {
+            const char *prefix = schema->prefixes + schema->offsets[i];
+            size_t prefix_len = schema->offsets[i + 1] - schema->offsets[i];
+            const char *value = NULL;
+
+            if (!columns[i])
+                continue;
+            if (schema->types[i] == FIELD_STRING) {
+                value = ((const char **)columns[i])[row];
+                if (!value)
+                    continue;
+            }
+
+            /* the tab in front is skipped for the first field of a row */
+            if (out == start) {
+                prefix++;
+                prefix_len--;
+            }
+            memcpy(out, prefix, prefix_len);
+            out += prefix_len;
+
+            switch (schema->types[i]) {
+            case FIELD_BOOLEAN:
+                if (((const int *)columns[i])[row]) {
+                    memcpy(out, "true", 4);
+                    out += 4;
+                } else {
+                    memcpy(out, "false", 5);
+                    out += 5;
+                }
+                break;
+            case FIELD_INT32:
+                out += format_int64(out, ((const long *)columns[i])[row]);
+                break;
+            case FIELD_INT64:
+                out += format_int64(out, ((const long long *)columns[i])[row]);
+                break;
+            case FIELD_FLOAT32:
+                out += format_float32(out, ((const float *)columns[i])[row]);
+                break;
+            case FIELD_FLOAT64:
+                out += format_float64(out, ((const double *)columns[i])[row]);
+                break;
+            case FIELD_STRING:
+                /* nothing is in data->buf->written yet, the batch is rejected as a whole */
+                if (!escape_value(out, value, strlen(value), &len))
+                    return PANDORAE_INVALID_UTF8;
+                out += len;
+                break;
+            }
+        }
+
+        if (out != start) {
+            *out++ = '\n';
+            count++;
+        }
     }
-    ctl->filesize = 0;
+    data->buf->written = data->buf->base + (out - data->buf->data);
+    data->point_count += count;
 
     return PANDORAE_OK;
 }
 
-pandora_error_t cache_control_delete_tmpfile(s_cache_control *ctl)
+pandora_error_t data_points_end_point(s_data_points *data)
 {
-    if (!ctl)
+    if (!data || !data->buf || data->point_fields < 0)
         return PANDORAE_INVALID_ARGUMENT;
 
-    if (ctl->oldpf) {
-        fclose(ctl->oldpf);
-        ctl->oldpf = NULL;
-        int ret = remove(ctl->oldfn);
-        if (ret == -1) {
-            fprintf(stderr, "remove cache file %s failed\n", ctl->oldfn);
-            return PANDORAE_DELETE_CACHE;
-        }
-        fprintf(stdout, "remove cache file %s successfully\n", ctl->oldfn);
+    /* like data_points_append, a point without fields is rejected */
+    if (data->point_fields == 0) {
+        data_points_abort_point(data);
+        return PANDORAE_INVALID_ARGUMENT;
+    }
+
+    if (!buffer_append(data->buf, '\n')) {
+        data_points_abort_point(data);
+        return PANDORAE_OUT_OF_MEMORY;
     }
+    data->point_fields = -1;
+    data->point_count++;
 
     return PANDORAE_OK;
 }
 
-pandora_error_t pandora_client_set_cache_policy(s_pandora_client *client, e_cache_policy policy, int threshold, char *cachedir)
+pandora_error_t data_points_append_string(s_data_points *data, const char *str)
 {
-    if (!client)
-        return PANDORAE_INVALID_CLIENT;
+    if (!data || !data->buf || !str)
+        return PANDORAE_INVALID_ARGUMENT;
 
-    if (client->cache_control.initialized)
-        return PANDORAE_CACHE_POLICY_INIT;
+    if (!buffer_write(data->buf, str, strlen(str)))
+        return PANDORAE_OUT_OF_MEMORY;
 
-    client->cache_control.policy = policy;
-    client->cache_control.threshold = threshold;
+    data->point_count++;
 
-    DIR *dirp = opendir(cachedir);
-    if (!dirp) {
-        if (mkdir(cachedir, 0777)) {
-            fprintf(stderr, "cannot create cache directory %s automatically\n", cachedir);
+    return PANDORAE_OK;
+}
+
+size_t data_points_length(s_data_points *data)
+{
+    if (!data || !data->buf)
+        return 0;
+
+    return data->buf->written;
+}
+
+int data_points_count(s_data_points *data)
+{
+    if (!data || !data->buf)
+        return 0;
+
+    return data->point_count;
+}
+
+static size_t write_callback(void *contents, size_t size, size_t nmemb, void *userp)
+{
+    size_t realsize = size * nmemb;
+    buffer_t *response = (buffer_t *)userp;
+
+    /* keep room for the NUL after the data, which is not counted in it */
+    if (!buffer_reserve(response, realsize + 1)) {
+        printf("not enough memory (realloc returned NULL)\n");
+        return 0;
+    }
+    buffer_write(response, contents, realsize);
+    *BUFFER_TAIL(response) = 0;
+
+    return realsize;
+}
+
+int response_init(buffer_t *response)
+{
+    if (!buffer_init(response, RESPONSE_BUFFER_SIZE, BUFFER_GROWABLE)) {
+        buffer_init_static(response, NULL, 0);
+        return FALSE;
+    }
+    response->data[0] = 0;
+    return TRUE;
+}
+
+void body_init(s_body *body, const buffer_t *buf, size_t offset, size_t len)
+{
+    body->buf = buf;
+    body->offset = offset;
+    body->len = len;
+    body->sent = 0;
+}
+
+static size_t body_read_callback(char *dest, size_t size, size_t nmemb, void *userp)
+{
+    s_body *body = (s_body *)userp;
+    size_t want = size * nmemb, done = 0, len;
+    const char *src;
+
+    while (done < want && body->sent < body->len) {
+        src = buffer_chunk(body->buf, body->offset + body->sent, &len);
+        if (len > body->len - body->sent)
+            len = body->len - body->sent;
+        if (len > want - done)
+            len = want - done;
+        memcpy(dest + done, src, len);
+        body->sent += len;
+        done += len;
+    }
+
+    return done;
+}
+
+/* libcurl rewinds the body when it has to send it again, e.g. after a redirect */
+static int body_seek_callback(void *userp, curl_off_t offset, int origin)
+{
+    s_body *body = (s_body *)userp;
+
+    if (origin != SEEK_SET || offset < 0 || (size_t)offset > body->len)
+        return CURL_SEEKFUNC_CANTSEEK;
+    body->sent = (size_t)offset;
+    return CURL_SEEKFUNC_OK;
+}
+
+void pandora_client_setup(CURL *handle, const char *url, struct curl_slist *headers, s_body *body, buffer_t *response)
+{
+    const char *data;
+    size_t len;
+
+    curl_easy_setopt(handle, CURLOPT_URL, url);
+    curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
+
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, (void *)response);
+
+    /* advertise every encoding libcurl was built with and inflate responses while they stream in */
+    curl_easy_setopt(handle, CURLOPT_ACCEPT_ENCODING, "");
+
+    if (body->len == 0)
+        return;
+
+    data = buffer_chunk(body->buf, body->offset, &len);
+    if (len >= body->len) {
+        curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)body->len);
+        curl_easy_setopt(handle, CURLOPT_POSTFIELDS, data);
+        return;
+    }
+
+    body->sent = 0;
+    curl_easy_setopt(handle, CURLOPT_POST, 1L);
+    curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)body->len);
+    curl_easy_setopt(handle, CURLOPT_READFUNCTION, body_read_callback);
+    curl_easy_setopt(handle, CURLOPT_READDATA, (void *)body);
+    curl_easy_setopt(handle, CURLOPT_SEEKFUNCTION, body_seek_callback);
+    curl_easy_setopt(handle, CURLOPT_SEEKDATA, (void *)body);
+}
+
+int pandora_client_result(CURL *handle, CURLcode c)
+{
+    if (c == CURLE_OK) {
+        long status_code = 0;
+        if (curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status_code) == CURLE_OK)
+            return (int)status_code;
+    }
+    return c;
+}
+
+long long pandora_client_retry_after(CURL *handle)
+{
+    curl_off_t retry_after = 0;
+
+    if (curl_easy_getinfo(handle, CURLINFO_RETRY_AFTER, &retry_after) != CURLE_OK || retry_after < 0)
+        return 0;
+    return (long long)retry_after * 1000;
+}
+
+int pandora_client_curl(s_pandora_client *client, const char *url, struct curl_slist *headers, s_body *body,
+                        char **response, long long *retry_after)
+{
+    int c;
+    CURL *handle = curl_pool_acquire(&client->curl_pool);
+    if (!handle)
+        return CURLE_FAILED_INIT;
+
+    buffer_t chunk;
+    if (!response_init(&chunk)) {
+        curl_pool_release(&client->curl_pool, handle);
+        return CURLE_OUT_OF_MEMORY;
+    }
+
+    pandora_client_setup(handle, url, headers, body, &chunk);
+
+    c = pandora_client_result(handle, curl_easy_perform(handle));
+    if (retry_after != NULL)
+        *retry_after = pandora_client_retry_after(handle);
+    /* the caller gets the array the response was received into */
+    if (response != NULL) {
+        *response = buffer_detach(&chunk, NULL);
+    } else {
+        buffer_destroy(&chunk);
+    }
+
+    curl_pool_release(&client->curl_pool, handle);
+
+    return c;
+}
+
+void add_request_headers(s_pandora_client *client, const char *uri, struct curl_slist **headers)
+{
+    char date[36];
+    char signstr[128];
+
+    char *pmt = current_gmt();
+    snprintf(date, 36, "Date: %s", pmt);
+    snprintf(signstr, 128, "POST\n\ntext/plain\n%s\n%s", pmt, uri);
+    pandora_free(pmt);
+
+    unsigned char hmac[20];
+    char b64[((20 + 1) * 4) / 3 +1];
+    char auth[AUTH_BUFFER_SIZE];
+
+    hmac_sha1(hmac, (unsigned char *)client->params.secret_key, strlen(client->params.secret_key),
+              (unsigned char *)signstr, strlen(signstr));
+    base64_encode(hmac, 20, b64);
+    snprintf(auth, AUTH_BUFFER_SIZE, "Authorization: Pandora %s:%s", client->params.access_key, b64);
+
+    *headers = curl_slist_append(*headers, "Content-Type: text/plain");
+    *headers = curl_slist_append(*headers, date);
+    *headers = curl_slist_append(*headers, "User-Agent: " PANDORA_C_USER_AGENT);
+    *headers = curl_slist_append(*headers, auth);
+    *headers = curl_slist_append(*headers, "Expect:");
+}
+
+pandora_error_t cache_control_delete_file(const char *filename)
+{
+    int ret = remove(filename);
+    if (ret == -1) {
+        fprintf(stderr, "remove cache file %s failed\n", filename);
+        return PANDORAE_DELETE_CACHE;
+    }
+    fprintf(stdout, "remove cache file %s successfully\n", filename);
+
+    return PANDORAE_OK;
+}
+
+/*
+ * Seal the current segment, if any, queue it for the flusher thread and start a new one.
+ * client->mutex must be held; unless durability is DURABILITY_NONE, the sealed segment is synced
+ * first, with the mutex let go so that writers go on appending to the new segment meanwhile
+ */
+pandora_error_t cache_control_create_tmpfile(s_pandora_client *client)
+{
+    s_cache_control *ctl = &client->cache_control;
+    s_cache_segment *segment = NULL;
+    char sealed[FILENAME_MAX];
+    unsigned long long end = 0;
+    size_t size = 0;
+    int fd = -1, sync = FALSE, ret = 0;
+    pandora_error_t status = PANDORAE_OK;
+
+    if (ctl->fd >= 0) {
+        /* a group commit still running on this segment finishes first */
+        while (ctl->syncing)
+            pthread_cond_wait(&ctl->sync_done, &client->mutex);
+
+        fd = ctl->fd;
+        size = ctl->filesize;
+        end = ctl->appended;
+        snprintf(sealed, FILENAME_MAX, "%s", ctl->filename);
+        ctl->fd = -1;
+        ctl->first_append_ms = 0;
+
+        /* committers of the sealed segment wait for this sync rather than sync the new one */
+        sync = ctl->durability != DURABILITY_NONE && ctl->synced < end;
+        if (sync)
+            ctl->syncing = TRUE;
+
+        /* queued in order right away, the flusher takes it once it is ready */
+        if (size > WAL_MAGIC_SIZE) {
+            segment = pandora_malloc(sizeof(s_cache_segment));
+            if (segment) {
+                segment->next = NULL;
+                segment->size = size;
+                segment->ready = FALSE;
+                snprintf(segment->filename, FILENAME_MAX, "%s", sealed);
+                if (ctl->sealed_tail)
+                    ctl->sealed_tail->next = segment;
+                else
+                    ctl->sealed_head = segment;
+                ctl->sealed_tail = segment;
+                ctl->flush_status.pending_segments++;
+                ctl->flush_status.pending_bytes += segment->size;
+            }
+        }
+    }
+
+    time_t rawtime;
+    struct tm tm;
+
+    /* the sequence number keeps names unique when rotating more than once a second */
+    time (&rawtime);
+    gmtime_r(&rawtime, &tm);
+    if (ctl->cachedir[strlen(ctl->cachedir) - 1] == '/') {
+        snprintf(ctl->filename, FILENAME_MAX, "%scache.%02d%02d%02d%02d%02d.%u", ctl->cachedir,
+                 tm.tm_mon, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, ctl->seq++);
+    } else {
+        snprintf(ctl->filename, FILENAME_MAX, "%s/cache.%02d%02d%02d%02d%02d.%u", ctl->cachedir,
+                 tm.tm_mon, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, ctl->seq++);
+    }
+
+    ctl->fd = wal_create(ctl->filename);
+    if (ctl->fd < 0) {
+        perror("open");
+        status = PANDORAE_CREATE_CACHE;
+    } else {
+        ctl->filesize = WAL_MAGIC_SIZE;
+    }
+
+    if (fd < 0)
+        return status;
+
+    if (sync) {
+        pthread_mutex_unlock(&client->mutex);
+        ret = wal_sync(fd);
+        close(fd);
+        pthread_mutex_lock(&client->mutex);
+        ctl->syncing = FALSE;
+        if (ret == 0 && end > ctl->synced)
+            ctl->synced = end;
+        pthread_cond_broadcast(&ctl->sync_done);
+    } else {
+        close(fd);
+    }
+
+    if (size <= WAL_MAGIC_SIZE) {
+        /* nothing was cached, nothing to replay */
+        cache_control_delete_file(sealed);
+    } else if (!segment) {
+        /* left on disk for pandora_client_write_cached */
+        fprintf(stderr, "cannot queue cache file %s\n", sealed);
+    } else {
+        segment->ready = TRUE;
+        pthread_cond_signal(&ctl->flush_wanted);
+    }
+
+    return status;
+}
+
+/* Sync everything appended so far, leading the sync or waiting for the one which covers it */
+static pandora_error_t cache_control_sync(s_pandora_client *client)
+{
+    s_cache_control *ctl = &client->cache_control;
+    unsigned long long target, end;
+    int ret = 0;
+
+    pthread_mutex_lock(&client->mutex);
+    target = ctl->appended;
+    while (ctl->synced < target && ret == 0) {
+        if (ctl->syncing) {
+            pthread_cond_wait(&ctl->sync_done, &client->mutex);
+            continue;
+        }
+
+        /* lead a sync covering everything appended so far, writers coming meanwhile wait for the next */
+        ctl->syncing = TRUE;
+        end = ctl->appended;
+        int fd = ctl->fd;
+        pthread_mutex_unlock(&client->mutex);
+        ret = wal_sync(fd);
+        pthread_mutex_lock(&client->mutex);
+        ctl->syncing = FALSE;
+        if (ret == 0 && end > ctl->synced)
+            ctl->synced = end;
+        pthread_cond_broadcast(&ctl->sync_done);
+    }
+    pthread_mutex_unlock(&client->mutex);
+
+    return ret == 0 ? PANDORAE_OK : PANDORAE_WRITE_CACHE;
+}
+
+pandora_error_t cache_control_commit(s_pandora_client *client)
+{
+    if (client->cache_control.durability != DURABILITY_GROUP_COMMIT)
+        return PANDORAE_OK;
+    return cache_control_sync(client);
+}
+
+static void *cache_syncer_run(void *arg)
+{
+    s_pandora_client *client = (s_pandora_client *)arg;
+    s_cache_control *ctl = &client->cache_control;
+
+    pthread_mutex_lock(&client->mutex);
+    while (!ctl->syncer_stop) {
+        /* woken early by pandora_client_do_cache once sync_interval_bytes are pending */
+        if (ctl->sync_interval_ms > 0)
+            cond_wait_ms(&ctl->sync_wanted, &client->mutex, ctl->sync_interval_ms);
+        else
+            pthread_cond_wait(&ctl->sync_wanted, &client->mutex);
+
+        if (ctl->synced < ctl->appended && ctl->fd >= 0) {
+            pthread_mutex_unlock(&client->mutex);
+            if (cache_control_sync(client) != PANDORAE_OK)
+                perror("fdatasync");
+            pthread_mutex_lock(&client->mutex);
+        }
+    }
+    pthread_mutex_unlock(&client->mutex);
+
+    return NULL;
+}
+
+void cache_syncer_stop(s_pandora_client *client)
+{
+    s_cache_control *ctl = &client->cache_control;
+
+    pthread_mutex_lock(&client->mutex);
+    if (!ctl->syncer_running) {
+        pthread_mutex_unlock(&client->mutex);
+        return;
+    }
+    ctl->syncer_stop = TRUE;
+    pthread_cond_signal(&ctl->sync_wanted);
+    pthread_mutex_unlock(&client->mutex);
+
+    pthread_join(ctl->syncer, NULL);
+    ctl->syncer_running = FALSE;
+    ctl->syncer_stop = FALSE;
+}
+
+pandora_error_t pandora_client_set_durability(s_pandora_client *client, e_durability mode, int interval_ms,
+                                              size_t interval_bytes)
+{
+    s_cache_control *ctl;
+
+    if (!client)
+        return PANDORAE_INVALID_CLIENT;
+    if (mode == DURABILITY_PERIODIC && interval_ms <= 0 && interval_bytes == 0)
+        return PANDORAE_INVALID_ARGUMENT;
+
+    ctl = &client->cache_control;
+    if (mode != DURABILITY_PERIODIC) {
+        cache_syncer_stop(client);
+    } else if (!ctl->syncer_running) {
+        /* started before anything changes, so that a failure leaves the previous durability */
+        if (pthread_create(&ctl->syncer, NULL, cache_syncer_run, client) != 0)
+            return PANDORAE_FAILED_INIT;
+        ctl->syncer_running = TRUE;
+    }
+
+    /* a running syncer picks up the new intervals once woken */
+    pthread_mutex_lock(&client->mutex);
+    ctl->durability = mode;
+    ctl->sync_interval_ms = interval_ms > 0 ? interval_ms : 0;
+    ctl->sync_interval_bytes = interval_bytes;
+    pthread_cond_signal(&ctl->sync_wanted);
+    pthread_mutex_unlock(&client->mutex);
+
+    return PANDORAE_OK;
+}
+
+static pandora_error_t do_write_from_path(s_pandora_client *client, const char *path, const char *repo);
+
+/* ms until the current segment is due by age, -1 when no age limit applies */
+static long long cache_control_due_in(s_cache_control *ctl, long long now)
+{
+    long long due;
+
+    if (ctl->max_age_ms <= 0 || ctl->first_append_ms == 0)
+        return -1;
+    due = ctl->first_append_ms + ctl->max_age_ms - now;
+    return due > 0 ? due : 0;
+}
+
+/*
+ * Replay the sealed segments in order, each in full before it is deleted. A segment which fails
+ * stays at the head of the queue and is retried after CACHE_FLUSH_BACKOFF ms. Between segments
+ * the current one is sealed once due by age, whether or not writes still come
+ */
+static void *cache_flusher_run(void *arg)
+{
+    s_pandora_client *client = (s_pandora_client *)arg;
+    s_cache_control *ctl = &client->cache_control;
+    s_cache_segment *segment;
+    pandora_error_t status;
+    long long now, due, retry_at = 0;
+    int ready;
+
+    pthread_mutex_lock(&client->mutex);
+    while (!ctl->flusher_stop) {
+        now = monotonic_ms();
+        due = cache_control_due_in(ctl, now);
+        if (due == 0) {
+            fprintf(stderr, "need_flush(by_timer): %lld\n", now - ctl->first_append_ms);
+            cache_control_create_tmpfile(client);
+            continue;
+        }
+
+        /* woken by pandora_client_do_cache when an empty segment gets its first record, and once a
+         * sealed segment is ready */
+        ready = ctl->sealed_head && ctl->sealed_head->ready;
+        if (!ready || now < retry_at) {
+            if (ready && (due < 0 || retry_at - now < due))
+                due = retry_at - now;
+            if (due > 0)
+                cond_wait_ms(&ctl->flush_wanted, &client->mutex, due);
+            else
+                pthread_cond_wait(&ctl->flush_wanted, &client->mutex);
+            continue;
+        }
+
+        segment = ctl->sealed_head;
+        ctl->sealed_head = segment->next;
+        if (!ctl->sealed_head)
+            ctl->sealed_tail = NULL;
+        ctl->flushing = segment;
+        ctl->flush_status.flushing = TRUE;
+        pthread_mutex_unlock(&client->mutex);
+
+        pthread_mutex_lock(&client->flush_mutex);
+        status = do_write_from_path(client, segment->filename, NULL);
+        if (status == PANDORAE_OK)
+            status = cache_control_delete_file(segment->filename);
+        if (status == PANDORAE_OK)
+            wal_remove_replayed(segment->filename);
+        else
+            fprintf(stderr, "replay of cache file %s failed with status: %d\n", segment->filename, status);
+        pthread_mutex_unlock(&client->flush_mutex);
+
+        pthread_mutex_lock(&client->mutex);
+        ctl->flushing = NULL;
+        ctl->flush_status.flushing = FALSE;
+        ctl->flush_status.last_error = status;
+        if (status == PANDORAE_OK) {
+            ctl->flush_status.pending_segments--;
+            ctl->flush_status.pending_bytes -= segment->size;
+            ctl->flush_status.flushed_segments++;
+            ctl->flush_status.flushed_bytes += segment->size;
+            ctl->flush_status.last_flush = time(NULL);
+            pandora_free(segment);
+            retry_at = 0;
+            continue;
+        }
+
+        segment->next = ctl->sealed_head;
+        ctl->sealed_head = segment;
+        if (!ctl->sealed_tail)
+            ctl->sealed_tail = segment;
+        retry_at = monotonic_ms() + CACHE_FLUSH_BACKOFF;
+    }
+    pthread_mutex_unlock(&client->mutex);
+
+    return NULL;
+}
+
+void cache_flusher_stop(s_pandora_client *client)
+{
+    s_cache_control *ctl = &client->cache_control;
+    s_cache_segment *segment;
+
+    pthread_mutex_lock(&client->mutex);
+    if (ctl->flusher_running) {
+        ctl->flusher_stop = TRUE;
+        pthread_cond_signal(&ctl->flush_wanted);
+        pthread_mutex_unlock(&client->mutex);
+
+        pthread_join(ctl->flusher, NULL);
+
+        pthread_mutex_lock(&client->mutex);
+        ctl->flusher_running = FALSE;
+        ctl->flusher_stop = FALSE;
+    }
+
+    while ((segment = ctl->sealed_head) != NULL) {
+        ctl->sealed_head = segment->next;
+        pandora_free(segment);
+    }
+    ctl->sealed_tail = NULL;
+    pthread_mutex_unlock(&client->mutex);
+}
+
+pandora_error_t pandora_client_get_flush_status(s_pandora_client *client, s_flush_status *status)
+{
+    if (!client)
+        return PANDORAE_INVALID_CLIENT;
+    if (!status)
+        return PANDORAE_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&client->mutex);
+    *status = client->cache_control.flush_status;
+    pthread_mutex_unlock(&client->mutex);
+
+    return PANDORAE_OK;
+}
+
+pandora_error_t pandora_client_set_cache_limits(s_pandora_client *client, size_t max_bytes, int max_age_ms)
+{
+    s_cache_control *ctl;
+
+    if (!client)
+        return PANDORAE_INVALID_CLIENT;
+
+    ctl = &client->cache_control;
+    if (ctl->policy == NO_CACHE || max_age_ms < 0)
+        return PANDORAE_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&client->mutex);
+    ctl->max_bytes = max_bytes;
+    ctl->max_age_ms = max_age_ms;
+    pthread_cond_signal(&ctl->flush_wanted);
+    pthread_mutex_unlock(&client->mutex);
+
+    return PANDORAE_OK;
+}
+
+/* back to NO_CACHE when pandora_client_set_cache_policy fails part way, its empty segment removed */
+static void cache_control_abandon(s_cache_control *ctl)
+{
+    if (ctl->fd >= 0) {
+        close(ctl->fd);
+        cache_control_delete_file(ctl->filename);
+    }
+    ctl->policy = NO_CACHE;
+    ctl->threshold = 0;
+    ctl->cachedir = ".";
+    ctl->fd = -1;
+    ctl->filesize = 0;
+    ctl->max_bytes = 0;
+    ctl->max_age_ms = 0;
+    ctl->first_append_ms = 0;
+    memset(ctl->filename, 0, FILENAME_MAX);
+}
+
+pandora_error_t pandora_client_set_cache_policy(s_pandora_client *client, e_cache_policy policy, int threshold, char *cachedir)
+{
+    if (!client)
+        return PANDORAE_INVALID_CLIENT;
+
+    if (client->cache_control.initialized)
+        return PANDORAE_CACHE_POLICY_INIT;
+
+    /* the age limit is kept in ms, more seconds than that holds are refused rather than wrapped */
+    if (policy == CACHE_BY_TIME && threshold > INT_MAX / 1000)
+        return PANDORAE_INVALID_ARGUMENT;
+
+    client->cache_control.policy = policy;
+    client->cache_control.threshold = threshold;
+
+    DIR *dirp = opendir(cachedir);
+    if (!dirp) {
+        if (mkdir(cachedir, 0777)) {
+            fprintf(stderr, "cannot create cache directory %s automatically\n", cachedir);
+            cache_control_abandon(&client->cache_control);
             return PANDORAE_NO_CACHE_DIR;
         }
         fprintf(stdout, "create cache directory %s automatically\n", cachedir);
@@ -436,12 +1398,27 @@ pandora_error_t pandora_client_set_cache_policy(s_pandora_client *client, e_cach
 
     client->cache_control.cachedir = cachedir;
 
-    if (policy == CACHE_BY_SIZE || policy == CACHE_BY_TIME) {
-        client->cache_control.start = (unsigned int)time(NULL);
-
-        pandora_error_t status = cache_control_create_tmpfile(&client->cache_control);
-        if (status != PANDORAE_OK)
+    if (policy == CACHE_BY_SIZE || policy == CACHE_BY_SIZE_OR_TIME)
+        client->cache_control.max_bytes = threshold > 0 ? (size_t)threshold : 0;
+    if (policy == CACHE_BY_TIME)
+        client->cache_control.max_age_ms = threshold > 0 ? threshold * 1000 : 0;
+    else if (policy == CACHE_BY_SIZE_OR_TIME)
+        client->cache_control.max_age_ms = CACHE_DEFAULT_MAX_AGE;
+
+    if (policy != NO_CACHE) {
+        pthread_mutex_lock(&client->mutex);
+        pandora_error_t status = cache_control_create_tmpfile(client);
+        pthread_mutex_unlock(&client->mutex);
+        if (status != PANDORAE_OK) {
+            cache_control_abandon(&client->cache_control);
             return status;
+        }
+
+        if (pthread_create(&client->cache_control.flusher, NULL, cache_flusher_run, client) != 0) {
+            cache_control_abandon(&client->cache_control);
+            return PANDORAE_FAILED_INIT;
+        }
+        client->cache_control.flusher_running = TRUE;
     }
 
     client->cache_control.initialized = TRUE;
@@ -451,215 +1428,608 @@ pandora_error_t pandora_client_set_cache_policy(s_pandora_client *client, e_cach
 
 int cache_control_need_flush(s_cache_control *ctl, size_t delta)
 {
-    unsigned int now, elapsed;
-
-    switch (ctl->policy) {
-        case CACHE_BY_SIZE:
-            if (ctl->filesize+delta >= ctl->threshold) {
-                fprintf(stderr, "need_flush(by_size): %lu\n", ctl->filesize+delta);
-                return TRUE;
-            }
-
-            break;
+    long long elapsed;
 
-        case CACHE_BY_TIME:
-            now = (unsigned int)time(NULL);
-            elapsed = now - ctl->start;
-            if (elapsed >= ctl->threshold) {
-                ctl->start = now;
-                fprintf(stderr, "need_flush(by_time): %d\n", elapsed);
-                return TRUE;
-            }
-
-            break;
+    if (ctl->max_bytes > 0 && ctl->filesize+delta >= ctl->max_bytes) {
+        fprintf(stderr, "need_flush(by_size): %lu\n", ctl->filesize+delta);
+        return TRUE;
+    }
 
-        default:
-            return FALSE;
+    if (ctl->max_age_ms > 0 && ctl->first_append_ms > 0) {
+        elapsed = monotonic_ms() - ctl->first_append_ms;
+        if (elapsed >= ctl->max_age_ms) {
+            fprintf(stderr, "need_flush(by_time): %lld\n", elapsed);
+            return TRUE;
+        }
     }
 
     return FALSE;
 }
 
-typedef struct {
-    const char *url;
-    const char *uri;
-    const char *repo;
-    s_data_points *data;
-} s_write_context;
-
 int do_write_should_retry(CURLcode code)
 {
     if (code >= (CURLcode)500) {
         return TRUE;
     }
 
-    switch (code) {
+    switch ((int)code) {
+        case 408: /* request timeout */
+        case 429: /* too many requests */
         case CURLE_OPERATION_TIMEDOUT:
         case CURLE_WRITE_ERROR:
         case CURLE_COULDNT_CONNECT:
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+        case CURLE_GOT_NOTHING:
             return TRUE;
         default:
             return FALSE;
     }
 }
 
+int pandora_client_encode(s_pandora_client *client, const s_body *body, buffer_t *out)
+{
+    if (client->compress_level == 0 || body->len < client->compress_min_size)
+        return FALSE;
+
+    if (!buffer_init(out, body->len / 4 + 64, BUFFER_GROWABLE))
+        return FALSE;
+
+    if (!gzip_compress(body->buf, body->offset, body->len, client->compress_level, out) ||
+        BUFFER_SIZE(out) >= body->len) {
+        buffer_destroy(out);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 pandora_error_t pandora_client_do_write(s_pandora_client *client, s_write_context *ctx)
 {
-    int retry = 0;
+    int attempt = 0;
+    int code;
     struct curl_slist *headers = NULL;
     char *result = NULL;
+    pandora_error_t status = PANDORAE_WRITE_FAILED;
+    long long started = monotonic_ms();
+    long long retry_after, delay;
+    unsigned int seed = (unsigned int)started ^ (unsigned int)(size_t)ctx;
+
+    s_body body;
+    buffer_t encoded;
+    int gzipped;
+
+    body_init(&body, ctx->data->buf, 0, data_points_length(ctx->data));
+    gzipped = pandora_client_encode(client, &body, &encoded);
+    if (gzipped)
+        body_init(&body, &encoded, 0, BUFFER_SIZE(&encoded));
+
+    for (;;) {
+        add_request_headers(client, ctx->uri, &headers);
+        if (gzipped)
+            headers = curl_slist_append(headers, "Content-Encoding: gzip");
+        code = pandora_client_curl(client, ctx->url, headers, &body, &result, &retry_after);
+        attempt++;
+
+        if (code/100 == 2) {
+            status = PANDORAE_OK;
+            break;
+        }
+
+        /* only this thread waits, client->mutex is not held here */
+        delay = retry_next_delay(client, code, attempt, started, retry_after, &seed);
+        if (delay < 0) {
+            if (!do_write_should_retry(code))
+                fprintf(stderr, "write failed: %s\n", result ? result : "");
+            break;
+        }
 
-do_write:
-    add_request_headers(client, ctx->uri, &headers);
-    int code = pandora_client_curl(ctx->url, headers, data_points_to_string(ctx->data), data_points_length(ctx->data), &result);
-    if (do_write_should_retry(code)) {
         curl_slist_free_all(headers);
         headers = NULL;
-
-        free(result);
+        pandora_free(result);
         result = NULL;
 
-        if (++retry < client->params.fail_retry) {
-            fprintf(stderr, "write failed after %d retry: %s", retry, curl_easy_strerror(code));
-            sleep(2);
-            goto do_write;
-        } else {
-            fprintf(stderr, "up to max fail retry %d: %s\n", client->params.fail_retry, curl_easy_strerror(code));
-            return PANDORAE_WRITE_FAILED;
-        }
+        sleep_ms(delay);
     }
 
     curl_slist_free_all(headers);
-    
-    if (code/100 == 2)
-        return PANDORAE_OK;
-    else {
-        fprintf(stderr, "write failed: %s\n", result);
-        free(result);
-        result = NULL;
-        return PANDORAE_WRITE_FAILED;
+    pandora_free(result);
+    if (gzipped)
+        buffer_destroy(&encoded);
+
+    return status;
+}
+
+size_t pandora_client_next_slice(s_pandora_client *client, const buffer_t *buf, size_t offset, size_t len)
+{
+    const char *chunk, *end;
+    size_t pos, avail, slice = 0;
+
+    if (len <= client->max_body_size)
+        return len;
+
+    /* cut after the last complete line that fits, looking at each segment of the window */
+    for (pos = 0; pos < client->max_body_size; pos += avail) {
+        chunk = buffer_chunk(buf, offset + pos, &avail);
+        if (avail > client->max_body_size - pos)
+            avail = client->max_body_size - pos;
+        end = memrchr(chunk, '\n', avail);
+        if (end)
+            slice = pos + (end - chunk) + 1;
+    }
+    if (slice > 0)
+        return slice;
+
+    /* a single line above the limit cannot be split, send it on its own */
+    for (pos = client->max_body_size; pos < len; pos += avail) {
+        chunk = buffer_chunk(buf, offset + pos, &avail);
+        if (avail > len - pos)
+            avail = len - pos;
+        end = memchr(chunk, '\n', avail);
+        if (end)
+            return pos + (end - chunk) + 1;
+    }
+    return len;
+}
+
+/*
+ * Post len bytes of buf from offset as bodies cut by pandora_client_next_slice, sent concurrently.
+ * Unless NULL, *accepted is set to the bytes of the bodies accepted before the first which was not
+ */
+static pandora_error_t do_write_slices(s_pandora_client *client, const char *repo, const buffer_t *buf,
+                                       size_t offset, size_t len, size_t *accepted)
+{
+    size_t pos, slice;
+    int i, count = 0;
+    pandora_error_t status;
+
+    for (pos = 0; pos < len; pos += slice, count++)
+        slice = pandora_client_next_slice(client, buf, offset + pos, len - pos);
+
+    s_transfer *transfers = pandora_malloc(sizeof(s_transfer) * count);
+    if (!transfers)
+        return PANDORAE_OUT_OF_MEMORY;
+
+    /* every slice points into buf, nothing is copied */
+    for (pos = 0, i = 0; i < count; pos += slice, i++) {
+        slice = pandora_client_next_slice(client, buf, offset + pos, len - pos);
+        transfer_init(&transfers[i], client, repo, buf, offset + pos, slice);
+    }
+
+    status = transfer_run(transfers, count);
+    if (accepted) {
+        for (i = 0, *accepted = 0; i < count && transfer_status(&transfers[i]) == PANDORAE_OK; i++)
+            *accepted += transfers[i].len;
     }
+    pandora_free(transfers);
+
+    return status;
+}
+
+pandora_error_t pandora_client_do_write_split(s_pandora_client *client, s_write_context *ctx)
+{
+    size_t len = data_points_length(ctx->data);
+
+    if (len <= client->max_body_size)
+        return pandora_client_do_write(client, ctx);
+
+    return do_write_slices(client, ctx->repo, ctx->data->buf, 0, len, NULL);
 }
 
 pandora_error_t pandora_client_do_cache(s_pandora_client *client, s_write_context *ctx)
 {
-    char *ptr;
-    size_t bytes;
+    s_cache_control *ctl = &client->cache_control;
+    size_t before = ctl->filesize;
 
-    if (!client->cache_control.fileptr)
+    if (ctl->fd < 0)
         return PANDORAE_WRITE_CACHE;
 
-    ptr = data_points_to_string(ctx->data);
-    bytes = data_points_length(ctx->data);
-    if (!ptr || bytes == 0)
+    if (!ctx->data || data_points_length(ctx->data) <= ctx->offset)
         return PANDORAE_INVALID_ARGUMENT;
 
-    fwrite(ptr, 1, bytes, client->cache_control.fileptr);
-    client->cache_control.filesize += bytes;
+    if (!wal_append(ctl->fd, &ctl->filesize, ctx->repo, ctx->data->buf, ctx->offset,
+                    data_points_length(ctx->data) - ctx->offset))
+        return PANDORAE_WRITE_CACHE;
+    ctl->appended += ctl->filesize - before;
+
+    if (ctl->first_append_ms == 0) {
+        ctl->first_append_ms = monotonic_ms();
+        if (ctl->max_age_ms > 0)
+            pthread_cond_signal(&ctl->flush_wanted);
+    }
+
+    if (ctl->durability == DURABILITY_PERIODIC && ctl->sync_interval_bytes > 0 &&
+        ctl->appended - ctl->synced >= ctl->sync_interval_bytes)
+        pthread_cond_signal(&ctl->sync_wanted);
 
     return PANDORAE_OK;
 }
 
-pandora_error_t pandora_client_write(s_pandora_client *client, const char *repo, s_data_points *data) {
-    size_t data_len = data_points_length(data);
-    if (data_len == 0)
-        return PANDORAE_OK;
-
-    int status;
-    char url[PANDORA_URL_MAX_SIZE];
+void pandora_client_write_url(s_pandora_client *client, const char *repo, char url[PANDORA_URL_MAX_SIZE], char uri[PANDORA_URL_MAX_SIZE])
+{
     snprintf(url, PANDORA_URL_MAX_SIZE, "%s/v2/repos/%s/data", client->params.pipeline_host, repo);
-    char uri[PANDORA_URL_MAX_SIZE];
     snprintf(uri, PANDORA_URL_MAX_SIZE, "/v2/repos/%s/data", repo);
+}
 
-    s_write_context ctx = {
-        .url = url,
-        .uri = uri,
-        .repo = repo,
-        .data = data,
-    };
+/*
+ * Post len bytes of buf from offset to repo in bodies cut at line boundaries, CACHE_REPLAY_BODIES of
+ * them at a time so that the bodies of a large cache file are not all compressed at once. Unless
+ * NULL, *accepted is set to the bytes from offset accepted in order, up to the first body which was not
+ */
+static pandora_error_t do_write_rounds(s_pandora_client *client, const char *repo, const buffer_t *buf,
+                                       size_t offset, size_t len, size_t *accepted)
+{
+    pandora_error_t status = PANDORAE_OK;
+    size_t pos, round, slice, done;
+    int i;
+
+    if (accepted)
+        *accepted = 0;
+    for (pos = 0; pos < len && status == PANDORAE_OK; pos += round) {
+        for (i = 0, round = 0; i < CACHE_REPLAY_BODIES && round < len - pos; i++, round += slice)
+            slice = pandora_client_next_slice(client, buf, offset + pos + round, len - pos - round);
+        status = do_write_slices(client, repo, buf, offset + pos, round, &done);
+        if (accepted)
+            *accepted += done;
+    }
 
-    pthread_mutex_lock(&client->mutex);
+    return status;
+}
 
-    if (client->cache_control.policy == NO_CACHE)
-        goto do_write;
-    else if (cache_control_need_flush(&client->cache_control, data_len))
-        goto do_flush;
+/* Post a cache file in the text format of older versions to repo, straight from its mapping */
+static pandora_error_t do_write_from_text(s_pandora_client *client, const char *path, const char *repo)
+{
+    pandora_error_t status;
+    struct stat st;
+    buffer_t body;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return PANDORAE_READ_CACHE;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return PANDORAE_READ_CACHE;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return PANDORAE_OK;
+    }
+
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return PANDORAE_READ_CACHE;
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    if (!buffer_init_extents(&body) || !buffer_add_extent(&body, map, (size_t)st.st_size))
+        status = PANDORAE_OUT_OF_MEMORY;
     else
-        goto do_cache;
+        status = do_write_rounds(client, repo, &body, 0, BUFFER_SIZE(&body), NULL);
+
+    buffer_destroy(&body);
+    munmap(map, (size_t)st.st_size);
 
-do_write:
-    status = pandora_client_do_write(client, &ctx);
-    pthread_mutex_unlock(&client->mutex);
     return status;
+}
 
-do_flush:
-    cache_control_create_tmpfile(&client->cache_control);
+/* Where a record chained into a replay batch ends, in the batch and in the segment */
+typedef struct {
+    size_t body_end;
+    size_t record_end;
+} s_replay_mark;
+
+/*
+ * Post the records chained in body, whose ends are in marks, and record the segment as replayed
+ * up to the last of them accepted in full with every body before it
+ */
+static pandora_error_t do_write_marked(s_pandora_client *client, const char *repo, const buffer_t *body,
+                                       const s_replay_mark *marks, int nmarks, const char *path)
+{
+    pandora_error_t status;
+    size_t accepted;
 
-    status = pandora_client_do_cache(client, &ctx);
-    if (status != PANDORAE_OK) {
-        fprintf(stderr, "cache failed with status: %d\n", status);
+    status = do_write_rounds(client, repo, body, 0, BUFFER_SIZE(body), &accepted);
+    while (nmarks > 0 && marks[nmarks - 1].body_end > accepted)
+        nmarks--;
+    if (nmarks > 0)
+        wal_set_replayed(path, marks[nmarks - 1].record_end);
+
+    return status;
+}
+
+/*
+ * Post the records of a mapped cache segment to the repos they were written for, straight from
+ * the mapping: the payloads of consecutive records of a repo are chained as extents and posted
+ * CACHE_REPLAY_BODIES bodies at a time. Progress is recorded after the last record accepted in
+ * order, also when a later body fails. A torn or corrupt tail is cut off
+ */
+static pandora_error_t do_write_from_map(s_pandora_client *client, s_wal_reader *reader, const char *path)
+{
+    char repo[WAL_REPO_MAX + 1] = "";
+    pandora_error_t status = PANDORAE_OK;
+    s_replay_mark *marks = NULL, *grown;
+    int nmarks = 0, max_marks = 0;
+    const char *payload;
+    buffer_t body;
+    size_t len;
+    int rc = 0;
+
+    if (!buffer_init_extents(&body)) {
+        buffer_destroy(&body);
+        return PANDORAE_OUT_OF_MEMORY;
     }
 
-    char buf[128*1024];
-    s_data_points *tmpdata = data_points_create();
+    while ((rc = wal_next(reader)) > 0) {
+        len = BUFFER_SIZE(&body);
+        if (len > 0 && (strcmp(repo, reader->repo) != 0 ||
+                        len + reader->length > CACHE_REPLAY_BODIES * client->max_body_size)) {
+            status = do_write_marked(client, repo, &body, marks, nmarks, path);
+            if (status != PANDORAE_OK)
+                break;
+            buffer_reset(&body);
+            nmarks = 0;
+        }
 
-    while (!feof(client->cache_control.oldpf)) {
-        if (fgets(buf, 128*1024, client->cache_control.oldpf) == NULL)
+        if (nmarks == max_marks) {
+            max_marks = max_marks ? max_marks * 2 : 64;
+            grown = pandora_realloc(marks, sizeof(s_replay_mark) * max_marks);
+            if (!grown) {
+                status = PANDORAE_OUT_OF_MEMORY;
+                break;
+            }
+            marks = grown;
+        }
+
+        payload = wal_payload(reader);
+        if (!payload) {
+            rc = -1;
+            break;
+        }
+        if (!buffer_add_extent(&body, payload, reader->length)) {
+            status = PANDORAE_OUT_OF_MEMORY;
             break;
+        }
+        marks[nmarks].body_end = BUFFER_SIZE(&body);
+        marks[nmarks].record_end = reader->offset;
+        nmarks++;
+        memcpy(repo, reader->repo, reader->repo_len + 1);
+    }
+
+    /* the payloads chained so far all lie before the cut, which leaves them mapped */
+    if (rc < 0) {
+        fprintf(stderr, "torn or corrupt cache record at offset %zu, cut off\n", reader->offset);
+        if (!wal_truncate(reader))
+            perror("ftruncate");
+    }
+
+    if (status == PANDORAE_OK && BUFFER_SIZE(&body) > 0)
+        status = do_write_marked(client, repo, &body, marks, nmarks, path);
+    buffer_destroy(&body);
+    pandora_free(marks);
 
-        if (data_points_length(tmpdata) + strlen(buf) > CLIENT_MAX_BODY_SIZE) {
-            ctx.data = tmpdata;
-            pandora_client_do_write(client, &ctx);
+    return status;
+}
+
+/*
+ * Like do_write_from_map for a segment which cannot be mapped, copying records of a repo one
+ * after the other together in bodies of up to max_body_size
+ */
+static pandora_error_t do_write_from_wal(s_pandora_client *client, s_wal_reader *reader, const char *path)
+{
+    char url[PANDORA_URL_MAX_SIZE];
+    char uri[PANDORA_URL_MAX_SIZE];
+    char repo[WAL_REPO_MAX + 1] = "";
+    pandora_error_t status = PANDORAE_OK;
+    size_t len;
+    int rc = 0;
+
+    s_data_points *tmpdata = data_points_create();
+    if (!tmpdata)
+        return PANDORAE_OUT_OF_MEMORY;
+    s_write_context ctx = { .url = url, .uri = uri, .repo = repo, .data = tmpdata };
+
+    while ((rc = wal_next(reader)) > 0) {
+        len = data_points_length(tmpdata);
+        if (len > 0 && (strcmp(repo, reader->repo) != 0 || len + reader->length > client->max_body_size)) {
+            pandora_client_write_url(client, repo, url, uri);
+            status = pandora_client_do_write_split(client, &ctx);
+            if (status != PANDORAE_OK)
+                break;
+            wal_set_replayed(path, reader->offset);
             data_points_clear(tmpdata);
         }
-        data_points_append_string(tmpdata, buf);
+
+        rc = wal_read(reader, tmpdata->buf);
+        if (rc <= 0)
+            break;
+        memcpy(repo, reader->repo, reader->repo_len + 1);
     }
 
-    if (data_points_count(tmpdata) > 0) {
-        ctx.data = tmpdata;
-        pandora_client_do_write(client, &ctx);
+    if (rc < 0) {
+        fprintf(stderr, "torn or corrupt cache record at offset %zu, cut off\n", reader->offset);
+        if (!wal_truncate(reader))
+            perror("ftruncate");
+    } else if (rc == 0 && reader->offset < reader->size) {
+        status = PANDORAE_OUT_OF_MEMORY;
+    }
+
+    if (status == PANDORAE_OK && data_points_length(tmpdata) > 0) {
+        pandora_client_write_url(client, repo, url, uri);
+        status = pandora_client_do_write_split(client, &ctx);
+        if (status == PANDORAE_OK)
+            wal_set_replayed(path, reader->offset);
     }
     data_points_destroy(tmpdata);
 
-    status = cache_control_delete_tmpfile(&client->cache_control);
-    pthread_mutex_unlock(&client->mutex);
     return status;
+}
+
+/*
+ * Replay the cache file at path, a cache file in the text format of older versions goes to repo.
+ * A segment resumes after the records an earlier replay got accepted
+ */
+static pandora_error_t do_write_from_path(s_pandora_client *client, const char *path, const char *repo)
+{
+    s_wal_reader reader;
+    pandora_error_t status;
+    size_t replayed;
+
+    switch (wal_open(&reader, path)) {
+        case 1:
+            replayed = wal_replayed(path);
+            if (replayed > reader.offset && replayed <= reader.size)
+                reader.offset = replayed;
+            if (wal_map(&reader))
+                status = do_write_from_map(client, &reader, path);
+            else
+                status = do_write_from_wal(client, &reader, path);
+            wal_close(&reader);
+            return status;
 
-do_cache:
-    status = pandora_client_do_cache(client, &ctx);
+        case 0:
+            /* the text format does not record the repo, the flusher thread has none to offer */
+            if (!repo)
+                return PANDORAE_READ_CACHE;
+            return do_write_from_text(client, path, repo);
+
+        default:
+            return PANDORAE_READ_CACHE;
+    }
+}
+
+pandora_error_t pandora_client_cache_write(s_pandora_client *client, s_write_context *ctx)
+{
+    pandora_error_t status = PANDORAE_OK;
+
+    /* the write which fills the segment only seals it, the flusher thread replays it */
+    pthread_mutex_lock(&client->mutex);
+    if (cache_control_need_flush(&client->cache_control, data_points_length(ctx->data) - ctx->offset))
+        status = cache_control_create_tmpfile(client);
+    if (status == PANDORAE_OK)
+        status = pandora_client_do_cache(client, ctx);
     pthread_mutex_unlock(&client->mutex);
+
+    if (status == PANDORAE_OK)
+        status = cache_control_commit(client);
     return status;
 }
 
-pandora_error_t do_write_from_file(s_pandora_client *client, FILE *fp, s_write_context *ctx)
+pandora_error_t pandora_client_write(s_pandora_client *client, const char *repo, s_data_points *data) {
+    size_t data_len = data_points_length(data);
+    if (data_len == 0)
+        return PANDORAE_OK;
+
+    char url[PANDORA_URL_MAX_SIZE];
+    char uri[PANDORA_URL_MAX_SIZE];
+    pandora_client_write_url(client, repo, url, uri);
+
+    s_write_context ctx = {
+        .url = url,
+        .uri = uri,
+        .repo = repo,
+        .data = data,
+    };
+
+    /* client->mutex only guards the cache control, never hold it across network I/O */
+    if (client->cache_control.policy == NO_CACHE)
+        return pandora_client_do_write_split(client, &ctx);
+
+    return pandora_client_cache_write(client, &ctx);
+}
+
+pandora_error_t pandora_client_write_ring(s_pandora_client *client, const char *repo, buffer_t *ring, size_t *bytes)
 {
-    if (!client || !fp)
-        return PANDORAE_INVALID_ARGUMENT;
+    pandora_error_t status;
+    size_t len;
 
-    char buf[128*1024];
-    s_data_points *tmpdata = data_points_create();
+    if (bytes)
+        *bytes = 0;
+    if (!client || !repo || !ring || !(ring->flags & BUFFER_RING))
+        return PANDORAE_INVALID_ARGUMENT;
 
-    while (!feof(fp)) {
-        if (fgets(buf, 128*1024, fp) == NULL)
-            break;
+    /* a line the producer has not finished stays for the next call */
+    buffer_ring_peek_lines(ring, ring->capacity, &len);
+    if (len == 0)
+        return PANDORAE_OK;
 
-        if (data_points_length(tmpdata) + strlen(buf) > CLIENT_MAX_BODY_SIZE) {
-            ctx->data = tmpdata;
-            pandora_client_do_write(client, ctx);
-            data_points_clear(tmpdata);
-        }
-        data_points_append_string(tmpdata, buf);
+    status = do_write_slices(client, repo, ring, ring->read, len, NULL);
+    if (status == PANDORAE_OK) {
+        buffer_ring_consume(ring, len);
+        if (bytes)
+            *bytes = len;
     }
 
-    if (data_points_count(tmpdata) > 0) {
-        ctx->data = tmpdata;
-        pandora_client_do_write(client, ctx);
+    return status;
+}
+
+pandora_error_t pandora_client_start_async(s_pandora_client *client, s_async_params *params)
+{
+    if (!client)
+        return PANDORAE_INVALID_CLIENT;
+
+    if (!params)
+        return PANDORAE_INVALID_ARGUMENT;
+
+    if (client->sender)
+        return PANDORAE_FAILED_INIT;
+
+    client->sender = async_sender_create(client, params);
+    if (!client->sender)
+        return PANDORAE_FAILED_INIT;
+
+    return PANDORAE_OK;
+}
+
+pandora_error_t pandora_client_write_async(s_pandora_client *client, const char *repo, s_data_points *data)
+{
+    return pandora_client_write_async_priority(client, repo, data, 0);
+}
+
+pandora_error_t pandora_client_write_async_priority(s_pandora_client *client, const char *repo, s_data_points *data,
+                                                    int priority)
+{
+    if (!client || !client->sender)
+        return PANDORAE_INVALID_CLIENT;
+
+    if (!repo || !data)
+        return PANDORAE_INVALID_ARGUMENT;
+
+    if (data_points_length(data) == 0) {
+        data_points_destroy(data);
+        return PANDORAE_OK;
     }
-    data_points_destroy(tmpdata);
+
+    return async_sender_push(client->sender, repo, data, priority);
+}
+
+pandora_error_t pandora_client_drain(s_pandora_client *client)
+{
+    if (!client || !client->sender)
+        return PANDORAE_INVALID_CLIENT;
+
+    async_sender_drain(client->sender);
 
     return PANDORAE_OK;
 }
 
+/* Whether path is a sealed segment queued for, or being replayed by, the flusher thread */
+static int cache_control_owns(s_cache_control *ctl, const char *path)
+{
+    s_cache_segment *segment;
+
+    if (ctl->flushing && strcmp(path, ctl->flushing->filename) == 0)
+        return TRUE;
+    for (segment = ctl->sealed_head; segment; segment = segment->next) {
+        if (strcmp(path, segment->filename) == 0)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
 pandora_error_t pandora_client_write_cached(s_pandora_client *client, const char *repo, const char *cachedir)
 {
     DIR *dirp = opendir(cachedir);
@@ -668,15 +2038,21 @@ pandora_error_t pandora_client_write_cached(s_pandora_client *client, const char
         return PANDORAE_NO_CACHE_DIR;
     }
 
-    int status;
-    char url[PANDORA_URL_MAX_SIZE];
-    snprintf(url, PANDORA_URL_MAX_SIZE, "%s/v2/repos/%s/data", client->params.pipeline_host, repo);
+    int status = PANDORAE_OK;
+
+    /* the flusher thread waits meanwhile, the segments it owns are skipped below */
+    pthread_mutex_lock(&client->flush_mutex);
 
     struct dirent *direntp;
     while ((direntp = readdir(dirp)) != NULL) {
+        size_t namelen = strlen(direntp->d_name);
         if (strcmp(direntp->d_name, ".") == 0 ||
             strcmp(direntp->d_name, "..") == 0)
             continue;
+        /* how far a segment was replayed, which goes with the segment */
+        if (namelen > strlen(WAL_REPLAYED_SUFFIX) &&
+            strcmp(direntp->d_name + namelen - strlen(WAL_REPLAYED_SUFFIX), WAL_REPLAYED_SUFFIX) == 0)
+            continue;
 
         char filepath[PATH_MAX];
         if (cachedir[strlen(cachedir) - 1] == '/') {
@@ -685,41 +2061,46 @@ pandora_error_t pandora_client_write_cached(s_pandora_client *client, const char
             snprintf(filepath, PATH_MAX, "%s/%s", cachedir, direntp->d_name);
         }
 
-        if (strcmp(filepath, client->cache_control.filename) == 0 ||
-            strcmp(filepath, client->cache_control.oldfn) == 0)
+        pthread_mutex_lock(&client->mutex);
+        int skip = strcmp(filepath, client->cache_control.filename) == 0 ||
+                   cache_control_owns(&client->cache_control, filepath);
+        pthread_mutex_unlock(&client->mutex);
+        if (skip)
             continue;
 
-        FILE *fp = fopen(filepath, "r");
-        if (!fp) {
-            fprintf(stderr, "could not open cache file: %s", filepath);
-            return PANDORAE_READ_CACHE;
-        }
         fprintf(stdout, "begin to read from cache file %s...\n", filepath);
 
-        s_write_context ctx = { .url = url, .repo = repo, .data = NULL };
-        status = do_write_from_file(client, fp, &ctx);
+        status = do_write_from_path(client, filepath, repo);
+        if (status == PANDORAE_READ_CACHE) {
+            fprintf(stderr, "could not open cache file: %s", filepath);
+            break;
+        }
         if (status != PANDORAE_OK) {
             fprintf(stderr, "write failed with status: %d", status);
-            return PANDORAE_WRITE_FAILED;
+            status = PANDORAE_WRITE_FAILED;
+            break;
         }
 
         fprintf(stdout, "cache file %s read done\n", filepath);
-        fclose(fp);
         status = remove(filepath);
         if (status == -1) {
             fprintf(stderr, "could not delete cache file: %s", filepath);
-            return PANDORAE_DELETE_CACHE;
+            status = PANDORAE_DELETE_CACHE;
+            break;
         }
+        wal_remove_replayed(filepath);
     }
 
+    pthread_mutex_unlock(&client->flush_mutex);
     closedir(dirp);
 
-    return PANDORAE_OK;
+    return status;
 }
 
 pandora_error_t pandora_client_insight_search(s_pandora_client *client, const char *repo, s_search_params *params, char **result)
 {
     struct curl_slist *headers = NULL;
+    char *response = NULL;
 
     int status;
     char url[PANDORA_URL_MAX_SIZE];
@@ -737,13 +2118,28 @@ pandora_error_t pandora_client_insight_search(s_pandora_client *client, const ch
     cJSON_AddNumberToObject(root, "size", params->size);
     cJSON_AddNumberToObject(root, "from", params->from);
     char *data = cJSON_Print(root);
+    size_t len = strlen(data);
+    buffer_t query;
+    s_body body;
+
+    /* the printed query is posted and freed as a buffer */
+    buffer_adopt(&query, data, len, len + 1, 0);
+    body_init(&body, &query, 0, len);
 
     add_request_headers(client, uri, &headers);
-    status = pandora_client_curl(url, headers, data, strlen(data), result);
+    status = pandora_client_curl(client, url, headers, &body, result ? &response : NULL, NULL);
 
     curl_slist_free_all(headers);
     cJSON_Delete(root);
-    free(data);
+    buffer_destroy(&query);
+
+    /* the result is released with free(), so it is copied out of the SDK's allocator */
+    if (result != NULL) {
+        *result = response ? malloc(strlen(response) + 1) : NULL;
+        if (*result)
+            strcpy(*result, response);
+        pandora_free(response);
+    }
 
     if (status/100 == 2)
         return PANDORAE_OK;
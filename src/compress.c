@@ -0,0 +1,67 @@
+#include <limits.h>
+#include <zlib.h>
+
+#include "pandora/alloc.h"
+#include "compress.h"
+
+/* windowBits above 15 asks zlib for a gzip header and trailer instead of zlib's own */
+#define GZIP_WINDOW_BITS (15 + 16)
+#define GZIP_MEM_LEVEL 8
+#define GZIP_CHUNK_SIZE 16384
+
+static voidpf gzip_alloc(voidpf opaque, uInt items, uInt size)
+{
+    (void)opaque;
+    return pandora_calloc(items, size);
+}
+
+static void gzip_free(voidpf opaque, voidpf address)
+{
+    (void)opaque;
+    pandora_free(address);
+}
+
+int gzip_compress(const buffer_t *src, size_t offset, size_t len, int level, buffer_t *out)
+{
+    z_stream strm;
+    char chunk[GZIP_CHUNK_SIZE];
+    size_t avail;
+    int ret, flush;
+
+    strm.zalloc = gzip_alloc;
+    strm.zfree = gzip_free;
+    strm.opaque = Z_NULL;
+    if (deflateInit2(&strm, level, Z_DEFLATED, GZIP_WINDOW_BITS, GZIP_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+        return 0;
+
+    buffer_reset(out);
+    strm.avail_in = 0;
+
+    /* input is consumed in place one segment at a time, only the compressed stream is copied out */
+    do {
+        if (strm.avail_in == 0 && len > 0) {
+            strm.next_in = (Bytef *)buffer_chunk(src, offset, &avail);
+            if (avail > len)
+                avail = len;
+            /* avail_in is 32 bits, a larger chunk is fed in several goes */
+            if (avail > UINT_MAX)
+                avail = UINT_MAX;
+            strm.avail_in = (uInt)avail;
+            offset += avail;
+            len -= avail;
+        }
+        flush = len == 0 ? Z_FINISH : Z_NO_FLUSH;
+
+        strm.next_out = (Bytef *)chunk;
+        strm.avail_out = GZIP_CHUNK_SIZE;
+        ret = deflate(&strm, flush);
+        if (ret == Z_STREAM_ERROR ||
+            !buffer_write(out, chunk, GZIP_CHUNK_SIZE - strm.avail_out)) {
+            deflateEnd(&strm);
+            return 0;
+        }
+    } while (ret != Z_STREAM_END);
+
+    deflateEnd(&strm);
+    return 1;
+}
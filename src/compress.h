@@ -0,0 +1,12 @@
+#ifndef PANDORA_C_COMPRESS_H
+#define PANDORA_C_COMPRESS_H
+
+#include "pandora/buffer.h"
+
+/**
+ * Deflate len bytes of src from offset into out with a gzip wrapper, replacing the content of out.
+ * out must be growable; returns 1 on success, 0 on failure
+ */
+int gzip_compress(const buffer_t *src, size_t offset, size_t len, int level, buffer_t *out);
+
+#endif //PANDORA_C_COMPRESS_H
@@ -0,0 +1,71 @@
+#include <pthread.h>
+#include <string.h>
+
+#include "crc32c.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CRC32C_X86 1
+#include <immintrin.h>
+#endif
+
+/* reflected Castagnoli polynomial */
+#define CRC32C_POLY 0x82F63B78u
+
+typedef uint32_t (*crc32c_fn)(uint32_t crc, const unsigned char *p, size_t len);
+
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+static uint32_t crc32c_table[256];
+
+static uint32_t crc32c_scalar(uint32_t crc, const unsigned char *p, size_t len)
+{
+    while (len--)
+        crc = crc32c_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+static crc32c_fn crc32c_impl = crc32c_scalar;
+
+#ifdef CRC32C_X86
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t len)
+{
+    uint64_t crc64 = crc;
+    uint64_t word;
+
+    for (; len >= 8; p += 8, len -= 8) {
+        memcpy(&word, p, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+    while (len--)
+        crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+
+#endif
+
+static void crc32c_select(void)
+{
+    uint32_t crc;
+    int i, bit;
+
+    for (i = 0; i < 256; i++) {
+        crc = (uint32_t)i;
+        for (bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (crc & 1 ? CRC32C_POLY : 0);
+        crc32c_table[i] = crc;
+    }
+
+#ifdef CRC32C_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+        crc32c_impl = crc32c_sse42;
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len)
+{
+    pthread_once(&crc32c_once, crc32c_select);
+    return ~crc32c_impl(~crc, (const unsigned char *)data, len);
+}
@@ -0,0 +1,13 @@
+#ifndef PANDORA_C_CRC32C_H
+#define PANDORA_C_CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Extend crc, 0 to start, with len bytes at data: CRC32C (Castagnoli), as used by iSCSI and ext4.
+ * Runs on the SSE4.2 crc32 instruction when the CPU has it
+ */
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+#endif //PANDORA_C_CRC32C_H
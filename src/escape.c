@@ -0,0 +1,349 @@
+#include <pthread.h>
+#include <string.h>
+
+#include "escape.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ESCAPE_X86 1
+#include <immintrin.h>
+#endif
+
+#define TRUE 1
+#define FALSE 0
+
+/* Length of the UTF-8 sequence starting at p, 0 if it is not valid (RFC 3629) */
+static int utf8_sequence(const unsigned char *p, size_t avail)
+{
+    unsigned char c = p[0];
+    int n, i;
+
+    if (c < 0xC2)
+        return 0;   /* stray continuation byte, or an overlong 2 byte lead */
+    else if (c < 0xE0)
+        n = 2;
+    else if (c < 0xF0)
+        n = 3;
+    else if (c < 0xF5)
+        n = 4;
+    else
+        return 0;
+
+    if (avail < (size_t)n)
+        return 0;
+    for (i = 1; i < n; i++) {
+        if ((p[i] & 0xC0) != 0x80)
+            return 0;
+    }
+
+    /* overlong forms, UTF-16 surrogates and code points past U+10FFFF */
+    if ((c == 0xE0 && p[1] < 0xA0) || (c == 0xED && p[1] > 0x9F) ||
+        (c == 0xF0 && p[1] < 0x90) || (c == 0xF4 && p[1] > 0x8F))
+        return 0;
+
+    return n;
+}
+
+/* Second char of the escape for a separator or backslash */
+static char escape_char(unsigned char c)
+{
+    return c == '\t' ? 't' : c == '\n' ? 'n' : '\\';
+}
+
+/* Escape or copy the character at src[*i], advancing both positions; FALSE if it is not valid UTF-8 */
+static int escape_one(char *out, size_t *o, const unsigned char *src, size_t *i, size_t len)
+{
+    unsigned char c = src[*i];
+    int n;
+
+    if (c == '\t' || c == '\n' || c == '\\') {
+        out[(*o)++] = '\\';
+        out[(*o)++] = escape_char(c);
+        (*i)++;
+        return TRUE;
+    }
+    if (c < 0x80) {
+        out[(*o)++] = (char)c;
+        (*i)++;
+        return TRUE;
+    }
+
+    n = utf8_sequence(src + *i, len - *i);
+    if (!n)
+        return FALSE;
+    memcpy(out + *o, src + *i, n);
+    *o += n;
+    *i += n;
+    return TRUE;
+}
+
+int escape_value_scalar(char *out, const char *src, size_t len, size_t *written)
+{
+    const unsigned char *s = (const unsigned char *)src;
+    size_t i = 0, o = 0;
+
+    while (i < len) {
+        if (!escape_one(out, &o, s, &i, len))
+            return FALSE;
+    }
+
+    *written = o;
+    return TRUE;
+}
+
+#ifdef ESCAPE_X86
+
+/* Copy len bytes with separators or backslashes at the set bits of sep, escaping those; returns the bytes written */
+static size_t escape_copy(char *out, const unsigned char *src, size_t len, unsigned int sep)
+{
+    size_t from = 0, o = 0, at;
+
+    while (sep) {
+        at = __builtin_ctz(sep);
+        memcpy(out + o, src + from, at - from);
+        o += at - from;
+        out[o++] = '\\';
+        out[o++] = escape_char(src[at]);
+        from = at + 1;
+        sep &= sep - 1;
+    }
+    memcpy(out + o, src + from, len - from);
+
+    return o + len - from;
+}
+
+/*
+ * Both kernels store whole vectors: i + width <= len and o <= 2 * i, so a vector never runs past
+ * ESCAPE_MAX_SIZE(len). A vector without separators or backslashes goes out as loaded, one with
+ * them is copied again piece by piece around them
+ */
+
+/* SSE2 has no byte shuffle for the UTF-8 tables below, vectors with non-ASCII bytes are validated one character at a time */
+__attribute__((target("sse2")))
+static int escape_value_sse2(char *out, const char *src, size_t len, size_t *written)
+{
+    const unsigned char *s = (const unsigned char *)src;
+    const __m128i tab = _mm_set1_epi8('\t'), nl = _mm_set1_epi8('\n'), bs = _mm_set1_epi8('\\');
+    size_t i = 0, o = 0, end;
+
+    while (i + 16 <= len) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        int sep = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, tab), _mm_cmpeq_epi8(v, nl)),
+                                                 _mm_cmpeq_epi8(v, bs)));
+
+        if (_mm_movemask_epi8(v)) {
+            for (end = i + 16; i < end;) {
+                if (!escape_one(out, &o, s, &i, len))
+                    return FALSE;
+            }
+        } else if (sep) {
+            o += escape_copy(out + o, s + i, 16, sep);
+            i += 16;
+        } else {
+            _mm_storeu_si128((__m128i *)(out + o), v);
+            i += 16;
+            o += 16;
+        }
+    }
+
+    while (i < len) {
+        if (!escape_one(out, &o, s, &i, len))
+            return FALSE;
+    }
+
+    *written = o;
+    return TRUE;
+}
+
+/*
+ * UTF-8 validation by table lookup (Keiser and Lemire, "Validating UTF-8 In Less Than One
+ * Instruction Per Byte"): the high nibble of each byte and both nibbles of the byte before it
+ * index three tables of error classes, a byte pair is invalid when all three agree on a class
+ */
+#define UTF8_TOO_SHORT      (1 << 0)    /* 11______ 0_______ */
+#define UTF8_TOO_LONG       (1 << 1)    /* 0_______ 10______ */
+#define UTF8_OVERLONG_3     (1 << 2)    /* 11100000 100_____ */
+#define UTF8_TOO_LARGE      (1 << 3)    /* 11110100 1001____ and up */
+#define UTF8_SURROGATE      (1 << 4)    /* 11101101 101_____ */
+#define UTF8_OVERLONG_2     (1 << 5)    /* 1100000_ 10______ */
+#define UTF8_TOO_LARGE_1000 (1 << 6)    /* 11110101 1000____ and up */
+#define UTF8_OVERLONG_4     (1 << 6)    /* 11110000 1000____ */
+#define UTF8_TWO_CONTS      (1 << 7)    /* 10______ 10______ */
+#define UTF8_CARRY          (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+#define UTF8_TABLE(t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12, t13, t14, t15) \
+    _mm256_setr_epi8(t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12, t13, t14, t15, \
+                     t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12, t13, t14, t15)
+
+/* v shifted right by n bytes across the 128 bit lanes, with the tail of prev shifted in */
+#define AVX2_PREV(v, prev, n) _mm256_alignr_epi8(v, _mm256_permute2x128_si256(prev, v, 0x21), 16 - (n))
+
+__attribute__((target("avx2")))
+static __m256i utf8_nibble(__m256i v)
+{
+    return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F));
+}
+
+/* Nonzero bytes where v, following prev, is not valid UTF-8; sequences running past v are not checked */
+__attribute__((target("avx2")))
+static __m256i utf8_errors(__m256i v, __m256i prev)
+{
+    const __m256i byte_1_high = UTF8_TABLE(
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+        UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+        UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4);
+    const __m256i byte_1_low = UTF8_TABLE(
+        UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+        UTF8_CARRY | UTF8_OVERLONG_2,
+        UTF8_CARRY,
+        UTF8_CARRY,
+        UTF8_CARRY | UTF8_TOO_LARGE,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000);
+    const __m256i byte_2_high = UTF8_TABLE(
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT);
+    __m256i prev1 = AVX2_PREV(v, prev, 1);
+    __m256i special = _mm256_and_si256(
+        _mm256_and_si256(_mm256_shuffle_epi8(byte_1_high, utf8_nibble(prev1)),
+                         _mm256_shuffle_epi8(byte_1_low, _mm256_and_si256(prev1, _mm256_set1_epi8(0x0F)))),
+        _mm256_shuffle_epi8(byte_2_high, utf8_nibble(v)));
+
+    /* the third and fourth byte of a sequence must be continuations, which the tables cannot see */
+    __m256i third = _mm256_subs_epu8(AVX2_PREV(v, prev, 2), _mm256_set1_epi8((char)(0xE0 - 0x80)));
+    __m256i fourth = _mm256_subs_epu8(AVX2_PREV(v, prev, 3), _mm256_set1_epi8((char)(0xF0 - 0x80)));
+    __m256i must_continue = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));
+
+    return _mm256_xor_si256(must_continue, special);
+}
+
+/* Nonzero when the last three bytes of v start a sequence which does not end in v */
+__attribute__((target("avx2")))
+static __m256i utf8_incomplete(__m256i v)
+{
+    const __m256i max = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1));
+
+    return _mm256_subs_epu8(v, max);
+}
+
+/* Set bits at the tabs, newlines and backslashes of v */
+__attribute__((target("avx2")))
+static unsigned int escape_mask(__m256i v)
+{
+    __m256i sep = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+
+    return (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(sep, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))));
+}
+
+__attribute__((target("avx2")))
+static int escape_value_avx2(char *out, const char *src, size_t len, size_t *written)
+{
+    const unsigned char *s = (const unsigned char *)src;
+    __m256i prev = _mm256_setzero_si256(), error = _mm256_setzero_si256(), incomplete = _mm256_setzero_si256();
+    unsigned char last[32];
+    size_t i = 0, o = 0;
+
+    while (i + 32 <= len) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        unsigned int sep = escape_mask(v);
+
+        if (_mm256_movemask_epi8(v)) {
+            error = _mm256_or_si256(error, utf8_errors(v, prev));
+            incomplete = utf8_incomplete(v);
+        } else {
+            error = _mm256_or_si256(error, incomplete);
+            incomplete = _mm256_setzero_si256();
+        }
+        prev = v;
+
+        if (sep) {
+            o += escape_copy(out + o, s + i, 32, sep);
+        } else {
+            _mm256_storeu_si256((__m256i *)(out + o), v);
+            o += 32;
+        }
+        i += 32;
+    }
+
+    /* the tail is checked zero padded, so a sequence cut short at the end shows up as too short */
+    if (i < len) {
+        __m256i v;
+        unsigned int sep;
+
+        memset(last, 0, sizeof(last));
+        memcpy(last, s + i, len - i);
+        v = _mm256_loadu_si256((const __m256i *)last);
+        sep = escape_mask(v);
+        if (_mm256_movemask_epi8(v))
+            error = _mm256_or_si256(error, utf8_errors(v, prev));
+        else
+            error = _mm256_or_si256(error, incomplete);
+        o += escape_copy(out + o, s + i, len - i, sep);
+    } else {
+        error = _mm256_or_si256(error, incomplete);
+    }
+
+    if (!_mm256_testz_si256(error, error))
+        return FALSE;
+
+    *written = o;
+    return TRUE;
+}
+
+#endif
+
+typedef int (*escape_fn)(char *out, const char *src, size_t len, size_t *written);
+
+static pthread_once_t escape_once = PTHREAD_ONCE_INIT;
+static escape_fn escape_impl = escape_value_scalar;
+static const char *escape_name = "scalar";
+
+static void escape_select(void)
+{
+#ifdef ESCAPE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        escape_impl = escape_value_avx2;
+        escape_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        escape_impl = escape_value_sse2;
+        escape_name = "sse2";
+    }
+#endif
+}
+
+int escape_value(char *out, const char *src, size_t len, size_t *written)
+{
+    /* too short to fill a vector */
+    if (len < 16)
+        return escape_value_scalar(out, src, len, written);
+
+    pthread_once(&escape_once, escape_select);
+    return escape_impl(out, src, len, written);
+}
+
+const char *escape_kernel(void)
+{
+    pthread_once(&escape_once, escape_select);
+    return escape_name;
+}
@@ -0,0 +1,27 @@
+#ifndef PANDORA_C_ESCAPE_H
+#define PANDORA_C_ESCAPE_H
+
+#include <stddef.h>
+
+/* Room escape_value needs for len bytes of input, every byte takes two at most */
+#define ESCAPE_MAX_SIZE(len) ((len) * 2)
+
+/**
+ * Copy len bytes at src to out, writing tab and newline as the two chars "\t" and "\n" so they
+ * cannot break the line protocol and backslash as "\\" so that those stay unambiguous, checking
+ * that src is valid UTF-8 on the way. out must have room for ESCAPE_MAX_SIZE(len) bytes. Returns
+ * 1 and the bytes written in *written on success, 0 when src is not valid UTF-8
+ */
+int escape_value(char *out, const char *src, size_t len, size_t *written);
+
+/**
+ * escape_value one byte at a time, what escape_value runs on CPUs without SSE2
+ */
+int escape_value_scalar(char *out, const char *src, size_t len, size_t *written);
+
+/**
+ * Name of the kernel escape_value runs on this CPU: "avx2", "sse2" or "scalar"
+ */
+const char *escape_kernel(void);
+
+#endif //PANDORA_C_ESCAPE_H
@@ -0,0 +1,336 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "format.h"
+
+/*
+ * Integers go out two digits at a time from a table. Floating point values use Grisu2
+ * (Loitsch, "Printing Floating-Point Numbers Quickly and Accurately with Integers"): the
+ * digits come from 64 bit integer arithmetic only, always read back as the same value and
+ * are the shortest such digits for all but a tiny fraction of inputs
+ */
+
+static const char digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+size_t format_uint64(char *out, uint64_t value)
+{
+    char tmp[20];
+    char *p = tmp + sizeof(tmp);
+    size_t len;
+
+    while (value >= 100) {
+        unsigned int i = (unsigned int)(value % 100) * 2;
+        value /= 100;
+        *--p = digit_pairs[i + 1];
+        *--p = digit_pairs[i];
+    }
+    if (value >= 10) {
+        *--p = digit_pairs[value * 2 + 1];
+        *--p = digit_pairs[value * 2];
+    } else {
+        *--p = (char)('0' + value);
+    }
+
+    len = tmp + sizeof(tmp) - p;
+    memcpy(out, p, len);
+    return len;
+}
+
+size_t format_int64(char *out, long long value)
+{
+    if (value < 0) {
+        *out = '-';
+        return 1 + format_uint64(out + 1, 0 - (uint64_t)value);
+    }
+    return format_uint64(out, (uint64_t)value);
+}
+
+typedef struct {
+    uint64_t f;
+    int e;
+} diy_fp;
+
+/* 10^k for k = -348, -340, ..., 340, normalized and rounded to 64 bits */
+static const uint64_t cached_powers_f[] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+    0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+    0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+    0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+    0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+    0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+    0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+    0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+    0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+    0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+    0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+    0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+    0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+    0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+    0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+    0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+    0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+    0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+    0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+    0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+    0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+    0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL
+};
+
+static const short cached_powers_e[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927,
+    -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635, -608,
+    -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316, -289,
+    -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+    56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614, 641, 667,
+    694, 720, 747, 774, 800, 827, 853, 880, 907, 933, 960, 986,
+    1013, 1039, 1066
+};
+
+static const uint32_t pow10_32[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+static diy_fp diy_fp_mul(diy_fp a, diy_fp b)
+{
+    const uint64_t m32 = 0xFFFFFFFFULL;
+    uint64_t ah = a.f >> 32, al = a.f & m32, bh = b.f >> 32, bl = b.f & m32;
+    uint64_t hh = ah * bh, lh = al * bh, hl = ah * bl, ll = al * bl;
+    uint64_t mid = (ll >> 32) + (hl & m32) + (lh & m32) + (1ULL << 31);
+    diy_fp r;
+
+    r.f = hh + (hl >> 32) + (lh >> 32) + (mid >> 32);
+    r.e = a.e + b.e + 64;
+    return r;
+}
+
+static diy_fp diy_fp_normalize(diy_fp v)
+{
+    while (!(v.f & (1ULL << 63))) {
+        v.f <<= 1;
+        v.e--;
+    }
+    return v;
+}
+
+/* Cached power c which brings c * 2^e into the digit generation range, K is its decimal exponent negated */
+static diy_fp cached_power(int e, int *K)
+{
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int k = (int)dk;
+    int index;
+    diy_fp c;
+
+    if (dk - k > 0.0)
+        k++;
+    index = (k >> 3) + 1;
+    *K = -(-348 + index * 8);
+
+    c.f = cached_powers_f[index];
+    c.e = cached_powers_e[index];
+    return c;
+}
+
+/* Walk the last digit down while that moves closer to w and stays inside the boundaries */
+static void grisu_round(char *buf, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w)
+{
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+        buf[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static int count_digits32(uint32_t n)
+{
+    int i;
+
+    for (i = 1; i < 10; i++)
+        if (n < pow10_32[i])
+            return i;
+    return 10;
+}
+
+static void digit_gen(diy_fp w, diy_fp mp, uint64_t delta, char *buf, int *len, int *K)
+{
+    const int shift = -mp.e;
+    const uint64_t one = 1ULL << shift;
+    const uint64_t wp_w = mp.f - w.f;
+    uint32_t p1 = (uint32_t)(mp.f >> shift);
+    uint64_t p2 = mp.f & (one - 1);
+    int kappa = count_digits32(p1);
+    uint64_t rest;
+
+    *len = 0;
+    while (kappa > 0) {
+        uint32_t d = p1 / pow10_32[kappa - 1];
+        p1 %= pow10_32[kappa - 1];
+        if (d || *len)
+            buf[(*len)++] = (char)('0' + d);
+        kappa--;
+        rest = ((uint64_t)p1 << shift) + p2;
+        if (rest <= delta) {
+            *K += kappa;
+            grisu_round(buf, *len, delta, rest, (uint64_t)pow10_32[kappa] << shift, wp_w);
+            return;
+        }
+    }
+
+    for (;;) {
+        char d;
+        p2 *= 10;
+        delta *= 10;
+        d = (char)(p2 >> shift);
+        if (d || *len)
+            buf[(*len)++] = (char)('0' + d);
+        p2 &= one - 1;
+        kappa--;
+        if (p2 < delta) {
+            *K += kappa;
+            grisu_round(buf, *len, delta, p2, one, -kappa < 10 ? wp_w * pow10_32[-kappa] : 0);
+            return;
+        }
+    }
+}
+
+/*
+ * Digits of the finite positive value f * 2^e go to buf, the value is buf * 10^K. lower_closer
+ * is set when the next smaller value is half as far away as the next larger one (f is a power of 2)
+ */
+static void grisu2(uint64_t f, int e, int lower_closer, char *buf, int *len, int *K)
+{
+    diy_fp v = { f, e }, w, wp, wm, c;
+
+    /* boundaries halfway to the neighbouring values */
+    wp.f = (f << 1) + 1;
+    wp.e = e - 1;
+    wp = diy_fp_normalize(wp);
+    if (lower_closer) {
+        wm.f = (f << 2) - 1;
+        wm.e = e - 2;
+    } else {
+        wm.f = (f << 1) - 1;
+        wm.e = e - 1;
+    }
+    wm.f <<= wm.e - wp.e;
+    wm.e = wp.e;
+
+    c = cached_power(wp.e, K);
+    w = diy_fp_mul(diy_fp_normalize(v), c);
+    wp = diy_fp_mul(wp, c);
+    wm = diy_fp_mul(wm, c);
+    wm.f++;
+    wp.f--;
+    digit_gen(w, wp, wp.f - wm.f, buf, len, K);
+}
+
+static size_t format_exponent(char *out, int k)
+{
+    *out = 'e';
+    return 1 + format_int64(out + 1, k);
+}
+
+/* Lay out the len digits of buf * 10^k */
+static size_t format_decimal(char *out, const char *buf, int len, int k)
+{
+    int kk = len + k;   /* 10^(kk-1) <= value < 10^kk */
+
+    if (k >= 0 && kk <= 21) {
+        /* 1234e2 -> 123400.0 */
+        memcpy(out, buf, len);
+        memset(out + len, '0', k);
+        memcpy(out + kk, ".0", 2);
+        return kk + 2;
+    }
+    if (kk > 0 && kk <= 21) {
+        /* 1234e-2 -> 12.34 */
+        memcpy(out, buf, kk);
+        out[kk] = '.';
+        memcpy(out + kk + 1, buf + kk, len - kk);
+        return len + 1;
+    }
+    if (kk > -6 && kk <= 0) {
+        /* 1234e-6 -> 0.001234 */
+        out[0] = '0';
+        out[1] = '.';
+        memset(out + 2, '0', -kk);
+        memcpy(out + 2 - kk, buf, len);
+        return 2 - kk + len;
+    }
+    if (len == 1) {
+        /* 1e30 */
+        out[0] = buf[0];
+        return 1 + format_exponent(out + 1, kk - 1);
+    }
+    /* 1234e30 -> 1.234e33 */
+    out[0] = buf[0];
+    out[1] = '.';
+    memcpy(out + 2, buf + 1, len - 1);
+    return len + 1 + format_exponent(out + len + 1, kk - 1);
+}
+
+/* Shared by both widths: bits is the IEEE encoding, precision counts the hidden bit */
+static size_t format_ieee(char *out, uint64_t bits, int precision, int exponent_bits)
+{
+    const int bias = (1 << (exponent_bits - 1)) - 1 + precision - 1;
+    const uint64_t significand = bits & ((1ULL << (precision - 1)) - 1);
+    const int biased_e = (int)((bits >> (precision - 1)) & ((1U << exponent_bits) - 1));
+    const int negative = (int)(bits >> (precision - 1 + exponent_bits)) & 1;
+    char buf[20];
+    int len, K;
+
+    if (biased_e == (1 << exponent_bits) - 1) {
+        if (significand) {
+            memcpy(out, "nan", 3);
+            return 3;
+        }
+        if (negative) {
+            memcpy(out, "-inf", 4);
+            return 4;
+        }
+        memcpy(out, "inf", 3);
+        return 3;
+    }
+
+    if (negative)
+        *out++ = '-';
+
+    if (biased_e == 0 && significand == 0) {
+        memcpy(out, "0.0", 3);
+        return negative + 3;
+    }
+
+    if (biased_e)
+        grisu2(significand | (1ULL << (precision - 1)), biased_e - bias, significand == 0 && biased_e > 1,
+               buf, &len, &K);
+    else
+        grisu2(significand, 1 - bias, 0, buf, &len, &K);
+
+    return negative + format_decimal(out, buf, len, K);
+}
+
+size_t format_float64(char *out, double value)
+{
+    uint64_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+    return format_ieee(out, bits, 53, 11);
+}
+
+size_t format_float32(char *out, float value)
+{
+    uint32_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+    return format_ieee(out, bits, 24, 8);
+}
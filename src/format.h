@@ -0,0 +1,32 @@
+#ifndef PANDORA_C_FORMAT_H
+#define PANDORA_C_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Room for the output of any formatter below */
+#define FORMAT_MAX_SIZE 32
+
+/**
+ * Write value in decimal to out (no NUL), returns the number of chars written
+ */
+size_t format_int64(char *out, long long value);
+
+/**
+ * Like format_int64, for unsigned values
+ */
+size_t format_uint64(char *out, uint64_t value);
+
+/**
+ * Write the shortest decimal which reads back as exactly value to out (no NUL), in plain notation
+ * when the decimal exponent is within -6..20 and with an exponent otherwise. Returns the number of
+ * chars written; nan and inf are written as "nan", "inf" and "-inf"
+ */
+size_t format_float64(char *out, double value);
+
+/**
+ * Like format_float64, shortest for the precision of a float
+ */
+size_t format_float32(char *out, float value);
+
+#endif //PANDORA_C_FORMAT_H
@@ -0,0 +1,134 @@
+#ifndef PANDORA_C_INTERNAL_H
+#define PANDORA_C_INTERNAL_H
+
+#include "pandora/client.h"
+
+#define PANDORA_URL_MAX_SIZE 256
+
+typedef struct {
+    const char *url;
+    const char *uri;
+    const char *repo;
+    s_data_points *data;
+    size_t offset;      /* bytes at the start of data already sent */
+} s_write_context;
+
+/**
+ * A request body: len bytes of buf from offset, which may span several segments
+ */
+typedef struct {
+    const buffer_t *buf;
+    size_t offset;
+    size_t len;
+    size_t sent;        /* position of the read callback when the body is not contiguous */
+} s_body;
+
+void body_init(s_body *body, const buffer_t *buf, size_t offset, size_t len);
+
+size_t data_points_length(s_data_points *data);
+int data_points_count(s_data_points *data);
+
+/**
+ * Append str, already encoded, as one point; on PANDORAE_OUT_OF_MEMORY data is left as it was
+ */
+pandora_error_t data_points_append_string(s_data_points *data, const char *str);
+
+/**
+ * Start an empty, NUL terminated response buffer; on failure it is left without data
+ */
+int response_init(buffer_t *response);
+
+/**
+ * Set url, headers, request body and response sink on an easy handle. A body spread over several
+ * segments is streamed through a read callback instead of being copied together
+ */
+void pandora_client_setup(CURL *handle, const char *url, struct curl_slist *headers, s_body *body, buffer_t *response);
+
+/**
+ * Map the result of a finished transfer to the http status code, or the curl error code on failure
+ */
+int pandora_client_result(CURL *handle, CURLcode c);
+
+/**
+ * Gzip a request body into out when compression is enabled and its length reaches the threshold.
+ * Returns 1 when out holds the body to send (and must be destroyed), 0 to send body as is
+ */
+int pandora_client_encode(s_pandora_client *client, const s_body *body, buffer_t *out);
+
+/**
+ * Retry-After hint of a finished transfer in milliseconds, 0 if the server sent none
+ */
+long long pandora_client_retry_after(CURL *handle);
+
+/**
+ * Append the signed request headers for uri to headers
+ */
+void add_request_headers(s_pandora_client *client, const char *uri, struct curl_slist **headers);
+
+/**
+ * Whether a write which ended with code (http status or curl error) is worth retrying
+ */
+int do_write_should_retry(CURLcode code);
+
+/**
+ * Format the pipeline url and the signed uri used to write into repo
+ */
+void pandora_client_write_url(s_pandora_client *client, const char *repo, char url[PANDORA_URL_MAX_SIZE], char uri[PANDORA_URL_MAX_SIZE]);
+
+/**
+ * Post ctx->data to the pipeline, retrying up to params.fail_retry times
+ */
+pandora_error_t pandora_client_do_write(s_pandora_client *client, s_write_context *ctx);
+
+/**
+ * Length of the next request body at offset of buf: all of len if it fits params.max_body_size,
+ * otherwise up to the last line boundary which does
+ */
+size_t pandora_client_next_slice(s_pandora_client *client, const buffer_t *buf, size_t offset, size_t len);
+
+/**
+ * Post ctx->data, split on line boundaries into bodies of at most max_body_size sent concurrently
+ */
+pandora_error_t pandora_client_do_write_split(s_pandora_client *client, s_write_context *ctx);
+
+/**
+ * Append ctx->data past ctx->offset to the current cache file, client->mutex must be held
+ */
+pandora_error_t pandora_client_do_cache(s_pandora_client *client, s_write_context *ctx);
+
+/**
+ * Append ctx->data past ctx->offset to the cache as pandora_client_write does: the current cache
+ * file is sealed first when it is due, and the append is committed as the durability mode asks.
+ * client->mutex must not be held
+ */
+pandora_error_t pandora_client_cache_write(s_pandora_client *client, s_write_context *ctx);
+
+/**
+ * A sealed cache segment waiting for the flusher thread
+ */
+typedef struct s_cache_segment {
+    struct s_cache_segment *next;
+    size_t size;
+    int ready;                  /* synced and closed, until then the flusher leaves it queued */
+    char filename[FILENAME_MAX];
+} s_cache_segment;
+
+/**
+ * With DURABILITY_GROUP_COMMIT, wait until everything appended to the cache so far is on disk.
+ * Concurrent callers share one fdatasync: the first leads a sync, those arriving meanwhile are
+ * covered by the next one. client->mutex must not be held
+ */
+pandora_error_t cache_control_commit(s_pandora_client *client);
+
+/**
+ * Stop the thread syncing the cache with DURABILITY_PERIODIC, if it runs
+ */
+void cache_syncer_stop(s_pandora_client *client);
+
+/**
+ * Stop the flusher thread once the segment it replays is done. Segments still queued stay on disk
+ * for pandora_client_write_cached
+ */
+void cache_flusher_stop(s_pandora_client *client);
+
+#endif //PANDORA_C_INTERNAL_H
@@ -0,0 +1,231 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pandora/alloc.h"
+#include "pool.h"
+
+#define TRUE 1
+#define FALSE 0
+
+static void share_lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userp)
+{
+    s_curl_pool *pool = (s_curl_pool *)userp;
+    (void)handle;
+    (void)access;
+    pthread_mutex_lock(&pool->share_locks[data]);
+}
+
+static void share_unlock(CURL *handle, curl_lock_data data, void *userp)
+{
+    s_curl_pool *pool = (s_curl_pool *)userp;
+    (void)handle;
+    pthread_mutex_unlock(&pool->share_locks[data]);
+}
+
+static void curl_pool_setup(s_curl_pool *pool, CURL *handle)
+{
+    if (pool->share)
+        curl_easy_setopt(handle, CURLOPT_SHARE, pool->share);
+    /* handles are used from many threads, never rely on signals for timeouts */
+    curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(handle, CURLOPT_MAXCONNECTS, (long)pool->max_handles);
+}
+
+int curl_pool_init(s_curl_pool *pool, int max_handles)
+{
+    int i;
+
+    if (max_handles <= 0)
+        return FALSE;
+
+    pool->idle = pandora_malloc(sizeof(CURL *) * max_handles);
+    if (!pool->idle)
+        return FALSE;
+    pool->idle_multi = pandora_malloc(sizeof(CURLM *) * max_handles);
+    if (!pool->idle_multi) {
+        pandora_free(pool->idle);
+        pool->idle = NULL;
+        return FALSE;
+    }
+    pool->nidle_multi = 0;
+    pool->nidle = 0;
+    pool->active = 0;
+    pool->max_handles = max_handles;
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+    for (i = 0; i < CURL_LOCK_DATA_LAST; i++)
+        pthread_mutex_init(&pool->share_locks[i], NULL);
+
+    /* a pool without share still reuses connections per handle, connections are never shared */
+    pool->share = curl_share_init();
+    if (pool->share) {
+        curl_share_setopt(pool->share, CURLSHOPT_LOCKFUNC, share_lock);
+        curl_share_setopt(pool->share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+        curl_share_setopt(pool->share, CURLSHOPT_USERDATA, pool);
+        curl_share_setopt(pool->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(pool->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+
+    return TRUE;
+}
+
+void curl_pool_cleanup(s_curl_pool *pool)
+{
+    int i;
+
+    while (pool->nidle > 0)
+        curl_easy_cleanup(pool->idle[--pool->nidle]);
+    pandora_free(pool->idle);
+    pool->idle = NULL;
+    while (pool->nidle_multi > 0)
+        curl_multi_cleanup(pool->idle_multi[--pool->nidle_multi]);
+    pandora_free(pool->idle_multi);
+    pool->idle_multi = NULL;
+
+    if (pool->share) {
+        curl_share_cleanup(pool->share);
+        pool->share = NULL;
+    }
+
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->mutex);
+    for (i = 0; i < CURL_LOCK_DATA_LAST; i++)
+        pthread_mutex_destroy(&pool->share_locks[i]);
+}
+
+int curl_pool_resize(s_curl_pool *pool, int max_handles)
+{
+    if (max_handles <= 0)
+        return FALSE;
+
+    pthread_mutex_lock(&pool->mutex);
+
+    if (max_handles > pool->max_handles) {
+        CURL **idle = pandora_realloc(pool->idle, sizeof(CURL *) * max_handles);
+        if (!idle) {
+            pthread_mutex_unlock(&pool->mutex);
+            return FALSE;
+        }
+        pool->idle = idle;
+
+        CURLM **idle_multi = pandora_realloc(pool->idle_multi, sizeof(CURLM *) * max_handles);
+        if (!idle_multi) {
+            pthread_mutex_unlock(&pool->mutex);
+            return FALSE;
+        }
+        pool->idle_multi = idle_multi;
+    }
+
+    while (pool->nidle > max_handles)
+        curl_easy_cleanup(pool->idle[--pool->nidle]);
+    while (pool->nidle_multi > max_handles)
+        curl_multi_cleanup(pool->idle_multi[--pool->nidle_multi]);
+    pool->max_handles = max_handles;
+
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    return TRUE;
+}
+
+static CURL *curl_pool_take(s_curl_pool *pool)
+{
+    CURL *handle = NULL;
+
+    if (pool->nidle > 0)
+        handle = pool->idle[--pool->nidle];
+    else
+        handle = curl_easy_init();
+
+    if (handle) {
+        pool->active++;
+        curl_pool_setup(pool, handle);
+    }
+
+    return handle;
+}
+
+CURL *curl_pool_acquire(s_curl_pool *pool)
+{
+    CURL *handle;
+
+    pthread_mutex_lock(&pool->mutex);
+
+    while (pool->nidle == 0 && pool->active >= pool->max_handles)
+        pthread_cond_wait(&pool->cond, &pool->mutex);
+    handle = curl_pool_take(pool);
+
+    pthread_mutex_unlock(&pool->mutex);
+
+    return handle;
+}
+
+CURL *curl_pool_try_acquire(s_curl_pool *pool)
+{
+    CURL *handle = NULL;
+
+    pthread_mutex_lock(&pool->mutex);
+
+    if (pool->nidle > 0 || pool->active < pool->max_handles)
+        handle = curl_pool_take(pool);
+
+    pthread_mutex_unlock(&pool->mutex);
+
+    return handle;
+}
+
+void curl_pool_release(s_curl_pool *pool, CURL *handle)
+{
+    if (!handle)
+        return;
+
+    /* keeps live connections, DNS and session caches of the handle */
+    curl_easy_reset(handle);
+
+    pthread_mutex_lock(&pool->mutex);
+
+    pool->active--;
+    if (pool->nidle + pool->active < pool->max_handles)
+        pool->idle[pool->nidle++] = handle;
+    else
+        curl_easy_cleanup(handle);
+
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+CURLM *curl_pool_acquire_multi(s_curl_pool *pool)
+{
+    CURLM *multi = NULL;
+
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->nidle_multi > 0)
+        multi = pool->idle_multi[--pool->nidle_multi];
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (!multi) {
+        multi = curl_multi_init();
+        if (multi)
+            curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, (long)pool->max_handles);
+    }
+
+    return multi;
+}
+
+void curl_pool_release_multi(s_curl_pool *pool, CURLM *multi)
+{
+    if (!multi)
+        return;
+
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->nidle_multi < pool->max_handles) {
+        pool->idle_multi[pool->nidle_multi++] = multi;
+        multi = NULL;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (multi)
+        curl_multi_cleanup(multi);
+}
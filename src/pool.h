@@ -0,0 +1,56 @@
+#ifndef PANDORA_C_POOL_H
+#define PANDORA_C_POOL_H
+
+#include "pandora/client.h"
+
+/**
+ * Initialize a pool of at most max_handles reusable easy handles, all
+ * attached to one share object for DNS and TLS sessions. Connections are
+ * not shared: libcurl cannot share a connection cache between handles
+ * running on different threads, so each easy handle and each multi
+ * handle keeps its own
+ */
+int curl_pool_init(s_curl_pool *pool, int max_handles);
+
+/**
+ * Destroy all idle handles and the share object; every borrowed handle
+ * must have been released before
+ */
+void curl_pool_cleanup(s_curl_pool *pool);
+
+/**
+ * Change the max number of handles; handles beyond the new limit are
+ * destroyed as they are released
+ */
+int curl_pool_resize(s_curl_pool *pool, int max_handles);
+
+/**
+ * Borrow a handle from the pool, blocks while all handles are in use.
+ * Returns NULL if a new handle could not be created
+ */
+CURL *curl_pool_acquire(s_curl_pool *pool);
+
+/**
+ * Borrow a handle without waiting, returns NULL if all handles are in use
+ */
+CURL *curl_pool_try_acquire(s_curl_pool *pool);
+
+/**
+ * Give a handle back to the pool. Options are reset, but live connections
+ * and caches kept by the handle are preserved for the next borrower
+ */
+void curl_pool_release(s_curl_pool *pool, CURL *handle);
+
+/**
+ * Borrow a multi handle for one thread to drive transfers on, with the
+ * connections an earlier borrower left open. Returns NULL if a new one
+ * could not be created
+ */
+CURLM *curl_pool_acquire_multi(s_curl_pool *pool);
+
+/**
+ * Give a multi handle back once every easy handle was removed from it
+ */
+void curl_pool_release_multi(s_curl_pool *pool, CURLM *multi);
+
+#endif //PANDORA_C_POOL_H
@@ -0,0 +1,103 @@
+#include <stdlib.h>
+
+#include "internal.h"
+#include "retry.h"
+#include "utils.h"
+
+#define TRUE 1
+#define FALSE 0
+
+void retry_budget_init(s_retry_budget *budget)
+{
+    pthread_mutex_init(&budget->mutex, NULL);
+    budget->window_start = 0;
+    budget->used = 0;
+}
+
+void retry_budget_cleanup(s_retry_budget *budget)
+{
+    pthread_mutex_destroy(&budget->mutex);
+}
+
+static int retry_budget_take(s_retry_budget *budget, const s_retry_policy *policy, long long now)
+{
+    int granted = TRUE;
+
+    if (policy->budget <= 0)
+        return TRUE;
+
+    pthread_mutex_lock(&budget->mutex);
+    if (now - budget->window_start >= policy->budget_window_ms) {
+        budget->window_start = now;
+        budget->used = 0;
+    }
+    if (budget->used < policy->budget)
+        budget->used++;
+    else
+        granted = FALSE;
+    pthread_mutex_unlock(&budget->mutex);
+
+    return granted;
+}
+
+static long long retry_backoff(const s_retry_policy *policy, int attempt, unsigned int *seed)
+{
+    long long delay = policy->base_ms;
+    int i;
+
+    for (i = 1; i < attempt && delay < policy->cap_ms; i++)
+        delay <<= 1;
+    if (delay > policy->cap_ms)
+        delay = policy->cap_ms;
+
+    /* randomize the last jitter percent of the delay so clients do not retry in lockstep */
+    long long spread = delay * policy->jitter / 100;
+    if (spread > 0)
+        delay -= rand_r(seed) % (spread + 1);
+
+    return delay;
+}
+
+static const char *retry_describe(int code, char *buf, size_t len)
+{
+    if (code >= 100) {
+        snprintf(buf, len, "http status %d", code);
+        return buf;
+    }
+    return curl_easy_strerror((CURLcode)code);
+}
+
+long long retry_next_delay(s_pandora_client *client, int code, int attempt, long long started_ms,
+                           long long retry_after_ms, unsigned int *seed)
+{
+    const s_retry_policy *policy = &client->retry_policy;
+    long long now = monotonic_ms();
+    long long delay;
+    char reason[32];
+
+    if (!do_write_should_retry(code))
+        return -1;
+
+    if (attempt >= client->params.fail_retry) {
+        fprintf(stderr, "up to max fail retry %d: %s\n", client->params.fail_retry, retry_describe(code, reason, sizeof(reason)));
+        return -1;
+    }
+
+    delay = retry_backoff(policy, attempt, seed);
+    if (retry_after_ms > delay)
+        delay = retry_after_ms;
+
+    if (policy->deadline_ms > 0 && now + delay - started_ms > policy->deadline_ms) {
+        fprintf(stderr, "write deadline %d ms exceeded after %d retry: %s\n", policy->deadline_ms, attempt,
+                retry_describe(code, reason, sizeof(reason)));
+        return -1;
+    }
+
+    if (!retry_budget_take(&client->retry_budget, policy, now)) {
+        fprintf(stderr, "retry budget exhausted after %d retry: %s\n", attempt, retry_describe(code, reason, sizeof(reason)));
+        return -1;
+    }
+
+    fprintf(stderr, "write failed after %d retry, retrying in %lld ms: %s\n", attempt, delay, retry_describe(code, reason, sizeof(reason)));
+    return delay;
+}
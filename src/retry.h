@@ -0,0 +1,25 @@
+#ifndef PANDORA_C_RETRY_H
+#define PANDORA_C_RETRY_H
+
+#include "pandora/client.h"
+
+/**
+ * Decide whether a write that ended with code (http status or curl error) after attempt
+ * attempts, the first one started at started_ms, gets another attempt. Returns the delay
+ * in milliseconds before that attempt, or -1 to give up. retry_after_ms is the server's
+ * Retry-After hint, 0 if none; seed feeds the jitter
+ */
+long long retry_next_delay(s_pandora_client *client, int code, int attempt, long long started_ms,
+                           long long retry_after_ms, unsigned int *seed);
+
+/**
+ * Initialize the retry budget shared by all writes of a client
+ */
+void retry_budget_init(s_retry_budget *budget);
+
+/**
+ * Free resources used by a retry budget
+ */
+void retry_budget_cleanup(s_retry_budget *budget);
+
+#endif //PANDORA_C_RETRY_H
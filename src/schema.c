@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pandora/alloc.h"
+#include "pandora/client.h"
+#include "utils.h"
+
+#define TRUE 1
+#define FALSE 0
+
+static int schema_valid_key(const char *key)
+{
+    const char *p;
+
+    if (!key || !(*key == '_' || (*key >= 'a' && *key <= 'z') || (*key >= 'A' && *key <= 'Z')))
+        return FALSE;
+
+    for (p = key + 1; *p; p++) {
+        if (!(*p == '_' || (*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9')))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+s_pandora_schema *pandora_schema_create(const char *repo, const char **keys, const e_field_type *types, int count)
+{
+    s_pandora_schema *schema;
+    size_t bytes = 0;
+    int i, j;
+
+    if (!repo || !keys || !types || count <= 0)
+        return NULL;
+
+    for (i = 0; i < count; i++) {
+        if (!schema_valid_key(keys[i]) || types[i] < FIELD_BOOLEAN || types[i] > FIELD_STRING)
+            return NULL;
+        for (j = 0; j < i; j++) {
+            if (strcmp(keys[i], keys[j]) == 0)
+                return NULL;
+        }
+        bytes += strlen(keys[i]) + 2;
+    }
+
+    schema = pandora_calloc(1, sizeof(s_pandora_schema));
+    if (!schema)
+        return NULL;
+
+    schema->repo = pandora_strdup(repo);
+    schema->types = pandora_malloc(sizeof(e_field_type) * count);
+    schema->prefixes = pandora_malloc(bytes);
+    schema->offsets = pandora_malloc(sizeof(size_t) * (count + 1));
+    if (!schema->repo || !schema->types || !schema->prefixes || !schema->offsets) {
+        pandora_schema_destroy(schema);
+        return NULL;
+    }
+    schema->count = count;
+
+    schema->offsets[0] = 0;
+    for (i = 0; i < count; i++) {
+        char *prefix = schema->prefixes + schema->offsets[i];
+        size_t len = strlen(keys[i]);
+
+        prefix[0] = '\t';
+        memcpy(prefix + 1, keys[i], len);
+        prefix[len + 1] = '=';
+        schema->offsets[i + 1] = schema->offsets[i] + len + 2;
+        schema->types[i] = types[i];
+    }
+
+    return schema;
+}
+
+void pandora_schema_destroy(s_pandora_schema *schema)
+{
+    if (schema) {
+        pandora_free(schema->repo);
+        pandora_free(schema->types);
+        pandora_free(schema->prefixes);
+        pandora_free(schema->offsets);
+        pandora_free(schema);
+    }
+}
@@ -0,0 +1,533 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pandora/alloc.h"
+#include "pool.h"
+#include "sender.h"
+#include "transfer.h"
+#include "utils.h"
+
+#define SENDER_POLL_TIMEOUT 100
+
+#define TRUE 1
+#define FALSE 0
+
+typedef struct {
+    char *repo;
+    s_data_points *data;
+    int priority;
+} s_async_item;
+
+typedef struct {
+    s_async_item item;
+    s_transfer transfer;
+    size_t offset;      /* start of the slice being sent, batches above max_body_size go out in slices */
+    int running;
+} s_async_slot;
+
+typedef struct {
+    s_async_sender *sender;
+    pthread_t thread;
+    CURLM *multi;
+    s_async_slot *slots;
+    int nslots;
+    int polling;
+} s_async_worker;
+
+struct s_async_sender {
+    s_pandora_client *client;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    pthread_cond_t drained;
+
+    s_async_item *items;
+    int capacity;
+    int head;
+    int count;
+    int inflight;
+    int stopping;
+
+    e_queue_policy policy;
+    int max_inflight;
+    int ordered;
+    pandora_write_callback callback;
+    void *userdata;
+    int block_timeout_ms;
+
+    /* repos of the batches in flight, only tracked when ordered */
+    const char **inflight_repos;
+
+    s_async_worker *workers;
+    int nworkers;
+};
+
+static void async_item_free(s_async_item *item)
+{
+    pandora_free(item->repo);
+    data_points_destroy(item->data);
+    item->repo = NULL;
+    item->data = NULL;
+}
+
+static pandora_error_t async_sender_spill(s_async_sender *sender, const char *repo, s_data_points *data, size_t offset)
+{
+    /* slices before offset already reached the server */
+    s_write_context ctx = { .url = NULL, .uri = NULL, .repo = repo, .data = data, .offset = offset };
+
+    /* sealed like any other cached write, or spill-only traffic would never reach the flusher */
+    return pandora_client_cache_write(sender->client, &ctx);
+}
+
+static int async_sender_repo_busy(s_async_sender *sender, const char *repo)
+{
+    int i;
+
+    for (i = 0; i < sender->inflight; i++) {
+        if (strcmp(sender->inflight_repos[i], repo) == 0)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static void async_sender_repo_done(s_async_sender *sender, const char *repo)
+{
+    int i;
+
+    for (i = 0; i < sender->inflight; i++) {
+        if (sender->inflight_repos[i] == repo) {
+            sender->inflight_repos[i] = sender->inflight_repos[sender->inflight - 1];
+            return;
+        }
+    }
+}
+
+/* Remove the i-th queued batch into item, keeping the others in order */
+static void async_sender_take(s_async_sender *sender, int i, s_async_item *item)
+{
+    int j;
+
+    *item = sender->items[(sender->head + i) % sender->capacity];
+    for (j = i; j > 0; j--)
+        sender->items[(sender->head + j) % sender->capacity] = sender->items[(sender->head + j - 1) % sender->capacity];
+    sender->head = (sender->head + 1) % sender->capacity;
+    sender->count--;
+}
+
+/*
+ * Take the oldest queued batch which may be sent now. With ordering, batches of a repo
+ * already in flight are skipped, so each repo still leaves the queue in FIFO order
+ */
+static int async_sender_pop(s_async_sender *sender, s_async_item *item)
+{
+    int i;
+
+    for (i = 0; i < sender->count; i++) {
+        s_async_item *candidate = &sender->items[(sender->head + i) % sender->capacity];
+        if (sender->ordered && async_sender_repo_busy(sender, candidate->repo))
+            continue;
+
+        async_sender_take(sender, i, item);
+
+        if (sender->ordered)
+            sender->inflight_repos[sender->inflight] = item->repo;
+        sender->inflight++;
+        pthread_cond_signal(&sender->not_full);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void async_slot_start(s_async_sender *sender, s_async_slot *slot)
+{
+    buffer_t *buf = slot->item.data->buf;
+    size_t len = data_points_length(slot->item.data) - slot->offset;
+
+    transfer_init(&slot->transfer, sender->client, slot->item.repo, buf, slot->offset,
+                  pandora_client_next_slice(sender->client, buf, slot->offset, len));
+}
+
+/* Move on to the next slice of a batch, FALSE once the batch is done or has failed */
+static int async_slot_next(s_async_worker *worker, s_async_slot *slot)
+{
+    if (transfer_status(&slot->transfer) != PANDORAE_OK ||
+        slot->offset + slot->transfer.len >= data_points_length(slot->item.data))
+        return FALSE;
+
+    slot->offset += slot->transfer.len;
+    transfer_cleanup(&slot->transfer, worker->multi);
+    async_slot_start(worker->sender, slot);
+    return TRUE;
+}
+
+static void async_worker_complete(s_async_worker *worker, s_async_slot *slot)
+{
+    s_async_sender *sender = worker->sender;
+    pandora_error_t status = transfer_status(&slot->transfer);
+
+    transfer_cleanup(&slot->transfer, worker->multi);
+    slot->running = FALSE;
+
+    if (status != PANDORAE_OK) {
+        /* keep the batch on disk when the client has a cache file */
+        if (async_sender_spill(sender, slot->item.repo, slot->item.data, slot->offset) == PANDORAE_OK)
+            fprintf(stderr, "async write to %s failed, batch spilled to cache\n", slot->item.repo);
+        else
+            fprintf(stderr, "async write to %s failed with status: %d\n", slot->item.repo, status);
+    }
+
+    if (sender->callback)
+        sender->callback(slot->item.repo, slot->item.data, status, sender->userdata);
+
+    pthread_mutex_lock(&sender->mutex);
+    if (sender->ordered)
+        async_sender_repo_done(sender, slot->item.repo);
+    sender->inflight--;
+    if (sender->ordered)
+        pthread_cond_broadcast(&sender->not_empty);
+    if (sender->count == 0 && sender->inflight == 0)
+        pthread_cond_broadcast(&sender->drained);
+    pthread_mutex_unlock(&sender->mutex);
+
+    async_item_free(&slot->item);
+    /* the memory just freed may bring writers back under budget */
+    pthread_cond_broadcast(&sender->not_full);
+}
+
+/* Fill free slots from the queue, sleeping while there is nothing to do; FALSE means stop */
+static int async_worker_fill(s_async_worker *worker, int *nrunning)
+{
+    s_async_sender *sender = worker->sender;
+    int i;
+
+    pthread_mutex_lock(&sender->mutex);
+    for (;;) {
+        for (i = 0; i < worker->nslots && *nrunning < worker->nslots; i++) {
+            s_async_slot *slot = &worker->slots[i];
+            if (slot->running)
+                continue;
+            if (!async_sender_pop(sender, &slot->item))
+                break;
+
+            slot->running = TRUE;
+            slot->offset = 0;
+            async_slot_start(sender, slot);
+            (*nrunning)++;
+        }
+
+        if (*nrunning > 0)
+            break;
+        if (sender->stopping && sender->count == 0) {
+            pthread_mutex_unlock(&sender->mutex);
+            return FALSE;
+        }
+        pthread_cond_wait(&sender->not_empty, &sender->mutex);
+    }
+    worker->polling = TRUE;
+    pthread_mutex_unlock(&sender->mutex);
+
+    return TRUE;
+}
+
+static void *async_worker_run(void *arg)
+{
+    s_async_worker *worker = (s_async_worker *)arg;
+    s_async_sender *sender = worker->sender;
+    int nrunning = 0;
+    int i, still_running, msgs;
+    long long now, wake_at;
+    CURLMsg *msg;
+
+    while (async_worker_fill(worker, &nrunning)) {
+        now = monotonic_ms();
+        wake_at = now + SENDER_POLL_TIMEOUT;
+
+        /* (re)start every transfer which is not on the wire and due */
+        for (i = 0; i < worker->nslots; i++) {
+            s_transfer *t = &worker->slots[i].transfer;
+            if (!worker->slots[i].running || t->handle)
+                continue;
+            if (t->retry_at > now) {
+                if (t->retry_at < wake_at)
+                    wake_at = t->retry_at;
+                continue;
+            }
+            if (!transfer_start(t, worker->multi))
+                wake_at = now + 10;
+        }
+
+        curl_multi_perform(worker->multi, &still_running);
+
+        while ((msg = curl_multi_info_read(worker->multi, &msgs)) != NULL) {
+            s_transfer *t = NULL;
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&t);
+            if (!transfer_done(t, worker->multi, msg->data.result)) {
+                wake_at = now;
+                continue;
+            }
+
+            for (i = 0; i < worker->nslots; i++) {
+                if (&worker->slots[i].transfer == t) {
+                    if (async_slot_next(worker, &worker->slots[i]))
+                        break;
+                    async_worker_complete(worker, &worker->slots[i]);
+                    nrunning--;
+                    break;
+                }
+            }
+            wake_at = now;
+        }
+
+        if (wake_at > now)
+            curl_multi_poll(worker->multi, NULL, 0, (int)(wake_at - now), NULL);
+
+        pthread_mutex_lock(&sender->mutex);
+        worker->polling = FALSE;
+        pthread_mutex_unlock(&sender->mutex);
+    }
+
+    return NULL;
+}
+
+static void async_sender_wakeup(s_async_sender *sender)
+{
+    int i;
+
+    pthread_cond_signal(&sender->not_empty);
+    for (i = 0; i < sender->nworkers; i++) {
+        if (sender->workers[i].polling)
+            curl_multi_wakeup(sender->workers[i].multi);
+    }
+}
+
+s_async_sender *async_sender_create(s_pandora_client *client, s_async_params *params)
+{
+    int i, max_inflight;
+
+    if (params->queue_depth <= 0 || params->sender_threads <= 0)
+        return NULL;
+    max_inflight = params->max_inflight > 0 ? params->max_inflight : 1;
+
+    s_async_sender *sender = pandora_calloc(1, sizeof(s_async_sender));
+    if (!sender)
+        return NULL;
+
+    sender->items = pandora_malloc(sizeof(s_async_item) * params->queue_depth);
+    sender->inflight_repos = pandora_malloc(sizeof(char *) * params->sender_threads * max_inflight);
+    sender->workers = pandora_calloc(params->sender_threads, sizeof(s_async_worker));
+    if (!sender->items || !sender->inflight_repos || !sender->workers) {
+        pandora_free(sender->items);
+        pandora_free(sender->inflight_repos);
+        pandora_free(sender->workers);
+        pandora_free(sender);
+        return NULL;
+    }
+
+    sender->client = client;
+    sender->capacity = params->queue_depth;
+    sender->policy = params->policy;
+    sender->max_inflight = max_inflight;
+    sender->ordered = params->ordered;
+    sender->callback = params->callback;
+    sender->userdata = params->userdata;
+    sender->block_timeout_ms = params->block_timeout_ms > 0 ? params->block_timeout_ms : 0;
+
+    pthread_mutex_init(&sender->mutex, NULL);
+    pthread_cond_init(&sender->not_empty, NULL);
+    pthread_cond_init(&sender->not_full, NULL);
+    pthread_cond_init(&sender->drained, NULL);
+
+    /* every in-flight batch needs its own connection */
+    if (client->curl_pool.max_handles < params->sender_threads * max_inflight)
+        curl_pool_resize(&client->curl_pool, params->sender_threads * max_inflight);
+
+    pthread_mutex_lock(&sender->mutex);
+    for (i = 0; i < params->sender_threads; i++) {
+        s_async_worker *worker = &sender->workers[sender->nworkers];
+        worker->sender = sender;
+        worker->multi = curl_multi_init();
+        worker->slots = pandora_calloc(max_inflight, sizeof(s_async_slot));
+        worker->nslots = max_inflight;
+        if (!worker->multi || !worker->slots ||
+            pthread_create(&worker->thread, NULL, async_worker_run, worker) != 0) {
+            if (worker->multi)
+                curl_multi_cleanup(worker->multi);
+            pandora_free(worker->slots);
+            break;
+        }
+        sender->nworkers++;
+    }
+    pthread_mutex_unlock(&sender->mutex);
+
+    if (sender->nworkers == 0) {
+        async_sender_destroy(sender);
+        return NULL;
+    }
+
+    return sender;
+}
+
+void async_sender_destroy(s_async_sender *sender)
+{
+    int i;
+
+    if (!sender)
+        return;
+
+    pthread_mutex_lock(&sender->mutex);
+    sender->stopping = TRUE;
+    pthread_cond_broadcast(&sender->not_empty);
+    pthread_cond_broadcast(&sender->not_full);
+    for (i = 0; i < sender->nworkers; i++)
+        curl_multi_wakeup(sender->workers[i].multi);
+    pthread_mutex_unlock(&sender->mutex);
+
+    for (i = 0; i < sender->nworkers; i++) {
+        pthread_join(sender->workers[i].thread, NULL);
+        curl_multi_cleanup(sender->workers[i].multi);
+        pandora_free(sender->workers[i].slots);
+    }
+
+    /* only left over when no thread could be started */
+    while (sender->count > 0) {
+        async_item_free(&sender->items[sender->head]);
+        sender->head = (sender->head + 1) % sender->capacity;
+        sender->count--;
+    }
+
+    pthread_cond_destroy(&sender->drained);
+    pthread_cond_destroy(&sender->not_full);
+    pthread_cond_destroy(&sender->not_empty);
+    pthread_mutex_destroy(&sender->mutex);
+
+    pandora_free(sender->workers);
+    pandora_free(sender->inflight_repos);
+    pandora_free(sender->items);
+    pandora_free(sender);
+}
+
+/* Index of the queued batch of lowest priority below priority, the newest of them on a tie; -1 if none */
+static int async_sender_victim(s_async_sender *sender, int priority)
+{
+    int i, victim = -1;
+
+    for (i = 0; i < sender->count; i++) {
+        s_async_item *item = &sender->items[(sender->head + i) % sender->capacity];
+        if (item->priority < priority &&
+            (victim < 0 || item->priority <= sender->items[(sender->head + victim) % sender->capacity].priority))
+            victim = i;
+    }
+    return victim;
+}
+
+pandora_error_t async_sender_push(s_async_sender *sender, const char *repo, s_data_points *data, int priority)
+{
+    pandora_error_t status;
+    s_async_item victim;
+    long long deadline = 0, now;
+    int full, over_budget, i;
+
+    char *repo_copy = pandora_strdup(repo);
+    if (!repo_copy)
+        return PANDORAE_OUT_OF_MEMORY;
+
+    pthread_mutex_lock(&sender->mutex);
+
+    /*
+     * Memory is freed outside the lock, by senders and by the application, so waits for the
+     * budget are bounded by SENDER_POLL_TIMEOUT and the budget checked again
+     */
+    while (!sender->stopping) {
+        full = sender->count == sender->capacity;
+        over_budget = pandora_memory_over_budget();
+        if (over_budget) {
+            /* pooled batches and segments count towards the budget too, they go back first */
+            data_points_pool_trim();
+            over_budget = pandora_memory_over_budget();
+        }
+        if (!full && !over_budget)
+            break;
+        status = full ? PANDORAE_QUEUE_FULL : PANDORAE_OVER_BUDGET;
+
+        switch (sender->policy) {
+            case QUEUE_BLOCK:
+                /* with nothing queued or in flight, no memory the sender holds can come back */
+                if (!full && sender->count == 0 && sender->inflight == 0) {
+                    pthread_mutex_unlock(&sender->mutex);
+                    pandora_free(repo_copy);
+                    return status;
+                }
+                now = monotonic_ms();
+                if (sender->block_timeout_ms > 0 && deadline == 0)
+                    deadline = now + sender->block_timeout_ms;
+                if (deadline > 0 && now >= deadline) {
+                    pthread_mutex_unlock(&sender->mutex);
+                    pandora_free(repo_copy);
+                    return status;
+                }
+                if (full && !over_budget && deadline == 0)
+                    pthread_cond_wait(&sender->not_full, &sender->mutex);
+                else
+                    cond_wait_ms(&sender->not_full, &sender->mutex,
+                                 deadline > 0 && deadline - now < SENDER_POLL_TIMEOUT ? deadline - now : SENDER_POLL_TIMEOUT);
+                break;
+
+            case QUEUE_SPILL:
+                pthread_mutex_unlock(&sender->mutex);
+                pandora_free(repo_copy);
+                if (async_sender_spill(sender, repo, data, 0) != PANDORAE_OK)
+                    return status;
+                data_points_destroy(data);
+                return PANDORAE_OK;
+
+            case QUEUE_DROP:
+            default:
+                i = async_sender_victim(sender, priority);
+                if (i < 0) {
+                    pthread_mutex_unlock(&sender->mutex);
+                    pandora_free(repo_copy);
+                    return status;
+                }
+
+                async_sender_take(sender, i, &victim);
+                if (sender->count == 0 && sender->inflight == 0)
+                    pthread_cond_broadcast(&sender->drained);
+                pthread_mutex_unlock(&sender->mutex);
+                if (sender->callback)
+                    sender->callback(victim.repo, victim.data, status, sender->userdata);
+                async_item_free(&victim);
+                pthread_mutex_lock(&sender->mutex);
+                break;
+        }
+    }
+
+    if (sender->stopping) {
+        pthread_mutex_unlock(&sender->mutex);
+        pandora_free(repo_copy);
+        return PANDORAE_INVALID_CLIENT;
+    }
+
+    s_async_item *item = &sender->items[(sender->head + sender->count) % sender->capacity];
+    item->repo = repo_copy;
+    item->data = data;
+    item->priority = priority;
+    sender->count++;
+
+    async_sender_wakeup(sender);
+    pthread_mutex_unlock(&sender->mutex);
+
+    return PANDORAE_OK;
+}
+
+void async_sender_drain(s_async_sender *sender)
+{
+    pthread_mutex_lock(&sender->mutex);
+    while (sender->count > 0 || sender->inflight > 0)
+        pthread_cond_wait(&sender->drained, &sender->mutex);
+    pthread_mutex_unlock(&sender->mutex);
+}
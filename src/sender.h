@@ -0,0 +1,26 @@
+#ifndef PANDORA_C_SENDER_H
+#define PANDORA_C_SENDER_H
+
+#include "pandora/client.h"
+
+/**
+ * Create a bounded queue and start its sender threads
+ */
+s_async_sender *async_sender_create(s_pandora_client *client, s_async_params *params);
+
+/**
+ * Send everything still queued, then stop the sender threads and free the queue
+ */
+void async_sender_destroy(s_async_sender *sender);
+
+/**
+ * Queue data for repo; ownership of data moves to the sender on PANDORAE_OK
+ */
+pandora_error_t async_sender_push(s_async_sender *sender, const char *repo, s_data_points *data, int priority);
+
+/**
+ * Wait until the queue is empty and no batch is being sent
+ */
+void async_sender_drain(s_async_sender *sender);
+
+#endif //PANDORA_C_SENDER_H
@@ -0,0 +1,172 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+#include "retry.h"
+#include "transfer.h"
+#include "utils.h"
+
+#define TRANSFER_POLL_TIMEOUT 100
+#define TRANSFER_BUSY_RETRY 10
+
+#define TRUE 1
+#define FALSE 0
+
+void transfer_init(s_transfer *t, s_pandora_client *client, const char *repo, const buffer_t *buf, size_t offset,
+                   size_t len)
+{
+    t->client = client;
+    pandora_client_write_url(client, repo, t->url, t->uri);
+    body_init(&t->body, buf, offset, len);
+    t->len = len;
+    t->gzipped = pandora_client_encode(client, &t->body, &t->encoded);
+    if (t->gzipped)
+        body_init(&t->body, &t->encoded, 0, BUFFER_SIZE(&t->encoded));
+    t->handle = NULL;
+    t->headers = NULL;
+    buffer_init_static(&t->response, NULL, 0);
+    t->attempt = 0;
+    t->started = monotonic_ms();
+    t->retry_at = 0;
+    t->seed = (unsigned int)t->started ^ (unsigned int)(size_t)t;
+    t->code = 0;
+    t->done = FALSE;
+}
+
+static void transfer_release(s_transfer *t, CURLM *multi)
+{
+    if (t->handle) {
+        curl_multi_remove_handle(multi, t->handle);
+        curl_pool_release(&t->client->curl_pool, t->handle);
+        t->handle = NULL;
+    }
+    if (t->headers) {
+        curl_slist_free_all(t->headers);
+        t->headers = NULL;
+    }
+}
+
+int transfer_start(s_transfer *t, CURLM *multi)
+{
+    t->handle = curl_pool_try_acquire(&t->client->curl_pool);
+    if (!t->handle)
+        return FALSE;
+
+    buffer_destroy(&t->response);
+    response_init(&t->response);
+
+    add_request_headers(t->client, t->uri, &t->headers);
+    if (t->gzipped)
+        t->headers = curl_slist_append(t->headers, "Content-Encoding: gzip");
+    pandora_client_setup(t->handle, t->url, t->headers, &t->body, &t->response);
+    curl_easy_setopt(t->handle, CURLOPT_PRIVATE, t);
+
+    if (curl_multi_add_handle(multi, t->handle) != CURLM_OK) {
+        transfer_release(t, multi);
+        return FALSE;
+    }
+    t->attempt++;
+
+    return TRUE;
+}
+
+int transfer_done(s_transfer *t, CURLM *multi, CURLcode result)
+{
+    long long retry_after, delay;
+
+    t->code = pandora_client_result(t->handle, result);
+    retry_after = pandora_client_retry_after(t->handle);
+    transfer_release(t, multi);
+
+    if (t->code/100 == 2) {
+        t->done = TRUE;
+        return TRUE;
+    }
+
+    /* the backoff is spent off the wire, the sender thread keeps driving other transfers */
+    delay = retry_next_delay(t->client, t->code, t->attempt, t->started, retry_after, &t->seed);
+    if (delay >= 0) {
+        t->retry_at = monotonic_ms() + delay;
+        return FALSE;
+    }
+
+    if (!do_write_should_retry(t->code))
+        fprintf(stderr, "write failed: %s\n", t->response.data ? t->response.data : "");
+    t->done = TRUE;
+    return TRUE;
+}
+
+pandora_error_t transfer_status(s_transfer *t)
+{
+    return t->code/100 == 2 ? PANDORAE_OK : PANDORAE_WRITE_FAILED;
+}
+
+void transfer_cleanup(s_transfer *t, CURLM *multi)
+{
+    transfer_release(t, multi);
+    buffer_destroy(&t->response);
+    buffer_init_static(&t->response, NULL, 0);
+    if (t->gzipped) {
+        buffer_destroy(&t->encoded);
+        t->gzipped = 0;
+    }
+}
+
+pandora_error_t transfer_run(s_transfer *transfers, int count)
+{
+    pandora_error_t status = PANDORAE_OK;
+    int i, pending = count, still_running, msgs;
+    long long now, wake_at;
+    CURLMsg *msg;
+
+    /* without a multi handle nothing is sent, the transfers are still cleaned up below */
+    s_curl_pool *pool = count > 0 ? &transfers[0].client->curl_pool : NULL;
+    CURLM *multi = pool ? curl_pool_acquire_multi(pool) : NULL;
+    if (count > 0 && !multi)
+        status = PANDORAE_FAILED_INIT;
+
+    while (multi && pending > 0) {
+        now = monotonic_ms();
+        wake_at = now + TRANSFER_POLL_TIMEOUT;
+
+        /* start as many as the connection pool allows, the rest follow as handles come back */
+        for (i = 0; i < count; i++) {
+            s_transfer *t = &transfers[i];
+            if (t->done || t->handle)
+                continue;
+            if (t->retry_at > now) {
+                if (t->retry_at < wake_at)
+                    wake_at = t->retry_at;
+                continue;
+            }
+            if (!transfer_start(t, multi) && now + TRANSFER_BUSY_RETRY < wake_at)
+                wake_at = now + TRANSFER_BUSY_RETRY;
+        }
+
+        curl_multi_perform(multi, &still_running);
+
+        while ((msg = curl_multi_info_read(multi, &msgs)) != NULL) {
+            s_transfer *t = NULL;
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&t);
+            if (transfer_done(t, multi, msg->data.result))
+                pending--;
+            wake_at = now;
+        }
+
+        if (wake_at > now)
+            curl_multi_poll(multi, NULL, 0, (int)(wake_at - now), NULL);
+    }
+
+    for (i = 0; i < count; i++) {
+        if (multi && transfer_status(&transfers[i]) != PANDORAE_OK)
+            status = PANDORAE_WRITE_FAILED;
+        transfer_cleanup(&transfers[i], multi);
+    }
+    if (multi)
+        curl_pool_release_multi(pool, multi);
+
+    return status;
+}
@@ -0,0 +1,65 @@
+#ifndef PANDORA_C_TRANSFER_H
+#define PANDORA_C_TRANSFER_H
+
+#include "internal.h"
+
+/**
+ * One pipeline write driven through a curl multi handle, retried in place
+ */
+typedef struct {
+    s_pandora_client *client;
+    char url[PANDORA_URL_MAX_SIZE];
+    char uri[PANDORA_URL_MAX_SIZE];
+    s_body body;
+    size_t len;             /* bytes of the batch this transfer carries, before compression */
+    buffer_t encoded;
+    int gzipped;
+
+    CURL *handle;
+    struct curl_slist *headers;
+    buffer_t response;
+
+    int attempt;
+    long long started;
+    long long retry_at;
+    unsigned int seed;
+    int code;
+    int done;
+} s_transfer;
+
+/**
+ * Prepare a write of len bytes of buf from offset into repo; buf must outlive the transfer,
+ * which must not be moved once initialized
+ */
+void transfer_init(s_transfer *t, s_pandora_client *client, const char *repo, const buffer_t *buf, size_t offset,
+                   size_t len);
+
+/**
+ * Sign the request and add it to multi. Returns 0 when no connection is available right now,
+ * the caller should try again later
+ */
+int transfer_start(s_transfer *t, CURLM *multi);
+
+/**
+ * Handle a finished attempt. Returns 1 when the transfer is complete (successfully or not),
+ * or 0 when another attempt is scheduled at t->retry_at
+ */
+int transfer_done(s_transfer *t, CURLM *multi, CURLcode result);
+
+/**
+ * Outcome of a complete transfer
+ */
+pandora_error_t transfer_status(s_transfer *t);
+
+/**
+ * Release everything held by the transfer
+ */
+void transfer_cleanup(s_transfer *t, CURLM *multi);
+
+/**
+ * Drive count initialized transfers concurrently until all are complete, then clean them up, on
+ * failure too; returns PANDORAE_OK only if every one of them succeeded
+ */
+pandora_error_t transfer_run(s_transfer *transfers, int count);
+
+#endif //PANDORA_C_TRANSFER_H
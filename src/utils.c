@@ -2,6 +2,7 @@
 #include <string.h>
 #include <time.h>
 
+#include "pandora/alloc.h"
 #include "utils.h"
 
 char *pandora_strdup(const char *src)
@@ -11,7 +12,7 @@ char *pandora_strdup(const char *src)
     if (src == NULL)
         return NULL;
 
-    dest = malloc(sizeof (char) * (strlen(src) + 1));
+    dest = pandora_malloc(sizeof (char) * (strlen(src) + 1));
     if (dest == NULL)
         return NULL;
 
@@ -22,11 +23,44 @@ char *pandora_strdup(const char *src)
 char *current_gmt()
 {
     time_t rawtime;
+    struct tm tm;
+    char *buf;
+
+    /* requests are signed from several threads, gmtime() would share one struct tm among them */
     time (&rawtime);
-    struct tm *ptm = gmtime (&rawtime);
-    char *buf = malloc(30);
-    strftime(buf, 30, "%a, %d %b %Y %H:%M:%S GMT", ptm);
+    gmtime_r(&rawtime, &tm);
+    buf = pandora_malloc(30);
+    if (buf != NULL)
+        strftime(buf, 30, "%a, %d %b %Y %H:%M:%S GMT", &tm);
     return buf;
 }
 
+long long monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
+void sleep_ms(long long ms)
+{
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000;
+    while (nanosleep(&ts, &ts) == -1)
+        ;
+}
+
+void cond_wait_ms(pthread_cond_t *cond, pthread_mutex_t *mutex, long long ms)
+{
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ms / 1000;
+    deadline.tv_nsec += (ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(cond, mutex, &deadline);
+}
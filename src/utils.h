@@ -1,10 +1,20 @@
 #ifndef PANDORA_C_UTILS_H
 #define PANDORA_C_UTILS_H
 
+#include <pthread.h>
 #include <stdio.h>
 
 char *pandora_strdup(const char *src);
 
 char *current_gmt();
 
+long long monotonic_ms();
+
+void sleep_ms(long long ms);
+
+/**
+ * pthread_cond_wait bounded by ms, the caller checks again why it waited
+ */
+void cond_wait_ms(pthread_cond_t *cond, pthread_mutex_t *mutex, long long ms);
+
 #endif //PANDORA_C_UTILS_H
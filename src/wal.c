@@ -0,0 +1,389 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "wal.h"
+#include "crc32c.h"
+
+#define TRUE 1
+#define FALSE 0
+
+/* iovecs handed to a single writev, the header and up to WAL_IOV_MAX - 1 chunks of payload */
+#define WAL_IOV_MAX 64
+
+/* payloads are read in pieces of this size so that a bogus length cannot make out grow first */
+#define WAL_READ_CHUNK (1024 * 1024)
+
+static void put_u32(unsigned char *p, uint32_t v)
+{
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+static uint32_t get_u32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* CRC of the header fields but the CRC itself, and of the repo */
+static uint32_t header_crc(const unsigned char *header, const char *repo, size_t repo_len)
+{
+    uint32_t crc = crc32c(0, header, 4);
+    crc = crc32c(crc, header + 8, 4);
+    return crc32c(crc, repo, repo_len);
+}
+
+int wal_create(const char *path)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+
+    /* the progress of a segment which had the name before says nothing about this one */
+    wal_remove_replayed(path);
+    if (fd < 0)
+        return -1;
+    if (write(fd, WAL_MAGIC, WAL_MAGIC_SIZE) != WAL_MAGIC_SIZE) {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    return fd;
+}
+
+static int write_all(int fd, struct iovec *iov, int iovcnt)
+{
+    ssize_t n;
+
+    while (iovcnt > 0) {
+        n = writev(fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return FALSE;
+        }
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return TRUE;
+}
+
+int wal_append(int fd, size_t *size, const char *repo, const buffer_t *buf, size_t offset, size_t len)
+{
+    unsigned char header[WAL_HEADER_SIZE + WAL_REPO_MAX];
+    struct iovec iov[WAL_IOV_MAX];
+    size_t repo_len = strlen(repo);
+    size_t pos, avail;
+    const char *chunk;
+    uint32_t crc;
+    int iovcnt, ok = TRUE;
+
+    if (repo_len > WAL_REPO_MAX || len > UINT32_MAX)
+        return FALSE;
+
+    put_u32(header, (uint32_t)len);
+    header[8] = (unsigned char)repo_len;
+    header[9] = (unsigned char)(repo_len >> 8);
+    header[10] = 0;
+    header[11] = 0;
+    memcpy(header + WAL_HEADER_SIZE, repo, repo_len);
+
+    crc = header_crc(header, repo, repo_len);
+    for (pos = 0; pos < len; pos += avail) {
+        chunk = buffer_chunk(buf, offset + pos, &avail);
+        if (avail > len - pos)
+            avail = len - pos;
+        crc = crc32c(crc, chunk, avail);
+    }
+    put_u32(header + 4, crc);
+
+    /* the whole record goes out in as few writev calls as the payload's segments allow */
+    iov[0].iov_base = header;
+    iov[0].iov_len = WAL_HEADER_SIZE + repo_len;
+    iovcnt = 1;
+    for (pos = 0; ok && pos < len; pos += avail) {
+        chunk = buffer_chunk(buf, offset + pos, &avail);
+        if (avail > len - pos)
+            avail = len - pos;
+        iov[iovcnt].iov_base = (void *)chunk;
+        iov[iovcnt].iov_len = avail;
+        if (++iovcnt == WAL_IOV_MAX) {
+            ok = write_all(fd, iov, iovcnt);
+            iovcnt = 0;
+        }
+    }
+    if (ok && iovcnt > 0)
+        ok = write_all(fd, iov, iovcnt);
+
+    if (!ok) {
+        /* a partial record would hide every later one from recovery */
+        if (ftruncate(fd, (off_t)*size) != 0)
+            perror("ftruncate");
+        return FALSE;
+    }
+
+    *size += WAL_HEADER_SIZE + repo_len + len;
+    return TRUE;
+}
+
+int wal_sync(int fd)
+{
+#ifdef __APPLE__
+    return fsync(fd);
+#else
+    return fdatasync(fd);
+#endif
+}
+
+static int read_at(int fd, void *dest, size_t len, size_t offset)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = pread(fd, dest, len, (off_t)offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return FALSE;
+        dest = (char *)dest + n;
+        len -= n;
+        offset += n;
+    }
+    return TRUE;
+}
+
+static int reader_at(s_wal_reader *reader, void *dest, size_t len, size_t offset)
+{
+    if (!reader->map)
+        return read_at(reader->fd, dest, len, offset);
+    memcpy(dest, reader->map + offset, len);
+    return TRUE;
+}
+
+int wal_open(s_wal_reader *reader, const char *path)
+{
+    char magic[WAL_MAGIC_SIZE];
+    struct stat st;
+
+    reader->map = NULL;
+    reader->fd = open(path, O_RDWR | O_CLOEXEC);
+    if (reader->fd < 0)
+        return -1;
+
+    if (fstat(reader->fd, &st) != 0) {
+        wal_close(reader);
+        return -1;
+    }
+    reader->size = (size_t)st.st_size;
+    reader->offset = WAL_MAGIC_SIZE;
+    reader->length = 0;
+
+    if (reader->size < WAL_MAGIC_SIZE || !read_at(reader->fd, magic, WAL_MAGIC_SIZE, 0) ||
+        memcmp(magic, WAL_MAGIC, WAL_MAGIC_SIZE) != 0) {
+        wal_close(reader);
+        return 0;
+    }
+    return 1;
+}
+
+int wal_next(s_wal_reader *reader)
+{
+    unsigned char header[WAL_HEADER_SIZE];
+    size_t left = reader->size - reader->offset;
+
+    if (left == 0)
+        return 0;
+    if (left < WAL_HEADER_SIZE || !reader_at(reader, header, WAL_HEADER_SIZE, reader->offset))
+        return -1;
+
+    reader->length = get_u32(header);
+    reader->crc = get_u32(header + 4);
+    reader->repo_len = header[8] | (size_t)header[9] << 8;
+    if (reader->repo_len > WAL_REPO_MAX || header[10] != 0 || header[11] != 0)
+        return -1;
+
+    /* a length running past the end is what a torn append leaves */
+    left -= WAL_HEADER_SIZE;
+    if (reader->repo_len > left || reader->length > left - reader->repo_len)
+        return -1;
+
+    if (!reader_at(reader, reader->repo, reader->repo_len, reader->offset + WAL_HEADER_SIZE))
+        return -1;
+    reader->repo[reader->repo_len] = '\0';
+    reader->partial = header_crc(header, reader->repo, reader->repo_len);
+
+    return 1;
+}
+
+int wal_read(s_wal_reader *reader, buffer_t *out)
+{
+    size_t start = BUFFER_SIZE(out);
+    size_t at = reader->offset + WAL_HEADER_SIZE + reader->repo_len;
+    size_t pos, piece;
+    uint32_t crc = reader->partial;
+
+    for (pos = 0; pos < reader->length; pos += piece) {
+        piece = reader->length - pos < WAL_READ_CHUNK ? reader->length - pos : WAL_READ_CHUNK;
+        if (!buffer_reserve(out, piece)) {
+            buffer_truncate(out, start);
+            return 0;
+        }
+        if (!read_at(reader->fd, BUFFER_TAIL(out), piece, at + pos)) {
+            buffer_truncate(out, start);
+            return -1;
+        }
+        crc = crc32c(crc, BUFFER_TAIL(out), piece);
+        out->written += piece;
+    }
+
+    if (crc != reader->crc) {
+        buffer_truncate(out, start);
+        return -1;
+    }
+
+    reader->offset = at + reader->length;
+    return 1;
+}
+
+int wal_map(s_wal_reader *reader)
+{
+    void *map = mmap(NULL, reader->size, PROT_READ, MAP_SHARED, reader->fd, 0);
+
+    if (map == MAP_FAILED)
+        return FALSE;
+    /* replay reads the segment once from start to end */
+    madvise(map, reader->size, MADV_SEQUENTIAL);
+    reader->map = map;
+    reader->map_size = reader->size;
+    return TRUE;
+}
+
+const char *wal_payload(s_wal_reader *reader)
+{
+    const char *payload = reader->map + reader->offset + WAL_HEADER_SIZE + reader->repo_len;
+
+    if (crc32c(reader->partial, payload, reader->length) != reader->crc)
+        return NULL;
+
+    reader->offset = payload - reader->map + reader->length;
+    return payload;
+}
+
+int wal_truncate(s_wal_reader *reader)
+{
+    if (ftruncate(reader->fd, (off_t)reader->offset) != 0)
+        return FALSE;
+    reader->size = reader->offset;
+    return TRUE;
+}
+
+void wal_close(s_wal_reader *reader)
+{
+    /* mapped at the size before a wal_truncate(), which is what gets unmapped */
+    if (reader->map)
+        munmap((void *)reader->map, reader->map_size);
+    reader->map = NULL;
+    if (reader->fd >= 0)
+        close(reader->fd);
+    reader->fd = -1;
+}
+
+long wal_recover(const char *path)
+{
+    s_wal_reader reader;
+    buffer_t scratch;
+    long records = 0;
+    int rc;
+
+    if (wal_open(&reader, path) <= 0)
+        return -1;
+    if (!buffer_init(&scratch, WAL_READ_CHUNK, BUFFER_GROWABLE)) {
+        wal_close(&reader);
+        return -1;
+    }
+
+    while ((rc = wal_next(&reader)) > 0) {
+        BUFFER_RESET(&scratch);
+        rc = wal_read(&reader, &scratch);
+        if (rc <= 0)
+            break;
+        records++;
+    }
+    /* out of memory says nothing about the record, only cut at a bad one */
+    if (rc < 0)
+        wal_truncate(&reader);
+    else if (rc == 0 && reader.offset < reader.size)
+        records = -1;
+
+    buffer_destroy(&scratch);
+    wal_close(&reader);
+    return records;
+}
+
+static void replayed_path(char *out, const char *path)
+{
+    snprintf(out, PATH_MAX, "%s" WAL_REPLAYED_SUFFIX, path);
+}
+
+size_t wal_replayed(const char *path)
+{
+    char sidecar[PATH_MAX];
+    unsigned char record[WAL_REPLAYED_SIZE];
+    size_t offset;
+    int fd;
+
+    replayed_path(sidecar, path);
+    fd = open(sidecar, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+    if (!read_at(fd, record, WAL_REPLAYED_SIZE, 0) || crc32c(0, record, 8) != get_u32(record + 8)) {
+        close(fd);
+        return 0;
+    }
+    close(fd);
+
+    offset = (size_t)get_u32(record) | (size_t)((uint64_t)get_u32(record + 4) << 32);
+    return offset >= WAL_MAGIC_SIZE ? offset : 0;
+}
+
+int wal_set_replayed(const char *path, size_t offset)
+{
+    char sidecar[PATH_MAX];
+    unsigned char record[WAL_REPLAYED_SIZE];
+    int fd, ok;
+
+    put_u32(record, (uint32_t)offset);
+    put_u32(record + 4, (uint32_t)((uint64_t)offset >> 32));
+    put_u32(record + 8, crc32c(0, record, 8));
+
+    /* one small write in place, a torn one fails its CRC and the segment is replayed from its start */
+    replayed_path(sidecar, path);
+    fd = open(sidecar, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return FALSE;
+    ok = pwrite(fd, record, WAL_REPLAYED_SIZE, 0) == WAL_REPLAYED_SIZE;
+    close(fd);
+    return ok;
+}
+
+void wal_remove_replayed(const char *path)
+{
+    char sidecar[PATH_MAX];
+
+    replayed_path(sidecar, path);
+    if (unlink(sidecar) != 0 && errno != ENOENT)
+        perror("unlink");
+}
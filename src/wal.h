@@ -0,0 +1,118 @@
+#ifndef PANDORA_C_WAL_H
+#define PANDORA_C_WAL_H
+
+#include <stdint.h>
+
+#include "pandora/buffer.h"
+
+/*
+ * A cache segment is WAL_MAGIC followed by records, each a header then the repo and the payload:
+ *   u32 payload length | u32 CRC32C | u16 repo length | u16 zero
+ * in little endian. The CRC covers the header but itself, the repo and the payload, so a torn or
+ * corrupt record is told apart from a valid one and everything from it on can be cut off
+ */
+#define WAL_MAGIC "PNDWAL01"
+#define WAL_MAGIC_SIZE 8
+#define WAL_HEADER_SIZE 12
+#define WAL_REPO_MAX 255
+
+/*
+ * How far a segment was replayed is kept next to it, in a file named after it with this suffix:
+ *   u64 offset | u32 CRC32C of the offset
+ * in little endian. The offset is the end of the last record the server accepted
+ */
+#define WAL_REPLAYED_SUFFIX ".replayed"
+#define WAL_REPLAYED_SIZE 12
+
+typedef struct {
+    int fd;
+    const char *map;    /* the whole segment once wal_map() succeeded, NULL before */
+    size_t map_size;
+    size_t offset;      /* end of the last record read in full, where a torn tail is cut */
+    size_t size;
+
+    /* header of the record wal_next() stopped at */
+    char repo[WAL_REPO_MAX + 1];
+    size_t repo_len;
+    size_t length;
+    uint32_t crc;       /* as recorded */
+    uint32_t partial;   /* computed over the header and the repo so far */
+} s_wal_reader;
+
+/**
+ * Create a segment at path and open it for appending, returns the descriptor or -1
+ */
+int wal_create(const char *path);
+
+/**
+ * Append len bytes of buf from offset as one record for repo. *size is the size of the segment,
+ * advanced past the record; a record which cannot be written in full is cut off again.
+ * returns 1 on success, 0 on failure
+ */
+int wal_append(int fd, size_t *size, const char *repo, const buffer_t *buf, size_t offset, size_t len);
+
+/**
+ * fdatasync, or fsync where there is none
+ */
+int wal_sync(int fd);
+
+/**
+ * Open a segment for reading: returns 1 if path is a segment, 0 if it is something else, like a
+ * cache file of the text format written before, and -1 if it cannot be opened
+ */
+int wal_open(s_wal_reader *reader, const char *path);
+
+/**
+ * Read the header of the next record: returns 1 with reader->repo and reader->length set, 0 at the
+ * end of the segment and -1 at a torn or corrupt record
+ */
+int wal_next(s_wal_reader *reader);
+
+/**
+ * Append the payload of the record wal_next() returned to out and check it: returns 1 on success,
+ * 0 if out cannot grow and -1 if the record is corrupt, which leaves out as it was
+ */
+int wal_read(s_wal_reader *reader, buffer_t *out);
+
+/**
+ * Map the segment read only for wal_payload(), wal_next() then reads headers from the mapping
+ * too. returns 1 on success, 0 if it cannot be mapped
+ */
+int wal_map(s_wal_reader *reader);
+
+/**
+ * Check the payload of the record wal_next() returned within the mapping and move past it:
+ * returns where it starts in the mapping, NULL if the record is corrupt
+ */
+const char *wal_payload(s_wal_reader *reader);
+
+/**
+ * Cut the segment at reader->offset, after its last valid record
+ */
+int wal_truncate(s_wal_reader *reader);
+
+void wal_close(s_wal_reader *reader);
+
+/**
+ * Check every record of the segment at path and cut off a torn or corrupt tail. returns the
+ * number of valid records, or -1 if path is not a segment
+ */
+long wal_recover(const char *path);
+
+/**
+ * Offset up to which the segment at path was replayed before, 0 if it never was
+ */
+size_t wal_replayed(const char *path);
+
+/**
+ * Record that the segment at path was replayed up to offset, the end of a record. returns 1 on
+ * success, 0 on failure
+ */
+int wal_set_replayed(const char *path, size_t offset);
+
+/**
+ * Forget how far the segment at path was replayed, once it is deleted
+ */
+void wal_remove_replayed(const char *path);
+
+#endif //PANDORA_C_WAL_H
@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pandora/alloc.h"
+#include "pandora/client.h"
+
+#define TEST_BATCHES 32
+#define TEST_POINTS 2000
+
+/*
+ * A QUEUE_BLOCK push over the budget must not wait for memory which only the idle pools hold:
+ * with nothing queued or in flight, nothing else would ever bring usage down
+ */
+int main(void)
+{
+    s_data_points *batches[TEST_BATCHES];
+    s_pandora_memory_stats stats;
+    s_client_params params;
+    s_async_params ap;
+    s_pandora_client *client;
+    s_data_points *data;
+    pandora_error_t status;
+    int i, j;
+
+    /* a hang is killed by SIGALRM, which fails the test */
+    alarm(10);
+
+    memset(&params, 0, sizeof(params));
+    params.pipeline_host = "http://127.0.0.1:1";
+    params.access_key = "ak";
+    params.secret_key = "sk";
+    client = pandora_client_init(&params);
+    if (!client)
+        return 1;
+
+    /* a burst leaves its batches and segments in the pools */
+    for (i = 0; i < TEST_BATCHES; i++) {
+        batches[i] = data_points_create();
+        for (j = 0; j < TEST_POINTS; j++) {
+            data_points_begin_point(batches[i]);
+            data_points_add_int64(batches[i], "seq", j);
+            data_points_add_string(batches[i], "msg", "the quick brown fox jumps over the lazy dog");
+            data_points_end_point(batches[i]);
+        }
+    }
+    for (i = 0; i < TEST_BATCHES; i++)
+        data_points_destroy(batches[i]);
+
+    pandora_get_memory_stats(&stats);
+    pandora_set_memory_budget(stats.bytes_in_use / 2);
+    if (!pandora_memory_over_budget()) {
+        fprintf(stderr, "the pools hold too little to exceed the budget\n");
+        return 1;
+    }
+
+    memset(&ap, 0, sizeof(ap));
+    ap.sender_threads = 1;
+    ap.queue_depth = 4;
+    ap.max_inflight = 1;
+    ap.policy = QUEUE_BLOCK;
+    ap.block_timeout_ms = 0;
+    if (pandora_client_start_async(client, &ap) != PANDORAE_OK)
+        return 1;
+
+    data = data_points_create();
+    data_points_begin_point(data);
+    data_points_add_int64(data, "seq", 0);
+    data_points_end_point(data);
+    status = pandora_client_write_async(client, "test", data);
+    if (status != PANDORAE_OK && status != PANDORAE_OVER_BUDGET) {
+        fprintf(stderr, "write_async: %d\n", status);
+        return 1;
+    }
+    if (status != PANDORAE_OK)
+        data_points_destroy(data);
+
+    pandora_client_cleanup(client);
+    pandora_set_memory_budget(0);
+    return 0;
+}
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pandora/alloc.h"
+#include "pandora/buffer.h"
+#include "pandora/client.h"
+#include "internal.h"
+
+#define TEST_SIZE (3 * BUFFER_SEGMENT_SIZE + 1000)
+#define TEST_WRITE 1000
+
+/* an allocator which fails on demand, to run out of segments part way through a write */
+static int fail_alloc;
+
+static void *test_malloc(size_t size, void *userdata)
+{
+    (void)userdata;
+    return fail_alloc ? NULL : malloc(size);
+}
+
+static void *test_realloc(void *ptr, size_t size, void *userdata)
+{
+    (void)userdata;
+    return fail_alloc ? NULL : realloc(ptr, size);
+}
+
+static void test_free(void *ptr, void *userdata)
+{
+    (void)userdata;
+    free(ptr);
+}
+
+static char expected[TEST_SIZE + 2 * BUFFER_SEGMENT_SIZE];
+
+/* the chunks from offset on, one per segment, are the bytes written and end where the data ends */
+static int check_chunks(const buffer_t *buf, size_t offset)
+{
+    const char *chunk;
+    size_t len;
+
+    while (offset < BUFFER_SIZE(buf)) {
+        chunk = buffer_chunk(buf, offset, &len);
+        if (len == 0 || offset + len > BUFFER_SIZE(buf) || memcmp(chunk, expected + offset, len) != 0) {
+            fprintf(stderr, "chunk at %zu of %zu bytes does not match\n", offset, len);
+            return 0;
+        }
+        offset += len;
+    }
+    buffer_chunk(buf, offset, &len);
+    if (len != 0) {
+        fprintf(stderr, "%zu bytes past the end\n", len);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Lookups into a segmented buffer at and around the segment boundaries, and writes which run out
+ * of segments half way: they fail as a whole, nothing of them stays in the buffer
+ */
+int main(void)
+{
+    s_pandora_allocator allocator = { test_malloc, test_realloc, test_free, NULL };
+    const char *chunk;
+    char value[2 * BUFFER_SEGMENT_SIZE];
+    buffer_t buf;
+    s_data_points *data;
+    size_t i, len, boundary, before;
+    int count, ret = 1;
+
+    if (pandora_set_allocator(&allocator) != PANDORAE_OK)
+        return 1;
+
+    for (i = 0; i < sizeof(expected); i++)
+        expected[i] = 'a' + i % 23;
+
+    if (!buffer_init(&buf, 0, BUFFER_GROWABLE | BUFFER_SEGMENTED))
+        return 1;
+    for (i = 0; i < TEST_SIZE; i += TEST_WRITE) {
+        if (!buffer_write(&buf, expected + i, TEST_WRITE)) {
+            fprintf(stderr, "write at %zu failed\n", i);
+            goto out;
+        }
+    }
+    if (buf.nsegments < 4) {
+        fprintf(stderr, "%d segments, the data should span 4\n", buf.nsegments);
+        goto out;
+    }
+
+    /* each chunk ends at the next boundary, offsets right before and after it land in the right segment */
+    for (i = 1; i < (size_t)buf.nsegments; i++) {
+        boundary = buf.segments[i].start;
+        chunk = buffer_chunk(&buf, boundary - 1, &len);
+        if (len != 1 || *chunk != expected[boundary - 1]) {
+            fprintf(stderr, "the byte before boundary %zu is wrong\n", boundary);
+            goto out;
+        }
+        if (!check_chunks(&buf, boundary - 1) || !check_chunks(&buf, boundary) ||
+            !check_chunks(&buf, boundary + 1))
+            goto out;
+    }
+    if (!check_chunks(&buf, 0))
+        goto out;
+
+    /* a write which needs new segments while there are none to be had is taken back */
+    buffer_pool_trim();
+    buffer_trim(&buf, 0);
+    before = BUFFER_SIZE(&buf);
+    fail_alloc = 1;
+    if (buffer_write(&buf, expected + before, 2 * BUFFER_SEGMENT_SIZE) || BUFFER_SIZE(&buf) != before) {
+        fprintf(stderr, "a failed write left %zu bytes\n", BUFFER_SIZE(&buf) - before);
+        goto out;
+    }
+    fail_alloc = 0;
+    if (!check_chunks(&buf, 0))
+        goto out;
+    if (!buffer_write(&buf, expected + before, 2 * BUFFER_SEGMENT_SIZE) ||
+        BUFFER_SIZE(&buf) != before + 2 * BUFFER_SEGMENT_SIZE || !check_chunks(&buf, 0)) {
+        fprintf(stderr, "the write after the failed one is wrong\n");
+        goto out;
+    }
+
+    /* neither does a point whose field cannot be appended or a string of points, nor are they counted */
+    memset(value, 'x', sizeof(value) - 1);
+    value[sizeof(value) - 1] = '\0';
+    data = data_points_create();
+    if (!data)
+        goto out;
+    data_points_begin_point(data);
+    data_points_add_int64(data, "seq", 1);
+    data_points_end_point(data);
+    before = data_points_length(data);
+    count = data_points_count(data);
+    buffer_pool_trim();
+    fail_alloc = 1;
+    data_points_begin_point(data);
+    if (data_points_add_string(data, "msg", value) != PANDORAE_OUT_OF_MEMORY || data_points_length(data) != before ||
+        data_points_count(data) != count) {
+        fprintf(stderr, "a point which ran out of memory was kept\n");
+        fail_alloc = 0;
+        data_points_destroy(data);
+        goto out;
+    }
+    if (data_points_append_string(data, value) != PANDORAE_OUT_OF_MEMORY || data_points_length(data) != before ||
+        data_points_count(data) != count) {
+        fprintf(stderr, "a string which ran out of memory was kept\n");
+        fail_alloc = 0;
+        data_points_destroy(data);
+        goto out;
+    }
+    fail_alloc = 0;
+    data_points_destroy(data);
+    ret = 0;
+
+out:
+    fail_alloc = 0;
+    buffer_destroy(&buf);
+    return ret;
+}
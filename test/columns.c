@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pandora/client.h"
+
+#define TEST_ROWS 3000
+#define TEST_TEXT (1024 * 1024)
+
+/* the encoded points of data, NUL terminated, or NULL when they do not fit in size bytes */
+static const char *points_text(s_data_points *data, char *out, size_t size)
+{
+    const char *chunk;
+    size_t offset = 0, len;
+
+    while (offset < BUFFER_SIZE(data->buf)) {
+        chunk = buffer_chunk(data->buf, offset, &len);
+        if (offset + len >= size)
+            return NULL;
+        memcpy(out + offset, chunk, len);
+        offset += len;
+    }
+    out[offset] = '\0';
+    return out;
+}
+
+static int same_points(const char *what, s_data_points *columnar, s_data_points *keyed)
+{
+    static char a[TEST_TEXT], b[TEST_TEXT];
+
+    if (!points_text(columnar, a, sizeof(a)) || !points_text(keyed, b, sizeof(b)) || strcmp(a, b) != 0 ||
+        columnar->point_count != keyed->point_count) {
+        fprintf(stderr, "%s: %d columnar points differ from %d built by key\n", what, columnar->point_count,
+                keyed->point_count);
+        return 0;
+    }
+    return 1;
+}
+
+static int flags[TEST_ROWS];
+static long counts[TEST_ROWS];
+static long long totals[TEST_ROWS];
+static float ratios[TEST_ROWS];
+static double values[TEST_ROWS];
+static const char *msgs[TEST_ROWS];
+
+/*
+ * Each column is read as the type its schema field has and encodes as that field added by key
+ * would; NULL columns and strings leave the field out, and a row with no field at all is skipped.
+ * A string which is not UTF-8 turns down the whole call
+ */
+int main(void)
+{
+    const char *keys[] = { "flag", "count", "total", "ratio", "value", "msg" };
+    const e_field_type types[] = { FIELD_BOOLEAN, FIELD_INT32, FIELD_INT64, FIELD_FLOAT32, FIELD_FLOAT64, FIELD_STRING };
+    const void *columns[6] = { flags, counts, totals, ratios, values, msgs };
+    const void *sparse[6] = { NULL, NULL, NULL, NULL, NULL, msgs };
+    s_pandora_schema *schema;
+    s_data_points *columnar, *keyed;
+    size_t row, before;
+    int count, ret = 1;
+
+    for (row = 0; row < TEST_ROWS; row++) {
+        flags[row] = row & 1;
+        counts[row] = row % 2 ? -2147483647L - 1 : (long)row;
+        totals[row] = 9007199254740993LL * (long long)row - 1;
+        ratios[row] = 0.1f * row;
+        values[row] = row % 3 ? 1.0 / (row + 1) : -1e300;
+        msgs[row] = row % 7 == 0 ? NULL : row % 5 == 0 ? "tab\tand\nnewline" : "the quick brown fox";
+    }
+
+    schema = pandora_schema_create("test", keys, types, 6);
+    columnar = data_points_create();
+    keyed = data_points_create();
+    if (!schema || !columnar || !keyed)
+        return 1;
+
+    /* every type, more rows than one segment holds */
+    if (data_points_append_columns(columnar, schema, columns, TEST_ROWS) != PANDORAE_OK)
+        goto out;
+    for (row = 0; row < TEST_ROWS; row++) {
+        data_points_begin_point(keyed);
+        data_points_add_boolean(keyed, "flag", flags[row]);
+        data_points_add_int32(keyed, "count", counts[row]);
+        data_points_add_int64(keyed, "total", totals[row]);
+        data_points_add_float32(keyed, "ratio", ratios[row]);
+        data_points_add_float64(keyed, "value", values[row]);
+        if (msgs[row])
+            data_points_add_string(keyed, "msg", msgs[row]);
+        data_points_end_point(keyed);
+    }
+    if (!same_points("all columns", columnar, keyed))
+        goto out;
+
+    /* only the string column, rows with a NULL string are no points */
+    data_points_clear(columnar);
+    data_points_clear(keyed);
+    if (data_points_append_columns(columnar, schema, sparse, TEST_ROWS) != PANDORAE_OK)
+        goto out;
+    for (row = 0; row < TEST_ROWS; row++) {
+        if (!msgs[row])
+            continue;
+        data_points_begin_point(keyed);
+        data_points_add_string(keyed, "msg", msgs[row]);
+        data_points_end_point(keyed);
+    }
+    if (!same_points("string column only", columnar, keyed))
+        goto out;
+
+    /* an invalid string late in the batch, or a point still open, leaves the batch as it was */
+    before = BUFFER_SIZE(columnar->buf);
+    count = columnar->point_count;
+    msgs[TEST_ROWS - 2] = "bad \xff byte";
+    if (data_points_append_columns(columnar, schema, columns, TEST_ROWS) != PANDORAE_INVALID_UTF8 ||
+        BUFFER_SIZE(columnar->buf) != before || columnar->point_count != count) {
+        fprintf(stderr, "a batch with an invalid string was appended\n");
+        goto out;
+    }
+    data_points_begin_point(columnar);
+    if (data_points_append_columns(columnar, schema, sparse, 1) != PANDORAE_INVALID_ARGUMENT) {
+        fprintf(stderr, "columns were appended into an open point\n");
+        goto out;
+    }
+    ret = 0;
+
+out:
+    data_points_destroy(columnar);
+    data_points_destroy(keyed);
+    pandora_schema_destroy(schema);
+    return ret;
+}
@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "pandora/client.h"
+#include "escape.h"
+
+static int failures;
+
+static void expect(const char *name, const char *got, size_t got_len, const char *want)
+{
+    if (got_len != strlen(want) || memcmp(got, want, got_len) != 0) {
+        fprintf(stderr, "%s: got \"%.*s\", want \"%s\"\n", name, (int)got_len, got, want);
+        failures++;
+    }
+}
+
+/* every kernel against the expected bytes, at offsets which land in vectors and in the tail */
+static void check(const char *src, const char *want)
+{
+    char out[ESCAPE_MAX_SIZE(256)];
+    size_t len;
+
+    if (!escape_value_scalar(out, src, strlen(src), &len))
+        len = 0;
+    expect("scalar", out, len, want);
+    if (!escape_value(out, src, strlen(src), &len))
+        len = 0;
+    expect(escape_kernel(), out, len, want);
+}
+
+int main(void)
+{
+    char src[128], want[256];
+    const char *line;
+    s_data_points *data;
+    size_t len;
+    int at;
+
+    /* a real tab and a backslash followed by t must not come out the same */
+    check("x\ty", "x\\ty");
+    check("x\\ty", "x\\\\ty");
+    check("\\", "\\\\");
+    check("a\\\\b\n", "a\\\\\\\\b\\n");
+
+    for (at = 0; at < 100; at++) {
+        memset(src, 'a', 100);
+        src[100] = '\0';
+        src[at] = '\\';
+        memset(want, 'a', 101);
+        want[at] = '\\';
+        want[at + 1] = '\\';
+        want[101] = '\0';
+        check(src, want);
+    }
+
+    data = data_points_create();
+    data_points_begin_point(data);
+    data_points_add_string(data, "a", "x\\ty");
+    data_points_add_string(data, "b", "x\ty");
+    data_points_end_point(data);
+    line = buffer_chunk(data->buf, 0, &len);
+    expect("data_points", line, len, "a=x\\\\ty\tb=x\\ty\n");
+    data_points_destroy(data);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,150 @@
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pandora/client.h"
+#include "sink.h"
+#include "wal.h"
+
+#define TEST_RECORDS 100
+#define TEST_LINES 10
+#define TEST_LINE 50
+#define TEST_BODY 1024
+#define TEST_ACCEPTED 30
+#define TEST_BODIES 8
+
+/* a sink which accepts the first requests it gets and turns down the rest with a 400 */
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static int accept_left;
+static int received[TEST_RECORDS * TEST_LINES];
+
+static void record_lines(const char *body, size_t len)
+{
+    const char *line = body, *end = body + len, *nl;
+    long seq;
+
+    while (line < end) {
+        nl = memchr(line, '\n', end - line);
+        if (!nl)
+            nl = end;
+        seq = strncmp(line, "seq=", 4) == 0 ? strtol(line + 4, NULL, 10) : -1;
+        if (seq >= 0 && seq < TEST_RECORDS * TEST_LINES)
+            received[seq]++;
+        line = nl + 1;
+    }
+}
+
+static void accept_first(const s_sink_request *request, s_sink_reply *reply, void *userdata)
+{
+    (void)userdata;
+
+    pthread_mutex_lock(&mutex);
+    if (accept_left > 0) {
+        accept_left--;
+        record_lines(request->body, request->len);
+    } else {
+        reply->status = 400;
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+static int write_segment(const char *path)
+{
+    char line[TEST_LINE + 1];
+    buffer_t record;
+    size_t size = WAL_MAGIC_SIZE;
+    int fd, i, j, ok = 1;
+
+    fd = wal_create(path);
+    if (fd < 0 || !buffer_init(&record, 0, BUFFER_GROWABLE))
+        return 0;
+    for (i = 0; i < TEST_RECORDS && ok; i++) {
+        buffer_reset(&record);
+        for (j = 0; j < TEST_LINES; j++) {
+            snprintf(line, sizeof(line), "seq=%-8d msg=the quick brown fox jumps over\n", i * TEST_LINES + j);
+            buffer_write(&record, line, strlen(line));
+        }
+        ok = wal_append(fd, &size, "test", &record, 0, BUFFER_SIZE(&record));
+    }
+    buffer_destroy(&record);
+    close(fd);
+    return ok;
+}
+
+/*
+ * A replay which fails part way must not post again the records the server already accepted:
+ * only the bodies posted along with the one which failed, at most TEST_BODIES - 1, and the start
+ * of the record it cuts through may arrive twice
+ */
+int main(void)
+{
+    char cachedir[] = "/tmp/pandora_test_replay.XXXXXX";
+    char host[64], path[PATH_MAX];
+    s_client_params params;
+    s_pandora_client *client;
+    pandora_error_t status;
+    int port, i, twice = 0, ret = 1;
+
+    alarm(20);
+
+    port = sink_start(accept_first, NULL);
+    if (port < 0 || !mkdtemp(cachedir))
+        return 1;
+    snprintf(host, sizeof(host), "http://127.0.0.1:%d", port);
+    snprintf(path, sizeof(path), "%s/cache.test", cachedir);
+    if (!write_segment(path))
+        goto out_dir;
+
+    memset(&params, 0, sizeof(params));
+    params.pipeline_host = host;
+    params.access_key = "ak";
+    params.secret_key = "sk";
+    client = pandora_client_init(&params);
+    if (!client)
+        goto out_dir;
+    pandora_client_set_max_body_size(client, TEST_BODY);
+
+    accept_left = TEST_ACCEPTED;
+    status = pandora_client_write_cached(client, "test", cachedir);
+    if (status == PANDORAE_OK || access(path, F_OK) != 0) {
+        fprintf(stderr, "the first replay should fail and keep the segment, status %d\n", status);
+        goto out;
+    }
+    if (wal_replayed(path) <= WAL_MAGIC_SIZE) {
+        fprintf(stderr, "no progress recorded for the accepted bodies\n");
+        goto out;
+    }
+
+    pthread_mutex_lock(&mutex);
+    accept_left = INT_MAX;
+    pthread_mutex_unlock(&mutex);
+    status = pandora_client_write_cached(client, "test", cachedir);
+    if (status != PANDORAE_OK || access(path, F_OK) == 0 || wal_replayed(path) != 0) {
+        fprintf(stderr, "the second replay should finish and delete the segment, status %d\n", status);
+        goto out;
+    }
+
+    for (i = 0; i < TEST_RECORDS * TEST_LINES; i++) {
+        if (received[i] == 0) {
+            fprintf(stderr, "line %d never arrived\n", i);
+            goto out;
+        }
+        twice += received[i] > 1;
+    }
+    if (twice > (TEST_BODIES - 1) * (TEST_BODY / TEST_LINE) + TEST_LINES) {
+        fprintf(stderr, "%d lines arrived twice, more than the bodies posted with the failed one\n", twice);
+        goto out;
+    }
+    ret = 0;
+
+out:
+    pandora_client_cleanup(client);
+out_dir:
+    unlink(path);
+    wal_remove_replayed(path);
+    rmdir(cachedir);
+    return ret;
+}
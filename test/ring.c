@@ -0,0 +1,156 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pandora/buffer.h"
+
+#define TEST_RECORD 1000
+#define TEST_LINES 200000
+
+static buffer_t ring;
+
+/* line i, of a length that varies so that lines end all over the ring */
+static int make_line(char *out, size_t size, long i)
+{
+    return snprintf(out, size, "seq=%ld %.*s\n", i, (int)(i % 97), "the quick brown fox jumps over the lazy dog "
+                    "the quick brown fox jumps over the lazy dog the quick brown fox jumps over");
+}
+
+/*
+ * One thread: records straddling the end of the ring are written and read in one piece through
+ * the second mapping, and the first mapping sees what went through the second
+ */
+static int check_wraparound(void)
+{
+    char record[TEST_RECORD], *dest;
+    const char *data;
+    size_t len, pos, i;
+    int round, straddled = 0;
+
+    for (round = 0; round < 40; round++) {
+        for (i = 0; i < TEST_RECORD; i++)
+            record[i] = (char)(round * 31 + i);
+
+        pos = ring.written & (ring.capacity - 1);
+        dest = buffer_ring_reserve(&ring, TEST_RECORD);
+        if (!dest) {
+            fprintf(stderr, "no room in an empty ring in round %d\n", round);
+            return 0;
+        }
+        memcpy(dest, record, TEST_RECORD);
+        buffer_ring_commit(&ring, TEST_RECORD);
+
+        data = buffer_ring_peek(&ring, &len);
+        if (len != TEST_RECORD || memcmp(data, record, TEST_RECORD) != 0) {
+            fprintf(stderr, "record at %zu read back wrong\n", pos);
+            return 0;
+        }
+        data = buffer_chunk(&ring, ring.read, &len);
+        if (len != TEST_RECORD || memcmp(data, record, TEST_RECORD) != 0) {
+            fprintf(stderr, "chunk at %zu read back wrong\n", pos);
+            return 0;
+        }
+        /* the part past the end landed at the start of the first mapping */
+        straddled += pos + TEST_RECORD > ring.capacity;
+        if (pos + TEST_RECORD > ring.capacity &&
+            memcmp(ring.data, record + (ring.capacity - pos), pos + TEST_RECORD - ring.capacity) != 0) {
+            fprintf(stderr, "the wrapped part of the record at %zu is not at the start\n", pos);
+            return 0;
+        }
+
+        /* full until the consumer releases, then room again */
+        while (buffer_ring_reserve(&ring, TEST_RECORD) != NULL)
+            buffer_ring_commit(&ring, TEST_RECORD);
+        if (buffer_ring_reserve(&ring, 1 + ring.capacity - (ring.written - ring.read)) != NULL) {
+            fprintf(stderr, "more room than the ring has\n");
+            return 0;
+        }
+        buffer_ring_consume(&ring, ring.written - ring.read);
+        if (buffer_ring_reserve(&ring, ring.capacity) == NULL) {
+            fprintf(stderr, "no room once everything was consumed\n");
+            return 0;
+        }
+        buffer_ring_commit(&ring, TEST_RECORD / 3);
+        buffer_ring_consume(&ring, TEST_RECORD / 3);
+    }
+    if (straddled == 0) {
+        fprintf(stderr, "no record straddled the end of the ring\n");
+        return 0;
+    }
+    return 1;
+}
+
+static void *producer_run(void *arg)
+{
+    char line[256], *dest;
+    int len;
+    long i;
+
+    (void)arg;
+    for (i = 0; i < TEST_LINES; i++) {
+        len = make_line(line, sizeof(line), i);
+        while ((dest = buffer_ring_reserve(&ring, len)) == NULL)
+            sched_yield();
+        memcpy(dest, line, len);
+        buffer_ring_commit(&ring, len);
+    }
+    return NULL;
+}
+
+/*
+ * Two threads: every line the producer published reaches the consumer whole and in order, over
+ * thousands of laps of the ring, with no lock but the acquire and release of the cursors
+ */
+static int check_threads(void)
+{
+    char expected[256];
+    const char *data, *line, *nl;
+    pthread_t thread;
+    size_t len;
+    long next = 0;
+    int explen, ok = 1;
+
+    if (pthread_create(&thread, NULL, producer_run, NULL) != 0)
+        return 0;
+    while (next < TEST_LINES && ok) {
+        data = buffer_ring_peek_lines(&ring, 1024, &len);
+        if (len == 0) {
+            sched_yield();
+            continue;
+        }
+        for (line = data; line < data + len; line = nl + 1) {
+            nl = memchr(line, '\n', data + len - line);
+            explen = make_line(expected, sizeof(expected), next);
+            if (!nl || nl + 1 - line != explen || memcmp(line, expected, explen) != 0) {
+                fprintf(stderr, "line %ld arrived as %.*s\n", next, (int)(nl ? nl - line : 0), line);
+                ok = 0;
+                break;
+            }
+            next++;
+        }
+        buffer_ring_consume(&ring, len);
+    }
+    /* the producer would wait for room forever */
+    if (!ok)
+        _exit(1);
+    pthread_join(thread, NULL);
+    return ok;
+}
+
+int main(void)
+{
+    int ret = 1;
+
+    alarm(20);
+
+    /* a single page, so that the threads lap it all the time */
+    if (!buffer_ring_init(&ring, 1))
+        return 1;
+    if (check_wraparound() && check_threads())
+        ret = 0;
+    buffer_destroy(&ring);
+    return ret;
+}
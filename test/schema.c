@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pandora/client.h"
+
+/* the encoded points of data, NUL terminated, or NULL when they do not fit in size bytes */
+static const char *points_text(s_data_points *data, char *out, size_t size)
+{
+    const char *chunk;
+    size_t offset = 0, len;
+
+    while (offset < BUFFER_SIZE(data->buf)) {
+        chunk = buffer_chunk(data->buf, offset, &len);
+        if (offset + len >= size)
+            return NULL;
+        memcpy(out + offset, chunk, len);
+        offset += len;
+    }
+    out[offset] = '\0';
+    return out;
+}
+
+static int check_invalid(const char *what, const char **keys, const e_field_type *types, int count)
+{
+    s_pandora_schema *schema = pandora_schema_create("test", keys, types, count);
+
+    if (schema) {
+        fprintf(stderr, "a schema with %s was created\n", what);
+        pandora_schema_destroy(schema);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Points built by field index through a schema are the points built by key, and a field of the
+ * wrong type or index is turned down without closing the point
+ */
+int main(void)
+{
+    const char *keys[] = { "flag", "count", "total", "ratio", "value", "msg" };
+    const e_field_type types[] = { FIELD_BOOLEAN, FIELD_INT32, FIELD_INT64, FIELD_FLOAT32, FIELD_FLOAT64, FIELD_STRING };
+    const char *bad_keys[] = { "ok", "1st" };
+    const char *dup_keys[] = { "ok", "ok" };
+    const e_field_type bad_types[] = { FIELD_STRING, (e_field_type)42 };
+    char by_index[1024], by_key[1024];
+    s_pandora_schema *schema;
+    s_data_points *indexed, *keyed;
+    const char *a, *b;
+    int i, ret = 1;
+
+    if (!check_invalid("a key starting with a digit", bad_keys, types, 2) ||
+        !check_invalid("a key given twice", dup_keys, types, 2) ||
+        !check_invalid("an unknown type", keys, bad_types, 2) ||
+        !check_invalid("no fields", keys, types, 0))
+        return 1;
+
+    schema = pandora_schema_create("test", keys, types, 6);
+    indexed = data_points_create();
+    keyed = data_points_create();
+    if (!schema || !indexed || !keyed)
+        return 1;
+
+    if (data_points_add_field_int64(indexed, schema, 2, 1) != PANDORAE_INVALID_ARGUMENT) {
+        fprintf(stderr, "a field was added with no point open\n");
+        goto out;
+    }
+
+    for (i = 0; i < 3; i++) {
+        data_points_begin_point(indexed);
+        /* the wrong type or index leaves the point open and as it was */
+        if (data_points_add_field_string(indexed, schema, 2, "x") != PANDORAE_SCHEMA_MISMATCH ||
+            data_points_add_field_int64(indexed, schema, 6, 1) != PANDORAE_INVALID_ARGUMENT ||
+            data_points_add_field_int64(indexed, schema, -1, 1) != PANDORAE_INVALID_ARGUMENT) {
+            fprintf(stderr, "a field of the wrong type or index was not turned down\n");
+            goto out;
+        }
+        /* fields in any order, the first one without a tab in front */
+        data_points_add_field_string(indexed, schema, 5, i == 1 ? "tab\there" : "hello");
+        data_points_add_field_boolean(indexed, schema, 0, i & 1);
+        data_points_add_field_int32(indexed, schema, 1, -2147483647L - i);
+        data_points_add_field_int64(indexed, schema, 2, 9007199254740993LL * (i + 1));
+        data_points_add_field_float32(indexed, schema, 3, 0.1f * i);
+        data_points_add_field_float64(indexed, schema, 4, 1e300 / (i + 1));
+        if (data_points_end_point(indexed) != PANDORAE_OK) {
+            fprintf(stderr, "point %d did not end\n", i);
+            goto out;
+        }
+
+        data_points_begin_point(keyed);
+        data_points_add_string(keyed, "msg", i == 1 ? "tab\there" : "hello");
+        data_points_add_boolean(keyed, "flag", i & 1);
+        data_points_add_int32(keyed, "count", -2147483647L - i);
+        data_points_add_int64(keyed, "total", 9007199254740993LL * (i + 1));
+        data_points_add_float32(keyed, "ratio", 0.1f * i);
+        data_points_add_float64(keyed, "value", 1e300 / (i + 1));
+        data_points_end_point(keyed);
+    }
+
+    a = points_text(indexed, by_index, sizeof(by_index));
+    b = points_text(keyed, by_key, sizeof(by_key));
+    if (!a || !b || strcmp(a, b) != 0 || indexed->point_count != 3) {
+        fprintf(stderr, "by index:\n%s\nby key:\n%s\n", a ? a : "(too long)", b ? b : "(too long)");
+        goto out;
+    }
+    ret = 0;
+
+out:
+    data_points_destroy(indexed);
+    data_points_destroy(keyed);
+    pandora_schema_destroy(schema);
+    return ret;
+}
@@ -0,0 +1,102 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pandora/client.h"
+#include "compress.h"
+#include "sink.h"
+
+#define TEST_HITS 2000
+
+static buffer_t plain;
+static buffer_t encoded;
+static int negotiated;
+
+/* the result goes out gzip encoded to a client which says it accepts gzip, as is otherwise */
+static void search(const s_sink_request *request, s_sink_reply *reply, void *userdata)
+{
+    const char *accept = strcasestr(request->headers, "Accept-Encoding:");
+    const char *eol = accept ? strstr(accept, "\r\n") : NULL;
+    const char *gzip = accept ? strstr(accept, "gzip") : NULL;
+
+    (void)userdata;
+    if (gzip && (!eol || gzip < eol)) {
+        negotiated = 1;
+        reply->headers = "Content-Encoding: gzip\r\n";
+        reply->body = encoded.data;
+        reply->len = BUFFER_SIZE(&encoded);
+    } else {
+        reply->body = plain.data;
+        reply->len = BUFFER_SIZE(&plain);
+    }
+}
+
+/*
+ * A search result the server gzip encodes reaches the caller decoded: the response is inflated
+ * while it streams into the buffer write_callback fills
+ */
+int main(void)
+{
+    char host[64], hit[160];
+    s_client_params params;
+    s_search_params sp;
+    s_pandora_client *client;
+    char *result = NULL;
+    pandora_error_t status;
+    int port, i, len, ret = 1;
+
+    alarm(10);
+
+    if (!buffer_init(&plain, 0, BUFFER_GROWABLE) || !buffer_init(&encoded, 0, BUFFER_GROWABLE))
+        return 1;
+    buffer_write(&plain, "{\"total\":2000,\"data\":[", 22);
+    for (i = 0; i < TEST_HITS; i++) {
+        len = snprintf(hit, sizeof(hit), "%s{\"seq\":%d,\"host\":\"web-%d\",\"msg\":\"the quick brown fox jumps over the lazy dog\"}",
+                       i ? "," : "", i, i % 16);
+        buffer_write(&plain, hit, len);
+    }
+    buffer_write(&plain, "]}", 2);
+    if (!gzip_compress(&plain, 0, BUFFER_SIZE(&plain), 6, &encoded))
+        return 1;
+
+    port = sink_start(search, NULL);
+    if (port < 0)
+        return 1;
+    snprintf(host, sizeof(host), "http://127.0.0.1:%d", port);
+
+    memset(&params, 0, sizeof(params));
+    params.insight_host = host;
+    params.access_key = "ak";
+    params.secret_key = "sk";
+    client = pandora_client_init(&params);
+    if (!client)
+        return 1;
+
+    memset(&sp, 0, sizeof(sp));
+    sp.query = "*";
+    sp.size = TEST_HITS;
+    status = pandora_client_insight_search(client, "test", &sp, &result);
+    if (status != PANDORAE_OK || !result) {
+        fprintf(stderr, "search failed with status %d\n", status);
+        goto out;
+    }
+    if (!negotiated) {
+        fprintf(stderr, "the request did not accept gzip\n");
+        goto out;
+    }
+    if (strlen(result) != BUFFER_SIZE(&plain) || memcmp(result, plain.data, BUFFER_SIZE(&plain)) != 0) {
+        fprintf(stderr, "got %zu bytes instead of the %zu decoded ones\n", strlen(result), BUFFER_SIZE(&plain));
+        goto out;
+    }
+    ret = 0;
+
+out:
+    free(result);
+    pandora_client_cleanup(client);
+    buffer_destroy(&plain);
+    buffer_destroy(&encoded);
+    return ret;
+}
@@ -0,0 +1,209 @@
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "sink.h"
+
+typedef struct {
+    int fd;
+    sink_handler handler;
+    void *userdata;
+} s_sink_conn;
+
+static const char *reason(int status)
+{
+    switch (status) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 429: return "Too Many Requests";
+        case 500: return "Internal Server Error";
+        case 503: return "Service Unavailable";
+        default: return "Unknown";
+    }
+}
+
+/* the head and the body in one go, a reply split in two writes stalls on delayed ACKs */
+static int reply_send(int fd, const s_sink_reply *reply)
+{
+    char head[512];
+    struct iovec iov[2];
+    ssize_t n;
+    int len = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Length: %zu\r\n"
+                       "Content-Type: application/json\r\n%s\r\n",
+                       reply->status, reason(reply->status), reply->len, reply->headers ? reply->headers : "");
+
+    if (len < 0 || (size_t)len >= sizeof(head))
+        return 0;
+    iov[0].iov_base = head;
+    iov[0].iov_len = len;
+    iov[1].iov_base = (void *)reply->body;
+    iov[1].iov_len = reply->len;
+
+    while (iov[0].iov_len + iov[1].iov_len > 0) {
+        n = writev(fd, iov, 2);
+        if (n <= 0)
+            return 0;
+        if ((size_t)n < iov[0].iov_len) {
+            iov[0].iov_base = (char *)iov[0].iov_base + n;
+            iov[0].iov_len -= n;
+        } else {
+            n -= iov[0].iov_len;
+            iov[0].iov_len = 0;
+            iov[1].iov_base = (char *)iov[1].iov_base + n;
+            iov[1].iov_len -= n;
+        }
+    }
+    return 1;
+}
+
+/* HTTP/1.1 with keep-alive, one request after the other on a connection */
+static void *conn_run(void *arg)
+{
+    s_sink_conn *conn = (s_sink_conn *)arg;
+    size_t cap = 1 << 20, have = 0, need, clen;
+    char *buf = malloc(cap), *hend, *p, *grown, *target_end;
+    s_sink_request request;
+    s_sink_reply reply;
+    ssize_t n;
+
+    while (buf) {
+        while (!(hend = have ? memmem(buf, have, "\r\n\r\n", 4) : NULL)) {
+            if (have == cap)
+                goto done;
+            n = read(conn->fd, buf + have, cap - have);
+            if (n <= 0)
+                goto done;
+            have += n;
+        }
+
+        clen = 0;
+        for (p = buf; p < hend; p = strstr(p, "\r\n") + 2) {
+            if (strncasecmp(p, "Content-Length:", 15) == 0)
+                clen = strtoul(p + 15, NULL, 10);
+        }
+
+        need = hend + 4 - buf + clen;
+        if (need > cap) {
+            grown = realloc(buf, need);
+            if (!grown)
+                goto done;
+            hend = grown + (hend - buf);
+            buf = grown;
+            cap = need;
+        }
+        while (have < need) {
+            n = read(conn->fd, buf + have, cap - have);
+            if (n <= 0)
+                goto done;
+            have += n;
+        }
+
+        /* the request line and the headers are cut into strings in place */
+        hend[2] = '\0';
+        p = strchr(buf, ' ');
+        request.target = p ? p + 1 : "";
+        target_end = p ? strchr(p + 1, ' ') : NULL;
+        if (target_end)
+            *target_end = '\0';
+        p = strstr(target_end ? target_end + 1 : buf, "\r\n");
+        request.headers = p ? p + 2 : "";
+        request.body = buf + need - clen;
+        request.len = clen;
+
+        reply.status = 200;
+        reply.headers = NULL;
+        reply.body = "{}";
+        reply.len = 2;
+        conn->handler(&request, &reply, conn->userdata);
+        if (!reply_send(conn->fd, &reply))
+            goto done;
+
+        memmove(buf, buf + need, have - need);
+        have -= need;
+    }
+
+done:
+    free(buf);
+    close(conn->fd);
+    free(conn);
+    return NULL;
+}
+
+typedef struct {
+    int fd;
+    sink_handler handler;
+    void *userdata;
+} s_sink;
+
+static void *server_run(void *arg)
+{
+    s_sink *sink = (s_sink *)arg;
+    s_sink_conn *conn;
+    pthread_t thread;
+    int fd, one = 1;
+
+    while ((fd = accept(sink->fd, NULL, NULL)) >= 0) {
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        conn = malloc(sizeof(s_sink_conn));
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->handler = sink->handler;
+        conn->userdata = sink->userdata;
+        if (pthread_create(&thread, NULL, conn_run, conn) != 0) {
+            close(fd);
+            free(conn);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    free(sink);
+    return NULL;
+}
+
+int sink_start(sink_handler handler, void *userdata)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    pthread_t server;
+    s_sink *sink;
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(lfd, 128) != 0 ||
+        getsockname(lfd, (struct sockaddr *)&addr, &len) != 0) {
+        if (lfd >= 0)
+            close(lfd);
+        return -1;
+    }
+
+    sink = malloc(sizeof(s_sink));
+    if (!sink) {
+        close(lfd);
+        return -1;
+    }
+    sink->fd = lfd;
+    sink->handler = handler;
+    sink->userdata = userdata;
+    if (pthread_create(&server, NULL, server_run, sink) != 0) {
+        close(lfd);
+        free(sink);
+        return -1;
+    }
+    pthread_detach(server);
+    return ntohs(addr.sin_port);
+}
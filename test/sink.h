@@ -0,0 +1,37 @@
+#ifndef PANDORA_C_TEST_SINK_H
+#define PANDORA_C_TEST_SINK_H
+
+#include <stddef.h>
+
+/*
+ * A local HTTP/1.1 stand-in for the pandora servers, used by the tests and the benchmarks: every
+ * connection gets a thread, which reads requests one after the other and answers each as the
+ * handler says
+ */
+
+typedef struct {
+    const char *target;     /* as in the request line, like /v2/repos/<repo>/data */
+    const char *headers;    /* the header lines, NUL terminated */
+    char *body;             /* not NUL terminated, may be changed by the handler */
+    size_t len;
+} s_sink_request;
+
+typedef struct {
+    int status;             /* 200 unless the handler sets another */
+    const char *headers;    /* more header lines, each ending in \r\n, or NULL */
+    const char *body;       /* "{}" unless the handler sets another */
+    size_t len;
+} s_sink_reply;
+
+/**
+ * Called on the connection's thread for every request, concurrently for requests on different
+ * connections. It may block, which holds back the reply
+ */
+typedef void (*sink_handler)(const s_sink_request *request, s_sink_reply *reply, void *userdata);
+
+/**
+ * Listen on an ephemeral port of the loopback interface: returns the port, -1 on failure
+ */
+int sink_start(sink_handler handler, void *userdata);
+
+#endif //PANDORA_C_TEST_SINK_H
@@ -0,0 +1,131 @@
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pandora/client.h"
+#include "sink.h"
+
+#define TEST_BATCHES 40
+#define TEST_POINTS 10
+#define TEST_SEGMENT 4096
+#define TEST_WAIT_MS 8000
+
+/* the sink holds every reply until it is opened, so that the sender cannot drain its queue */
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t opened = PTHREAD_COND_INITIALIZER;
+static int open_;
+
+static void hold(const s_sink_request *request, s_sink_reply *reply, void *userdata)
+{
+    (void)request;
+    (void)reply;
+    (void)userdata;
+
+    pthread_mutex_lock(&mutex);
+    while (!open_)
+        pthread_cond_wait(&opened, &mutex);
+    pthread_mutex_unlock(&mutex);
+}
+
+static void remove_dir(const char *dir)
+{
+    char path[PATH_MAX * 2];
+    struct dirent *entry;
+    DIR *dirp = opendir(dir);
+
+    if (!dirp)
+        return;
+    while ((entry = readdir(dirp)) != NULL) {
+        if (strncmp(entry->d_name, "cache.", 6) != 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        unlink(path);
+    }
+    closedir(dirp);
+    rmdir(dir);
+}
+
+/*
+ * Batches which only ever reach the cache through QUEUE_SPILL must seal segments at the size
+ * limit like pandora_client_write does, for the flusher thread to replay them
+ */
+int main(void)
+{
+    char cachedir[] = "/tmp/pandora_test_spill.XXXXXX";
+    char host[64];
+    s_client_params params;
+    s_async_params ap;
+    s_flush_status fs;
+    s_pandora_client *client;
+    s_data_points *data;
+    int port, i, j, waited, ret = 1;
+
+    /* a hang is killed by SIGALRM, which fails the test */
+    alarm(20);
+
+    port = sink_start(hold, NULL);
+    if (port < 0 || !mkdtemp(cachedir))
+        return 1;
+    snprintf(host, sizeof(host), "http://127.0.0.1:%d", port);
+
+    memset(&params, 0, sizeof(params));
+    params.pipeline_host = host;
+    params.access_key = "ak";
+    params.secret_key = "sk";
+    client = pandora_client_init(&params);
+    if (!client || pandora_client_set_cache_policy(client, CACHE_BY_SIZE, TEST_SEGMENT, cachedir) != PANDORAE_OK ||
+        pandora_client_set_durability(client, DURABILITY_NONE, 0, 0) != PANDORAE_OK)
+        goto out;
+
+    memset(&ap, 0, sizeof(ap));
+    ap.sender_threads = 1;
+    ap.queue_depth = 1;
+    ap.max_inflight = 1;
+    ap.policy = QUEUE_SPILL;
+    if (pandora_client_start_async(client, &ap) != PANDORAE_OK)
+        goto out;
+
+    /* the first batch stays on the wire and the next fills the queue, the rest spill */
+    for (i = 0; i < TEST_BATCHES; i++) {
+        data = data_points_create();
+        for (j = 0; j < TEST_POINTS; j++) {
+            data_points_begin_point(data);
+            data_points_add_int64(data, "seq", i * TEST_POINTS + j);
+            data_points_add_string(data, "msg", "the quick brown fox jumps over the lazy dog");
+            data_points_end_point(data);
+        }
+        if (pandora_client_write_async(client, "test", data) != PANDORAE_OK) {
+            fprintf(stderr, "write_async of batch %d failed\n", i);
+            data_points_destroy(data);
+            goto out;
+        }
+    }
+
+    pthread_mutex_lock(&mutex);
+    open_ = 1;
+    pthread_cond_broadcast(&opened);
+    pthread_mutex_unlock(&mutex);
+
+    for (waited = 0; waited < TEST_WAIT_MS; waited += 50) {
+        pandora_client_get_flush_status(client, &fs);
+        if (fs.flushed_segments > 0 && fs.pending_segments == 0)
+            break;
+        usleep(50 * 1000);
+    }
+    if (fs.flushed_segments == 0 || fs.pending_segments != 0 || fs.last_error != PANDORAE_OK) {
+        fprintf(stderr, "flushed %llu segments, %d pending, last error %d\n", fs.flushed_segments,
+                fs.pending_segments, fs.last_error);
+        goto out;
+    }
+    ret = 0;
+
+out:
+    if (client)
+        pandora_client_cleanup(client);
+    remove_dir(cachedir);
+    return ret;
+}
@@ -0,0 +1,141 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "wal.h"
+
+#define TEST_RECORDS 10
+
+static size_t ends[TEST_RECORDS + 1];
+
+/* TEST_RECORDS records of growing length, ends[i] is where record i ends and ends[0] the magic */
+static int write_segment(const char *path)
+{
+    char line[64];
+    buffer_t record;
+    size_t size = WAL_MAGIC_SIZE;
+    int fd, i, j, ok = 1;
+
+    fd = wal_create(path);
+    if (fd < 0 || !buffer_init(&record, 0, BUFFER_GROWABLE))
+        return 0;
+    ends[0] = size;
+    for (i = 1; i <= TEST_RECORDS && ok; i++) {
+        buffer_reset(&record);
+        for (j = 0; j < i; j++) {
+            snprintf(line, sizeof(line), "seq=%d msg=the quick brown fox\n", i * 100 + j);
+            buffer_write(&record, line, strlen(line));
+        }
+        ok = wal_append(fd, &size, "test", &record, 0, BUFFER_SIZE(&record));
+        ends[i] = size;
+    }
+    buffer_destroy(&record);
+    close(fd);
+    return ok;
+}
+
+static off_t file_size(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_size : -1;
+}
+
+/* the records left after a recovery read back in full, the last one ending the file */
+static int check_records(const char *path, long expected)
+{
+    s_wal_reader reader;
+    buffer_t payload;
+    long records = 0;
+    int rc;
+
+    if (wal_open(&reader, path) <= 0 || !buffer_init(&payload, 0, BUFFER_GROWABLE))
+        return 0;
+    while ((rc = wal_next(&reader)) > 0 && strcmp(reader.repo, "test") == 0) {
+        buffer_reset(&payload);
+        if (wal_read(&reader, &payload) <= 0)
+            break;
+        records++;
+    }
+    buffer_destroy(&payload);
+    wal_close(&reader);
+    return rc == 0 && records == expected;
+}
+
+/* recover the segment at path after damage, which should leave the first expected records */
+static int recovered(const char *path, const char *what, long expected)
+{
+    long records = wal_recover(path);
+
+    if (records != expected || file_size(path) != (off_t)ends[expected] || !check_records(path, expected)) {
+        fprintf(stderr, "%s: %ld records and %lld bytes left, expected %ld and %zu\n", what, records,
+                (long long)file_size(path), expected, ends[expected]);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Recovery cuts a segment after its last valid record: a tail torn within a header or a payload,
+ * and a record whose CRC does not match, go with everything after them
+ */
+int main(void)
+{
+    char path[] = "/tmp/pandora_test_wal.XXXXXX";
+    char byte;
+    int fd, ret = 1;
+
+    fd = mkstemp(path);
+    if (fd < 0)
+        return 1;
+    close(fd);
+
+    if (!write_segment(path) || !recovered(path, "intact", TEST_RECORDS))
+        goto out;
+
+    /* torn in the payload of the last record */
+    if (truncate(path, ends[TEST_RECORDS] - 5) != 0 || !recovered(path, "torn payload", TEST_RECORDS - 1))
+        goto out;
+
+    /* torn in the header of the next to last record */
+    if (!write_segment(path) || truncate(path, ends[TEST_RECORDS - 1] + WAL_HEADER_SIZE / 2) != 0 ||
+        !recovered(path, "torn header", TEST_RECORDS - 1))
+        goto out;
+
+    /* a flipped byte in the payload of record 7 takes it and the records after it */
+    if (!write_segment(path))
+        goto out;
+    fd = open(path, O_RDWR);
+    if (fd < 0 || pread(fd, &byte, 1, ends[7] - 3) != 1)
+        goto out;
+    byte ^= 0x20;
+    if (pwrite(fd, &byte, 1, ends[7] - 3) != 1) {
+        close(fd);
+        goto out;
+    }
+    close(fd);
+    if (!recovered(path, "payload CRC mismatch", 6))
+        goto out;
+
+    /* so does one in the length of record 3, which the header CRC covers */
+    if (!write_segment(path))
+        goto out;
+    fd = open(path, O_RDWR);
+    if (fd < 0 || pread(fd, &byte, 1, ends[2]) != 1)
+        goto out;
+    byte ^= 0x01;
+    if (pwrite(fd, &byte, 1, ends[2]) != 1) {
+        close(fd);
+        goto out;
+    }
+    close(fd);
+    if (!recovered(path, "header CRC mismatch", 2))
+        goto out;
+    ret = 0;
+
+out:
+    unlink(path);
+    return ret;
+}